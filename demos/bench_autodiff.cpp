@@ -0,0 +1,180 @@
+#include <cstdlib>
+#include <new>
+#include <iostream>
+#include <chrono>
+#include <cmath>
+#include <vector>
+
+#include <autodiff.hpp>
+
+using namespace ASC_ode;
+
+
+// every heap allocation of the program goes through here
+static size_t allocations = 0;
+
+void * operator new (size_t size)
+{
+  allocations++;
+  if (void * p = std::malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
+void * operator new (size_t size, std::align_val_t align)
+{
+  allocations++;
+  if (void * p = std::aligned_alloc(size_t(align), (size + size_t(align) - 1) / size_t(align) * size_t(align)))
+    return p;
+  throw std::bad_alloc();
+}
+void operator delete (void * p) noexcept { std::free(p); }
+void operator delete (void * p, size_t) noexcept { std::free(p); }
+void operator delete (void * p, std::align_val_t) noexcept { std::free(p); }
+void operator delete (void * p, size_t, std::align_val_t) noexcept { std::free(p); }
+
+
+template <typename FUNC>
+double Time (FUNC && func, int runs)
+{
+  auto start = std::chrono::high_resolution_clock::now();
+  for (int r = 0; r < runs; r++)
+    func();
+  auto end = std::chrono::high_resolution_clock::now();
+  return std::chrono::duration<double>(end - start).count() / runs;
+}
+
+// keeps results alive, so the timed loops are not optimised away
+volatile double sink;
+
+
+// rhs of the pendulum, and of a chain of N masses between nonlinear springs
+template <typename T>
+void Pendulum (const T * x, T * f)
+{
+  f[0] = x[1];
+  f[1] = -9.81 * sin(x[0]);
+}
+
+template <size_t N, typename T>
+void Chain (const T * x, T * f)
+{
+  for (size_t i = 0; i < N; i++)
+  {
+    T left = i > 0 ? x[i] - x[i-1] : x[i];
+    T right = i+1 < N ? x[i+1] - x[i] : T(0.0) - x[i];
+    f[i] = right - left + 0.1 * (right * right * right - left * left * left);
+  }
+}
+
+
+// Jacobian with N directions, FixedAutoDiff<N> against the dynamic AutoDiff
+template <size_t N, typename FUNC>
+void BenchmarkFixed (const std::string & name, FUNC && func, int runs)
+{
+  volatile double x[N];
+  for (size_t i = 0; i < N; i++) x[i] = 0.1 * (i+1);
+
+  double tfixed = Time([&]
+  {
+    FixedAutoDiff<N> xad[N], fad[N];
+    for (size_t i = 0; i < N; i++) xad[i] = FixedAutoDiff<N>(x[i], i);
+    func(xad, fad);
+    sink = fad[N-1].deriv()[0];
+  }, runs);
+
+  double tdyn = Time([&]
+  {
+    AutoDiff<> xad[N], fad[N];
+    for (size_t i = 0; i < N; i++) xad[i] = AutoDiff<>(x[i], i, N);
+    func(xad, fad);
+    sink = fad[N-1].deriv()[0];
+  }, runs);
+
+  std::cout << name << ": AutoDiff " << tdyn*1e9 << " ns, FixedAutoDiff " << tfixed*1e9
+            << " ns, speedup " << tdyn/tfixed << std::endl;
+}
+
+
+// r = expression over n derivatives: the SIMD kernel of AutoDiff assignment
+// against the element-wise loop it replaces
+void BenchmarkSIMD (size_t n, int runs)
+{
+  AutoDiff<> a(0.3, n), b(-0.7, n), c(1.1, n), r(0.0, n);
+  for (size_t i = 0; i < n; i++)
+  {
+    a.deriv()[i] = 0.1 * i;
+    b.deriv()[i] = 1.0 - 0.01 * i;
+    c.deriv()[i] = 0.5;
+  }
+  auto ex = a * b + sin(c) * a - 2.0 * exp(b - c) / c;
+
+  double tsimd = Time([&] { r = ex; sink = r.deriv()[n-1]; }, runs);
+  double tscalar = Time([&]
+  {
+    for (size_t i = 0; i < n; i++)
+      r.deriv()[i] = ex.derivAt(i);
+    sink = r.deriv()[n-1];
+  }, runs);
+
+  std::cout << "n = " << n << ": element-wise " << tscalar*1e9 << " ns, SIMD" << SIMDWidth
+            << " " << tsimd*1e9 << " ns, speedup " << tscalar/tsimd << std::endl;
+}
+
+
+// Jacobian of a chain of n masses with dynamic AutoDiff, from the heap and from an arena
+void BenchmarkArena (size_t n, int runs)
+{
+  std::vector<double> x(n);
+  for (size_t i = 0; i < n; i++) x[i] = 0.01 * (i+1);
+  std::vector<AutoDiff<>> xad(n), fad(n);
+
+  auto jacobian = [&]
+  {
+    for (size_t i = 0; i < n; i++) xad[i] = AutoDiff<>(x[i], i, n);
+    for (size_t i = 0; i < n; i++)
+    {
+      AutoDiff<> left = i > 0 ? AutoDiff<>(xad[i] - xad[i-1]) : xad[i];
+      AutoDiff<> right = i+1 < n ? AutoDiff<>(xad[i+1] - xad[i]) : AutoDiff<>(-xad[i]);
+      fad[i] = right - left + 0.1 * (right * right * right - left * left * left);
+    }
+    sink = fad[n-1].deriv()[n-1];
+  };
+
+  DerivArena arena;
+  auto arenaJacobian = [&]
+  {
+    ArenaScope scope(arena);
+    jacobian();
+    for (auto & ad : xad) ad = AutoDiff<>();   // give the storage back before the reset
+    for (auto & ad : fad) ad = AutoDiff<>();
+  };
+
+  jacobian();
+  arenaJacobian();
+  size_t before = allocations;
+  double theap = Time(jacobian, runs);
+  size_t heapallocs = (allocations - before) / runs;
+  before = allocations;
+  double tarena = Time(arenaJacobian, runs);
+  size_t arenaallocs = (allocations - before) / runs;
+
+  std::cout << "n = " << n << ": heap " << heapallocs << " allocations, " << theap*1e6 << " us; arena "
+            << arenaallocs << " allocations, " << tarena*1e6 << " us, speedup " << theap/tarena << std::endl;
+}
+
+
+int main()
+{
+  std::cout << "Jacobians of small systems (user-001)" << std::endl;
+  BenchmarkFixed<2> ("pendulum, n = 2", [](auto x, auto f) { Pendulum(x, f); }, 1000000);
+  BenchmarkFixed<6> ("chain, n = 6", [](auto x, auto f) { Chain<6>(x, f); }, 200000);
+  BenchmarkFixed<12> ("chain, n = 12", [](auto x, auto f) { Chain<12>(x, f); }, 100000);
+
+  std::cout << "AutoDiff derivative kernels (user-005)" << std::endl;
+  for (size_t n : { 50, 100, 500 })
+    BenchmarkSIMD (n, 200000);
+
+  std::cout << "dynamic AutoDiff Jacobians from an arena (user-007)" << std::endl;
+  for (size_t n : { 20, 100 })
+    BenchmarkArena (n, 2000);
+}
@@ -0,0 +1,72 @@
+#include <iostream>
+#include <chrono>
+#include <cmath>
+
+#include <nonlinfunc.hpp>
+#include <timestepper.hpp>
+#include <implicitRK.hpp>
+
+#include "spring_chain.hpp"
+
+using namespace ASC_ode;
+
+
+// Solves one Newton correction of the s*n stage system of ImplicitRungeKutta,
+// once by explicit inversion (the former NewtonSolver) and once by DenseLU.
+void Benchmark (size_t n, int stages, int runs)
+{
+  Vector<> c(stages), w(stages);
+  GaussLegendre(c, w);
+  auto [a, b] = ComputeABfromC(c);
+
+  auto rhs = std::make_shared<SpringChain>(n);
+  auto yold = std::make_shared<ConstantFunction>(stages*n);
+  auto tau = std::make_shared<Parameter>(0.1);
+  auto knew = std::make_shared<IdentityFunction>(stages*n);
+  auto equ = Simplify(knew - Compose(std::make_shared<MultipleFunc>(rhs, stages),
+                                     yold + tau*std::make_shared<MatVecFunc>(a, n)));
+
+  size_t dim = stages*n;
+  Vector<> y(dim), k(dim), res(dim), xinv(dim), xlu(dim);
+  for (size_t i = 0; i < dim; i++)
+  {
+    y(i) = std::sin(0.1*i);
+    k(i) = std::cos(0.3*i);
+  }
+  yold->set(y);
+  Matrix<> jac(dim, dim), inv(dim, dim);
+  equ->evaluateWithDeriv(k, res, jac);
+
+  auto start = std::chrono::steady_clock::now();
+  for (int r = 0; r < runs; r++)
+  {
+    inv = jac;
+    calcInverse(inv);
+    xinv = inv*res;
+  }
+  std::chrono::duration<double> tinv = std::chrono::steady_clock::now() - start;
+
+  DenseLU<double> lu;
+  start = std::chrono::steady_clock::now();
+  for (int r = 0; r < runs; r++)
+  {
+    lu.factor(jac);
+    lu.solve(res, xlu);
+  }
+  std::chrono::duration<double> tlu = std::chrono::steady_clock::now() - start;
+
+  std::cout << "s = " << stages << ", n = " << n << ", system size " << dim
+            << ":  inverse " << tinv.count()/runs*1e3 << " ms"
+            << ",  LU " << tlu.count()/runs*1e3 << " ms"
+            << ",  speedup " << tinv.count()/tlu.count()
+            << ",  difference " << norm(xinv-xlu) << std::endl;
+}
+
+
+int main()
+{
+  for (size_t n : { 10, 50, 100, 200 })
+    Benchmark(n, 3, n <= 50 ? 100 : 10);
+  Benchmark(100, 5, 10);
+  return 0;
+}
@@ -0,0 +1,57 @@
+#include <iostream>
+#include <chrono>
+#include <cmath>
+
+#include <nonlinfunc.hpp>
+#include <timestepper.hpp>
+#include <implicitRK.hpp>
+
+#include "spring_chain.hpp"
+
+using namespace ASC_ode;
+
+
+// Integrates the chain with Radau IIA, once with the monolithic s*n stage
+// system of ImplicitRungeKutta and once with TransformedRungeKutta, which
+// factors one n x n system per real eigenvalue / conjugate pair of A.
+void Benchmark (size_t n, int stages, int steps)
+{
+  Vector<> c(stages), w(stages);
+  GaussRadau(c, w);
+  auto [a, b] = ComputeABfromC(c);
+  auto rhs = std::make_shared<SpringChain>(n);
+
+  Vector<> y1(n), y2(n);
+  for (size_t i = 0; i < n; i++)
+    y1(i) = y2(i) = std::sin(0.1*i);
+
+  ImplicitRungeKutta irk(rhs, a, b, c);
+  TransformedRungeKutta trk(rhs, a, b, c);
+  double tau = 0.05;
+
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < steps; i++)
+    irk.DoStep(tau, y1);
+  std::chrono::duration<double> tirk = std::chrono::steady_clock::now() - start;
+
+  start = std::chrono::steady_clock::now();
+  for (int i = 0; i < steps; i++)
+    trk.DoStep(tau, y2);
+  std::chrono::duration<double> ttrk = std::chrono::steady_clock::now() - start;
+
+  std::cout << "s = " << stages << ", n = " << n
+            << ":  monolithic " << tirk.count()/steps*1e3 << " ms"
+            << ",  transformed " << ttrk.count()/steps*1e3 << " ms"
+            << (trk.sparse() ? " (sparse)" : " (dense)")
+            << ",  speedup " << tirk.count()/ttrk.count()
+            << ",  difference " << norm(y1-y2) << std::endl;
+}
+
+
+int main()
+{
+  for (int stages : { 2, 3, 5 })
+    for (size_t n : { 30, 1000, 5000 })
+      Benchmark(n, stages, 10);
+  return 0;
+}
@@ -0,0 +1,66 @@
+#ifndef SPRING_CHAIN_HPP
+#define SPRING_CHAIN_HPP
+
+// test problem shared by the demos and benchmarks
+
+#include <nonlinfunc.hpp>
+
+namespace ASC_ode
+{
+
+  // chain of n nonlinear springs: f_i = x_{i-1} - 2 x_i + x_{i+1} - x_i^3,
+  // with a sparse Jacobian but no directional derivative of its own
+  class SpringChain : public NonlinearFunction
+  {
+    size_t n;
+  public:
+    SpringChain (size_t _n) : n(_n) { }
+    size_t dimX() const override { return n; }
+    size_t dimF() const override { return n; }
+
+    void evaluate (VectorView<double> x, VectorView<double> f) const override
+    {
+      for (size_t i = 0; i < n; i++)
+      {
+        f(i) = -2*x(i) - x(i)*x(i)*x(i);
+        if (i > 0) f(i) += x(i-1);
+        if (i+1 < n) f(i) += x(i+1);
+      }
+    }
+
+    void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const override
+    {
+      df = 0.0;
+      for (size_t i = 0; i < n; i++)
+      {
+        df(i,i) = -2 - 3*x(i)*x(i);
+        if (i > 0) df(i,i-1) = 1;
+        if (i+1 < n) df(i,i+1) = 1;
+      }
+    }
+
+    void addJacobianPattern (SparsityPattern & pattern, size_t firstf, size_t firstx) const override
+    {
+      for (size_t i = 0; i < n; i++)
+      {
+        pattern.add(firstf+i, firstx+i);
+        if (i > 0) pattern.add(firstf+i, firstx+i-1);
+        if (i+1 < n) pattern.add(firstf+i, firstx+i+1);
+      }
+    }
+
+    void addJacobian (VectorView<double> x, SparseMatrix<double> & df, double fac,
+                      size_t firstf, size_t firstx) const override
+    {
+      for (size_t i = 0; i < n; i++)
+      {
+        df.add(firstf+i, firstx+i, fac*(-2 - 3*x(i)*x(i)));
+        if (i > 0) df.add(firstf+i, firstx+i-1, fac);
+        if (i+1 < n) df.add(firstf+i, firstx+i+1, fac);
+      }
+    }
+  };
+
+}
+
+#endif
@@ -0,0 +1,323 @@
+#include <iostream>
+#include <cmath>
+#include <string>
+#include <array>
+#include <cstdint>
+#include <optional>
+
+#include <autodiff.hpp>
+#include <reverseAD.hpp>
+#include <hessian.hpp>
+
+#include "test_check.hpp"
+
+using namespace ASC_ode;
+
+
+// uses every operator and elementary function of the AD types
+template <typename T>
+T TestFunc (T x, T y, T z)
+{
+  T a = x * y + sin(z) - 2.0 * x / y;
+  T b = exp(0.5 * a) + log(y * y + 1.0) - cos(x - z);
+  T c = sqrt(x * x + z * z + 1.0) / (3.0 - y) + 1.0 / b;
+  c += a;
+  c *= y;
+  c -= x;
+  c /= b;
+  return c - (-a) * 0.5 + z / 2.0 - 1.0;
+}
+
+const std::array<double, 3> x0 { 0.7, -1.3, 0.4 };
+volatile double sink;
+
+
+// value and central difference gradient of TestFunc at x0
+double Reference (std::array<double, 3> & grad)
+{
+  double h = 1e-6;
+  for (size_t i = 0; i < 3; i++)
+  {
+    auto xp = x0, xm = x0;
+    xp[i] += h;
+    xm[i] -= h;
+    grad[i] = (TestFunc(xp[0], xp[1], xp[2]) - TestFunc(xm[0], xm[1], xm[2])) / (2*h);
+  }
+  return TestFunc(x0[0], x0[1], x0[2]);
+}
+
+// value and gradient agree with finite differences, and with the dynamic AutoDiff
+void CheckGradient (const std::string & name, double val, const std::array<double, 3> & grad)
+{
+  std::array<double, 3> fd;
+  double fval = Reference(fd);
+  AutoDiff<> ad = TestFunc(AutoDiff<>(x0[0], 0, 3), AutoDiff<>(x0[1], 1, 3), AutoDiff<>(x0[2], 2, 3));
+
+  bool valok = Near(val, fval, 1e-14), fdok = true, adok = Near(ad.value(), fval, 1e-14);
+  for (size_t i = 0; i < 3; i++)
+  {
+    fdok &= Near(grad[i], fd[i], 1e-7);
+    adok &= Near(grad[i], ad.deriv()[i], 1e-14);
+  }
+  Check (valok, name + ": value");
+  Check (fdok, name + ": gradient vs finite differences");
+  Check (adok, name + ": gradient vs AutoDiff");
+}
+
+
+int main()
+{
+  // FixedAutoDiff
+  {
+    auto f = TestFunc(FixedAutoDiff<3>(x0[0], 0), FixedAutoDiff<3>(x0[1], 1), FixedAutoDiff<3>(x0[2], 2));
+    CheckGradient ("FixedAutoDiff<3>", f.value(), f.deriv());
+
+    // a partial seeding: derivative w.r.t. y only
+    auto fy = TestFunc(FixedAutoDiff<1>(x0[0]), FixedAutoDiff<1>(x0[1], 0), FixedAutoDiff<1>(x0[2]));
+    Check (Near(fy.value(), f.value(), 1e-14) && Near(fy.deriv()[0], f.deriv()[1], 1e-14),
+           "FixedAutoDiff<1>: single direction");
+  }
+
+  // expression-template AutoDiff
+  {
+    AutoDiff<> x(x0[0], 0, 3), y(x0[1], 1, 3), z(x0[2], 2, 3);
+    AutoDiff<> f = TestFunc(x, y, z);
+    CheckGradient ("AutoDiff", f.value(), { f.deriv()[0], f.deriv()[1], f.deriv()[2] });
+
+    // one fused expression equals the same computed step by step
+    AutoDiff<> fused = sin(x) * y / (1.0 + z * z) - 2.0 * exp(x - y);
+    AutoDiff<> t1 = sin(x), t2 = t1 * y, t3 = z * z, t4 = 1.0 + t3, t5 = t2 / t4;
+    AutoDiff<> t6 = x - y, t7 = exp(t6), t8 = 2.0 * t7, steps = t5 - t8;
+    bool same = Near(fused.value(), steps.value(), 1e-15);
+    for (size_t i = 0; i < 3; i++)
+      same &= Near(fused.deriv()[i], steps.deriv()[i], 1e-15);
+    Check (same, "AutoDiff: fused expression equals step by step");
+
+    // constants without derivatives are zero-extended
+    AutoDiff<> k(2.0);
+    AutoDiff<> kx = k * x + k;
+    Check (k.size() == 0 && kx.size() == 3 && kx.value() == 2*x0[0]+2
+           && kx.deriv()[0] == 2 && kx.deriv()[1] == 0,
+           "AutoDiff: constant operand without derivatives");
+
+    // derivative() of an unevaluated expression, and of a plain number
+    Check (Near(derivative(sin(x), 0), std::cos(x0[0]), 1e-15) && derivative(x * y, 1) == x0[0]
+           && derivative(x * y, 2) == 0 && derivative(2.5, 0) == 0,
+           "AutoDiff: derivative of an expression");
+
+    // debug builds detect an expression that outlived its operand
+#ifndef NDEBUG
+    std::optional<AutoDiff<>> tmp(std::in_place, 1.5, 0, 3);
+    auto dangling = *tmp * 2.0 + x;
+    tmp.reset();
+    Check (Throws<std::logic_error>([&] { AutoDiff<> r = dangling; }),
+           "AutoDiff: expression evaluated after its operand was destroyed throws");
+#endif
+
+    // the target may appear in the expression, its storage is reused
+    AutoDiff<> w = x;
+    const double * data = w.deriv().data();
+    w = w * w + sin(w);
+    Check (w.deriv().data() == data && Near(w.value(), x0[0]*x0[0] + std::sin(x0[0]), 1e-15)
+           && Near(w.deriv()[0], 2*x0[0] + std::cos(x0[0]), 1e-15) && w.deriv()[1] == 0,
+           "AutoDiff: aliased assignment in place");
+  }
+
+  // SIMD packs and the vectorised derivative kernels
+  {
+    alignas(SIMDAlignment) double a[SIMDWidth], b[SIMDWidth], r[SIMDWidth];
+    for (size_t i = 0; i < SIMDWidth; i++) { a[i] = i + 1; b[i] = 0.5 - i; }
+    using P = SIMD<double, SIMDWidth>;
+    (P::load(a) * P::load(b) + P(2.0) - P::load(a)).store(r);
+    bool packok = true;
+    for (size_t i = 0; i < SIMDWidth; i++)
+      packok &= r[i] == a[i] * b[i] + 2.0 - a[i];
+    Check (packok, "SIMD<double," + std::to_string(SIMDWidth) + ">: load, store, + - *");
+
+    double a3[3] = { 1, 2, 3 };
+    SIMD<double, 3> g = SIMD<double, 3>(2.0) * SIMD<double, 3>::load(a3) - SIMD<double, 3>(1.0);
+    Check (g[0] == 1 && g[1] == 3 && g[2] == 5, "SIMD<double,3>: scalar fallback");
+
+    // the packed kernel equals the element-wise derivatives, for lengths around the padding
+    bool kernelok = true, layoutok = true;
+    for (size_t n = 1; n <= 2*SIMDWidth+1; n++)
+    {
+      AutoDiff<> u(0.3, 0, n), v(-0.8, n-1, n), s(1.7, n);
+      for (size_t i = 0; i < n; i++) { u.deriv()[i] += 0.1*i; s.deriv()[i] = 1.0 - 0.2*i; }
+      auto ex = u * v + sin(s) * u - v / s + 3.0 * exp(u - s);
+      AutoDiff<> res = ex;
+      for (size_t i = 0; i < n; i++)
+        kernelok &= Near(res.deriv()[i], ex.derivAt(i), 1e-15);
+      layoutok &= reinterpret_cast<uintptr_t>(res.deriv().data()) % SIMDAlignment == 0
+        && res.deriv().capacity() % SIMDWidth == 0 && res.size() == n;
+    }
+    Check (kernelok, "AutoDiff: SIMD kernel equals element-wise derivatives");
+    Check (layoutok, "AutoDiff: derivative storage aligned and padded");
+  }
+
+  // arena allocation of the derivative vectors
+  {
+    DerivArena arena(4096);
+    AutoDiff<> heap = TestFunc(AutoDiff<>(x0[0], 0, 3), AutoDiff<>(x0[1], 1, 3), AutoDiff<>(x0[2], 2, 3));
+    bool same = true, active = true;
+    size_t capacity = 0;
+    for (int pass = 0; pass < 3; pass++)
+    {
+      ArenaScope scope(arena);
+      active &= DerivArena::active() == &arena;
+      AutoDiff<> f = TestFunc(AutoDiff<>(x0[0], 0, 3), AutoDiff<>(x0[1], 1, 3), AutoDiff<>(x0[2], 2, 3));
+      same &= f.value() == heap.value();
+      for (size_t i = 0; i < 3; i++)
+        same &= f.deriv()[i] == heap.deriv()[i];
+      if (pass == 0) capacity = arena.capacity();
+    }
+    Check (active, "DerivArena: active in its scope");
+    Check (same, "DerivArena: same results as the heap");
+    Check (capacity > 0 && arena.capacity() == capacity, "DerivArena: later passes reuse the blocks");
+    Check (DerivArena::active() == nullptr, "DerivArena: heap again after the scope");
+
+    // nested scopes restore the outer arena, blocks larger than the block size
+    DerivArena inner(64);
+    {
+      ArenaScope outer(arena);
+      {
+        ArenaScope scope(inner);
+        AutoDiff<> big(1.0, 0, 100);
+        Check (inner.capacity() >= 100 * sizeof(double), "DerivArena: oversized allocation");
+      }
+      Check (DerivArena::active() == &arena, "DerivArena: nested scope restores the outer arena");
+    }
+
+    // storage of a value that outlived its scope is not given back to a later scope
+    AutoDiff<> outlived;
+    {
+      ArenaScope scope(arena);
+      outlived = AutoDiff<>(1.0, 0, 3);
+    }
+    {
+      ArenaScope scope(arena);
+      AutoDiff<> a(2.0, 0, 3);
+      outlived = AutoDiff<>();
+      AutoDiff<> b(3.0, 1, 3);
+      Check (a.deriv().data() != b.deriv().data() && a.deriv()[0] == 1 && b.deriv()[0] == 0,
+             "DerivArena: stale storage does not roll back newer allocations");
+    }
+
+    // debug builds detect derivatives used after their scope
+#ifndef NDEBUG
+    {
+      ArenaScope scope(arena);
+      outlived = AutoDiff<>(1.0, 0, 3);
+    }
+    Check (Throws<std::logic_error>([&] { sink = outlived.deriv()[0]; }),
+           "DerivArena: derivatives used after the scope throw");
+    Check (Throws<std::logic_error>([&] { AutoDiff<> copy = outlived; }),
+           "DerivArena: copy after the scope throws");
+    outlived = AutoDiff<>();
+#endif
+
+    // releasing the most recent allocation rolls the pointer back
+    void * p1 = arena.allocate(100);
+    arena.deallocate(p1, 100);
+    void * p2 = arena.allocate(100);
+    Check (p1 == p2, "DerivArena: last allocation given back");
+    arena.reset();
+  }
+
+  // ReverseAD: one backward sweep, on a tape reused between calls
+  {
+    Tape<> tape;
+    Vector<> x(3), grad(3);
+    for (size_t i = 0; i < 3; i++) x(i) = x0[i];
+    auto func = [](auto x) { return TestFunc(x(0), x(1), x(2)); };
+
+    double val = ReverseGradient(tape, func, x, grad);
+    CheckGradient ("ReverseAD", val, { grad(0), grad(1), grad(2) });
+
+    size_t nodes = tape.size();
+    grad = 0.0;
+    double val2 = ReverseGradient(tape, func, x, grad);
+    Check (val2 == val && tape.size() == nodes, "ReverseAD: reused tape records the same nodes");
+
+    // gradient of many variables in one sweep
+    Vector<> y(100), gy(100);
+    for (size_t i = 0; i < 100; i++) y(i) = 0.01 * i;
+    ReverseGradient(tape, [](auto y)
+    {
+      auto sum = y(0) * y(0);
+      for (size_t i = 1; i < y.size(); i++)
+        sum += y(i) * y(i);
+      return sum;
+    }, y, gy);
+    bool gyok = true;
+    for (size_t i = 0; i < 100; i++)
+      gyok &= Near(gy(i), 2 * y(i), 1e-15);
+    Check (gyok, "ReverseAD: gradient of sum y_i^2 with 100 variables");
+
+    // constants need no tape, variables do
+    ReverseAD<> c = sin(ReverseAD<>(1.0)) * 2.0;
+    Check (c.isConstant() && c.value() == 2 * std::sin(1.0), "ReverseAD: constants without a tape");
+
+    ReverseAD<> v;
+    {
+      TapeScope<> scope(tape);
+      v = ReverseAD<>::variable(1.0);
+    }
+    Check (Throws<std::logic_error>([&] { v = v * v; }), "ReverseAD: operation without an active tape throws");
+  }
+
+  // second derivatives: full Hessian, and Hessian-vector products
+  {
+    auto func = [](auto x) { return TestFunc(x(0), x(1), x(2)); };
+    Vector<> x(3), grad(3), v(3), hvgrad(3), hv(3);
+    Matrix<> hess(3, 3);
+    for (size_t i = 0; i < 3; i++) { x(i) = x0[i]; v(i) = 1.0 - 0.6 * i; }
+
+    double val = HessianFixed<3>(func, x, grad, hess);
+    CheckGradient ("HessianFixed", val, { grad(0), grad(1), grad(2) });
+
+    // columns of the Hessian by central differences of the AutoDiff gradient
+    auto adgrad = [](std::array<double, 3> p)
+    {
+      return TestFunc(AutoDiff<>(p[0], 0, 3), AutoDiff<>(p[1], 1, 3), AutoDiff<>(p[2], 2, 3));
+    };
+    bool fdok = true, symok = true;
+    double h = 1e-5;
+    for (size_t j = 0; j < 3; j++)
+    {
+      auto xp = x0, xm = x0;
+      xp[j] += h;
+      xm[j] -= h;
+      AutoDiff<> gp = adgrad(xp), gm = adgrad(xm);
+      for (size_t i = 0; i < 3; i++)
+      {
+        fdok &= Near(hess(i, j), (gp.deriv()[i] - gm.deriv()[i]) / (2*h), 1e-7);
+        symok &= Near(hess(i, j), hess(j, i), 1e-14);
+      }
+    }
+    Check (fdok, "HessianFixed: Hessian vs finite differences of the gradient");
+    Check (symok, "HessianFixed: Hessian symmetric");
+
+    Tape<FixedAutoDiff<1>> tape;
+    double hvval = HessianVectorProduct(tape, func, x, v, hvgrad, hv);
+    bool hvok = Near(hvval, val, 1e-14);
+    for (size_t i = 0; i < 3; i++)
+    {
+      double ref = 0;
+      for (size_t j = 0; j < 3; j++)
+        ref += hess(i, j) * v(j);
+      hvok &= Near(hv(i), ref, 1e-13) && Near(hvgrad(i), grad(i), 1e-14);
+    }
+    Check (hvok, "HessianVectorProduct: value, gradient and H*v vs HessianFixed");
+
+    // nested forward mode: second derivative of one variable
+    FixedAutoDiff<1, FixedAutoDiff<1>> t(FixedAutoDiff<1>(0.8, 0), 0);
+    auto e = exp(t * t);
+    double ref2 = (2 + 4*0.64) * std::exp(0.64);
+    Check (Near(e.deriv()[0].deriv()[0], ref2, 1e-14) && Near(e.deriv()[0].value(), 1.6*std::exp(0.64), 1e-14),
+           "FixedAutoDiff<1,FixedAutoDiff<1>>: second derivative");
+  }
+
+  std::cout << (ok ? "all AD tests passed" : "AD tests failed") << std::endl;
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,161 @@
+#include <cstdlib>
+#include <new>
+#include <iostream>
+#include <cmath>
+#include <functional>
+#include <string>
+
+#include <nonlinfunc.hpp>
+#include <timestepper.hpp>
+#include <implicitRK.hpp>
+#include <embeddedRK.hpp>
+
+#include "spring_chain.hpp"
+#include "mass_spring.hpp"
+
+using namespace ASC_ode;
+
+
+// every heap allocation of the program goes through here
+static size_t allocations = 0;
+
+void * operator new (size_t size)
+{
+  allocations++;
+  if (void * p = std::malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
+// AutoDiff derivative storage is over-aligned and comes through these
+void * operator new (size_t size, std::align_val_t align)
+{
+  allocations++;
+  if (void * p = std::aligned_alloc(size_t(align), (size + size_t(align) - 1) / size_t(align) * size_t(align)))
+    return p;
+  throw std::bad_alloc();
+}
+void operator delete (void * p) noexcept { std::free(p); }
+void operator delete (void * p, size_t) noexcept { std::free(p); }
+void operator delete (void * p, std::align_val_t) noexcept { std::free(p); }
+void operator delete (void * p, size_t, std::align_val_t) noexcept { std::free(p); }
+
+
+// y' = (v, a(x)) for y = (x, v) of a hanging chain of masses: the
+// accelerations come from MSS_Function, with AutoDiff Jacobians
+std::shared_ptr<NonlinearFunction> MassSpringChain (MassSpringSystem<2> & mss, size_t masses)
+{
+  mss.setGravity( {0, -9.81} );
+  Connector prev = mss.addFix( { { 0.0, 0.0 } } );
+  for (size_t i = 0; i < masses; i++)
+  {
+    Connector next = mss.addMass( { 1, { double(i+1), 0.0 } } );
+    mss.addSpring( { 1, 100, { prev, next } } );
+    prev = next;
+  }
+  size_t n = 2*masses;
+  auto velocity = std::make_shared<EmbedFunction>(std::make_shared<IdentityFunction>(n), n, 2*n, 0, 2*n);
+  auto acceleration = std::make_shared<EmbedFunction>(std::make_shared<MSS_Function<2>>(mss), 0, 2*n, n, 2*n);
+  return velocity + acceleration;
+}
+
+
+// Steps warmup times from y0, so that all lazily allocated scratch exists,
+// then counts the allocations of further steps, which must be none.
+bool Check (const std::string & name, TimeStepper & stepper, const Vector<> & y0)
+{
+  Vector<> y = y0;
+  int warmup = 5, steps = 20;
+  for (int i = 0; i < warmup; i++)
+    stepper.DoStep(0.01, y);
+
+  size_t before = allocations;
+  for (int i = 0; i < steps; i++)
+    stepper.DoStep(0.01, y);
+  size_t count = allocations - before;
+
+  std::cout << (count ? "FAILED " : "ok     ") << name << ", n = " << y.size()
+            << ": " << count << " allocations in " << steps << " steps" << std::endl;
+  return count == 0;
+}
+
+// every stepper on one right hand side
+bool CheckSteppers (const std::string & problem, std::shared_ptr<NonlinearFunction> rhs, const Vector<> & y0)
+{
+  bool ok = true;
+  Vector<> c(3), w(3);
+  GaussRadau(c, w);
+  auto [a, b] = ComputeABfromC(c);
+
+  ExplicitEuler ee(rhs);
+  ok &= Check(problem + ", ExplicitEuler", ee, y0);
+  ImprovedEuler ime(rhs);
+  ok &= Check(problem + ", ImprovedEuler", ime, y0);
+  ExplicitRungeKutta erk(rhs, a, b, c);
+  ok &= Check(problem + ", ExplicitRungeKutta", erk, y0);
+  EmbeddedRungeKutta dopri(rhs, DormandPrince());
+  ok &= Check(problem + ", EmbeddedRungeKutta", dopri, y0);
+
+  ImplicitEuler ie(rhs);
+  ok &= Check(problem + ", ImplicitEuler", ie, y0);
+  ImplicitEuler iequad(rhs);
+  iequad.setPredictor(Predictor::Quadratic);
+  ok &= Check(problem + ", ImplicitEuler, quadratic predictor", iequad, y0);
+
+  CrankNicolson cn(rhs);
+  ok &= Check(problem + ", CrankNicolson", cn, y0);
+  CrankNicolson cnsimp(rhs);
+  cnsimp.newton().setMode(NewtonMode::Simplified);
+  cnsimp.setPredictor(Predictor::DenseOutput);
+  ok &= Check(problem + ", CrankNicolson, simplified, dense output predictor", cnsimp, y0);
+  CrankNicolson cnbroyden(rhs);
+  cnbroyden.newton().setMode(NewtonMode::Broyden);
+  ok &= Check(problem + ", CrankNicolson, Broyden", cnbroyden, y0);
+  CrankNicolson cngmres(rhs);
+  cngmres.newton().setLinearSolver(LinearSolver::GMRES);
+  cngmres.newton().setPreconditioner(std::make_shared<JacobiPreconditioner>());
+  ok &= Check(problem + ", CrankNicolson, GMRES", cngmres, y0);
+  CrankNicolson cnblock(rhs);
+  cnblock.newton().setLinearSolver(LinearSolver::GMRES);
+  cnblock.newton().setPreconditioner(std::make_shared<BlockJacobiPreconditioner>(2));
+  ok &= Check(problem + ", CrankNicolson, GMRES, block Jacobi", cnblock, y0);
+
+  ImplicitRungeKutta irk(rhs, a, b, c);
+  ok &= Check(problem + ", ImplicitRungeKutta", irk, y0);
+  ImplicitRungeKutta irkdense(rhs, a, b, c);
+  irkdense.setPredictor(Predictor::DenseOutput);
+  ok &= Check(problem + ", ImplicitRungeKutta, dense output predictor", irkdense, y0);
+  TransformedRungeKutta trk(rhs, a, b, c);
+  ok &= Check(problem + ", TransformedRungeKutta", trk, y0);
+  return ok;
+}
+
+
+int main()
+{
+  bool ok = true;
+
+  // dense below NewtonWorkspace::SparseMinDim, sparse above
+  for (size_t n : { 20, 400 })
+  {
+    Vector<> y0(n);
+    for (size_t i = 0; i < n; i++)
+      y0(i) = std::sin(0.1*i);
+    ok &= CheckSteppers("SpringChain", std::make_shared<SpringChain>(n), y0);
+  }
+
+  // AutoDiff Jacobians: colored dynamic AutoDiff above 12 unknowns, dense and sparse
+  for (size_t masses : { 10, 60 })
+  {
+    MassSpringSystem<2> mss;
+    auto rhs = MassSpringChain(mss, masses);
+    size_t n = 2*masses;
+    Vector<> x(n), dx(n), ddx(n), y0(2*n);
+    mss.getState(x, dx, ddx);
+    y0.range(0, n) = x;
+    y0.range(n, 2*n) = dx;
+    ok &= CheckSteppers("MassSpring", rhs, y0);
+  }
+
+  std::cout << (ok ? "no allocations in warm steps" : "warm steps allocate") << std::endl;
+  return ok ? 0 : 1;
+}
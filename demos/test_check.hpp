@@ -0,0 +1,46 @@
+#ifndef TEST_CHECK_HPP
+#define TEST_CHECK_HPP
+
+// pass/fail bookkeeping shared by the demo tests: every Check prints one
+// line, and main returns nonzero if any of them failed
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <cmath>
+#include <stdexcept>
+
+
+// false once a check failed
+inline bool ok = true;
+
+inline void Check (bool cond, const std::string & what)
+{
+  std::cout << (cond ? "ok     " : "FAILED ") << what << std::endl;
+  ok &= cond;
+}
+
+// short form of x, std::to_string prints 1e-13 as 0.000000
+inline std::string Str (double x)
+{
+  std::ostringstream ost;
+  ost << x;
+  return ost.str();
+}
+
+// |a - b| <= tol, relative to b for |b| > 1
+inline bool Near (double a, double b, double tol)
+{
+  return std::abs(a - b) <= tol * (1 + std::abs(b));
+}
+
+// true if func() throws an EXCEPTION
+template <typename EXCEPTION = std::domain_error, typename FUNC>
+bool Throws (FUNC && func)
+{
+  try { func(); }
+  catch (EXCEPTION &) { return true; }
+  return false;
+}
+
+#endif
@@ -0,0 +1,147 @@
+#include <iostream>
+#include <cmath>
+#include <string>
+
+#include <nonlinfunc.hpp>
+#include <timestepper.hpp>
+#include <embeddedRK.hpp>
+
+#include "test_check.hpp"
+
+using namespace ASC_ode;
+
+
+// harmonic oscillator x'' = -x, exact solution cos t
+class Oscillator : public NonlinearFunction
+{
+public:
+  size_t dimX() const override { return 2; }
+  size_t dimF() const override { return 2; }
+  void evaluate (VectorView<double> x, VectorView<double> f) const override
+  {
+    f(0) = x(1);
+    f(1) = -x(0);
+  }
+  void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const override
+  {
+    df = 0.0;
+    df(0,1) = 1;
+    df(1,0) = -1;
+  }
+};
+
+
+// slope of the global error at t = 1 (order p of b) and of the scaled
+// error estimate of one step (q+1 for the embedded order q), tau -> tau/2
+void CheckOrders (const std::string & name, const EmbeddedTableau & tab, int order, int steps)
+{
+  auto rhs = std::make_shared<Oscillator>();
+  double err[2], est[2];
+  for (int k = 0; k < 2; k++)
+    {
+      int n = steps << k;
+      EmbeddedRungeKutta stepper(rhs, tab);
+      Vector<> y(2);
+      y(0) = 1; y(1) = 0;
+      for (int i = 0; i < n; i++)
+        stepper.DoStep(1.0/n, y);
+      err[k] = std::abs(y(0) - std::cos(1.0));
+
+      y(0) = 1; y(1) = 0;
+      stepper.DoStep(0.5/n, y);
+      est[k] = stepper.error();
+    }
+  double p = std::log2(err[0]/err[1]), q1 = std::log2(est[0]/est[1]);
+  Check (std::abs(p - order) < 0.3, name + ": order " + Str(p) + ", expected " + std::to_string(order));
+  Check (std::abs(q1 - (tab.order+1)) < 0.3, name + ": error estimate order " + Str(q1)
+         + ", expected " + std::to_string(tab.order+1));
+}
+
+
+int main()
+{
+  CheckOrders ("BogackiShampine", BogackiShampine(), 3, 20);
+  CheckOrders ("DormandPrince", DormandPrince(), 5, 10);
+  CheckOrders ("CashKarp", CashKarp(), 5, 10);
+
+  // controller
+  {
+    PIController ctrl(4);
+    Check (ctrl.accept(1e-12) == 5, "PI: tiny error grows by maxfac");
+    ctrl.reset();
+    ctrl.accept(1);
+    Check (std::abs(ctrl.accept(1) - 0.9) < 1e-14, "PI: error 1 twice keeps the step times safety");
+    double r = ctrl.reject(100);
+    Check (r >= 0.2 && r <= 0.9, "PI: rejection shrinks within [minfac, safety]");
+    Check (ctrl.accept(1e-12) == 1, "PI: no growth right after a rejection");
+    Check (ctrl.accept(1e-12) == 5, "PI: growth again after an accepted step");
+    Check (Throws<std::invalid_argument>([&] { ctrl.setLimits(0.9, 2, 5); }), "PI: invalid limits throw");
+  }
+
+  auto rhs = std::make_shared<Oscillator>();
+
+  // tolerance proportionality: the error follows the tolerance
+  for (auto [name, tab] : { std::pair { "BogackiShampine", BogackiShampine() },
+                            std::pair { "DormandPrince", DormandPrince() },
+                            std::pair { "CashKarp", CashKarp() } })
+    {
+      double err[2];
+      int rejected = 0;
+      for (int k = 0; k < 2; k++)
+        {
+          double tol = k == 0 ? 1e-6 : 1e-9;
+          EmbeddedRungeKutta stepper(rhs, tab);
+          stepper.setTolerance(tol, tol);
+          Vector<> y(2);
+          y(0) = 1; y(1) = 0;
+          double t = 0;
+          while (t < 10)
+            t += stepper.AdaptiveStep(y, 10-t);
+          err[k] = std::abs(y(0) - std::cos(10.0));
+          rejected += stepper.rejected();
+          Check (std::abs(t - 10) < 1e-12 && err[k] < 100*tol,
+                 std::string(name) + ", tol " + Str(tol) + ": error " + Str(err[k])
+                 + " in " + std::to_string(stepper.accepted()) + " steps");
+        }
+      Check (err[0]/err[1] > 1e2 && err[0]/err[1] < 1e4,
+             std::string(name) + ": 1000x smaller tolerance, error ratio " + Str(err[0]/err[1]));
+      Check (rejected <= 2, std::string(name) + ": " + std::to_string(rejected) + " rejected steps on a smooth problem");
+    }
+
+  // rejection: a far too large first step is retried smaller
+  {
+    EmbeddedRungeKutta stepper(rhs, DormandPrince());
+    stepper.setInitialStep(5);
+    Vector<> y(2);
+    y(0) = 1; y(1) = 0;
+    double tau = stepper.AdaptiveStep(y, 10);
+    Check (stepper.rejected() > 0 && tau < 5 && stepper.error() <= 1,
+           "rejected first step retried with " + Str(tau));
+
+    EmbeddedRungeKutta strict(rhs, DormandPrince());
+    strict.setInitialStep(5);
+    strict.setMaxRejections(1);
+    Check (Throws([&] { strict.AdaptiveStep(y, 10); }), "too many rejections throw");
+  }
+
+  // a step cut at tmax: the proposal stays if the controller would grow it,
+  // and shrinks if the controller shrinks it
+  {
+    EmbeddedRungeKutta stepper(rhs, DormandPrince());
+    stepper.setInitialStep(0.1);
+    Vector<> y(2);
+    y(0) = 1; y(1) = 0;
+    stepper.AdaptiveStep(y, 0.01);
+    Check (stepper.proposedStep() >= 0.1, "cut step keeps the larger proposal");
+
+    EmbeddedRungeKutta shrinking(rhs, DormandPrince());
+    shrinking.controller().setGains(0, 0);   // constant factor: safety = 0.9
+    shrinking.setInitialStep(0.1);
+    y(0) = 1; y(1) = 0;
+    shrinking.AdaptiveStep(y, 0.01);
+    Check (std::abs(shrinking.proposedStep() - 0.009) < 1e-15, "cut step with shrinking controller shrinks");
+  }
+
+  std::cout << (ok ? "all embedded Runge-Kutta tests passed" : "embedded Runge-Kutta tests failed") << std::endl;
+  return ok ? 0 : 1;
+}
@@ -4,6 +4,7 @@
 #include <nonlinfunc.hpp>
 #include <timestepper.hpp>
 #include <implicitRK.hpp>
+#include <embeddedRK.hpp>
 
 using namespace ASC_ode;
 
@@ -32,6 +33,9 @@ public:
     df(0,1) = 1;
     df(1,0) = -stiffness/mass;
   }
+
+  // linear: implicit steppers factor the Jacobian once per time step size
+  JacobianTraits jacobianTraits () const override { return { true, true, false, 0 }; }
 };
 
 
@@ -65,14 +69,39 @@ public:
 
 int main(int argc, char* argv[])
 {
-  if (argc != 2)
+  bool adaptive = argc == 3 && std::string(argv[1]) == "adaptive";
+  if (argc != 2 && !adaptive)
   {
-    std::cout << "Usage: " << argv[0] << " <steps>" << std::endl;
+    std::cout << "Usage: " << argv[0] << " <steps>" << std::endl
+              << "       " << argv[0] << " adaptive <tolerance>" << std::endl;
     return 1;
   }
 
   double tend = 1.0;
 
+  if (adaptive)
+  {
+    // Dormand-Prince 5(4), the step size follows the error estimate
+    Vector<> y = { 0, 0 };
+    auto rhs = std::make_shared<ElectricNetwork>(100.0, 1e-6);
+    EmbeddedRungeKutta stepper(rhs, DormandPrince());
+    double tol = std::stod(argv[2]);
+    stepper.setTolerance(tol, tol);
+
+    std::ofstream outfile ("../demos/data/electric_circuit/circuit_dopri.txt");
+    double t = 0;
+    outfile << t << "  " << y(0) << " " << y(1) << std::endl;
+    while (t < tend)
+    {
+      double tau = stepper.AdaptiveStep(y, tend-t);
+      t += tau;
+      outfile << t << "  " << y(0) << " " << y(1) << " " << tau << std::endl;
+    }
+    std::cout << "t = " << t << ", y = " << y << ", " << stepper.accepted() << " steps, "
+              << stepper.rejected() << " rejected, " << stepper.evaluations() << " evaluations" << std::endl;
+    return 0;
+  }
+
   // in oder to not build it each time when changing stepsize, we make it an argument
   const int steps = std::stoi(argv[1]);  // get nr steps as argument
 
@@ -102,6 +131,8 @@ int main(int argc, char* argv[])
   // ImplicitEuler stepper(rhs);
   // ImprovedEuler stepper(rhs);
   CrankNicolson stepper(rhs);
+  // keep the Newton factorization over the steps while it contracts well
+  stepper.newton().setMode(NewtonMode::Simplified);
 
   //  ExplicitRungeKutta stepper(rhs, Gauss2a, Gauss2b, Gauss2c);
 
@@ -143,4 +174,5 @@ int main(int argc, char* argv[])
      std::cout << (i+1) * tau << "  " << y(0) << " " << y(1) << " " << steps << std::endl;
      outfile << (i+1) * tau << "  " << y(0) << " " << y(1) << " " <<  steps << std::endl;
   }
+  std::cerr << "Newton: " << stepper.statistics() << std::endl;
 }
@@ -0,0 +1,65 @@
+#include <iostream>
+#include <chrono>
+#include <cmath>
+
+#include "timestepper.hpp"
+#include "staticfunc.hpp"
+
+#include "test_check.hpp"
+
+using namespace ASC_ode;
+using namespace nanoblas;
+
+
+// integrates 'runs' times over [0,1] and returns the run time in seconds and y of the last run
+template <typename STEPPER, typename VEC>
+double Integrate (STEPPER & stepper, VEC & y, int runs, int steps)
+{
+  auto start = std::chrono::steady_clock::now();
+  for (int r = 0; r < runs; r++)
+  {
+    y(0) = 1; y(1) = 0;
+    for (int i = 0; i < steps; i++)
+      stepper.DoStep(1.0/steps, y);
+  }
+  std::chrono::duration<double> time = std::chrono::steady_clock::now() - start;
+  return time.count();
+}
+
+
+// static and dynamic steppers solve the same equations, the results agree up to rounding
+template <typename FUNC>
+void Compare (std::string name, const FUNC & func, int runs, int steps)
+{
+  Vec<2> ys;
+  Vector<> yd(2);
+
+  StaticImplicitEuler<FUNC> sie(func);
+  ImplicitEuler die(MakeDynamic(func));
+  double ts = Integrate(sie, ys, runs, steps);
+  double td = Integrate(die, yd, runs, steps);
+  double diff = std::abs(ys(0)-yd(0)) + std::abs(ys(1)-yd(1));
+  Check (diff < 1e-12, name + " ImplicitEuler:  static " + Str(ts) + " s, dynamic " + Str(td) + " s, "
+         + "difference " + Str(diff));
+
+  StaticCrankNicolson<FUNC> scn(func);
+  CrankNicolson dcn(MakeDynamic(func));
+  ts = Integrate(scn, ys, runs, steps);
+  td = Integrate(dcn, yd, runs, steps);
+  diff = std::abs(ys(0)-yd(0)) + std::abs(ys(1)-yd(1));
+  Check (diff < 1e-12, name + " CrankNicolson:  static " + Str(ts) + " s, dynamic " + Str(td) + " s, "
+         + "difference " + Str(diff));
+}
+
+
+int main()
+{
+  int runs = 1000, steps = 100;
+  std::cout << runs << " integrations with " << steps << " steps each" << std::endl;
+  Compare("MassSpring     ", StaticMassSpring(1.0, 1.0), runs, steps);
+  Compare("Pendulum       ", StaticPendulum(1.0), runs, steps);
+  Compare("ElectricNetwork", StaticElectricNetwork(100.0, 1e-6), runs, steps);
+
+  std::cout << (ok ? "static and dynamic steppers agree" : "static and dynamic steppers differ") << std::endl;
+  return ok ? 0 : 1;
+}
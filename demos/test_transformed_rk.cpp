@@ -0,0 +1,116 @@
+#include <iostream>
+#include <cmath>
+#include <string>
+
+#include <nonlinfunc.hpp>
+#include <timestepper.hpp>
+#include <implicitRK.hpp>
+
+#include "spring_chain.hpp"
+#include "test_check.hpp"
+
+using namespace ASC_ode;
+
+
+// max_i |a v_i - lambda_i v_i|
+double Residual (const Matrix<> & a)
+{
+  auto [lambda, v] = EigenDecomposition(a);
+  double res = 0;
+  for (size_t i = 0; i < a.rows(); i++)
+    for (size_t k = 0; k < a.rows(); k++)
+    {
+      std::complex<double> sum = -lambda[i] * v(k,i);
+      for (size_t j = 0; j < a.rows(); j++)
+        sum += a(k,j) * v(j,i);
+      res = std::max(res, std::abs(sum));
+    }
+  return res;
+}
+
+// steps the spring chain with ImplicitRungeKutta and TransformedRungeKutta,
+// both solve the same stage equations up to the Newton tolerance
+void Compare (const std::string & name, const Vector<> & c, size_t n)
+{
+  auto [a, b] = ComputeABfromC(c);
+  Check (Residual(a) < 1e-12, name + ": eigen decomposition of A");
+
+  auto rhs = std::make_shared<SpringChain>(n);
+  Vector<> y1(n), y2(n);
+  for (size_t i = 0; i < n; i++)
+    y1(i) = y2(i) = std::sin(0.1*i);
+
+  ImplicitRungeKutta irk(rhs, a, b, c);
+  TransformedRungeKutta trk(rhs, a, b, c);
+  for (int step = 0; step < 20; step++)
+  {
+    irk.DoStep(0.05, y1);
+    trk.DoStep(0.05, y2);
+  }
+  double diff = norm(y1 - y2);
+  Check (diff < 1e-9, name + ", n = " + std::to_string(n) + (trk.sparse() ? " (sparse)" : " (dense)")
+         + ": |y_IRK - y_TRK| = " + Str(diff));
+}
+
+
+int main()
+{
+  for (int s : { 2, 3, 5 })
+  {
+    Vector<> c(s), w(s);
+    GaussLegendre(c, w);
+    Compare ("Gauss " + std::to_string(s), c, 30);
+    GaussRadau(c, w);
+    Compare ("Radau IIA " + std::to_string(s), c, 30);
+  }
+  Vector<> c(3), w(3);
+  GaussRadau(c, w);
+  Compare ("Radau IIA 3", c, 400);
+  auto [a, b] = ComputeABfromC(c);
+
+  // a repeated eigenvalue with independent eigenvectors is fine,
+  // a defective matrix is not
+  Matrix<> twice(2, 2);
+  twice = 0.0;
+  twice(0,0) = twice(1,1) = 2;
+  Check (!Throws([&] { EigenDecomposition(twice); }) && Residual(twice) < 1e-14,
+         "EigenDecomposition: 2 I");
+
+  Matrix<> jordan(2, 2);
+  jordan = 0.0;
+  jordan(0,0) = jordan(1,1) = 0.5;
+  jordan(0,1) = 1;
+  Check (Throws([&] { EigenDecomposition(jordan); }), "EigenDecomposition: Jordan block throws");
+
+  // SDIRK, equal diagonal entries: defective Butcher matrix
+  double gamma = 1 - 1/std::sqrt(2.0);
+  Matrix<> sdirk(2, 2);
+  sdirk(0,0) = gamma; sdirk(0,1) = 0;
+  sdirk(1,0) = 1-gamma; sdirk(1,1) = gamma;
+  Vector<> bs(2), cs(2);
+  bs(0) = 1-gamma; bs(1) = gamma;
+  cs(0) = gamma; cs(1) = 1;
+  auto rhs = std::make_shared<SpringChain>(10);
+  Check (Throws([&] { TransformedRungeKutta trk(rhs, sdirk, bs, cs); }),
+         "TransformedRungeKutta: defective Butcher matrix throws");
+
+  // Newton tolerance and iteration limit
+  Vector<> y(10), ystrict(10);
+  for (size_t i = 0; i < 10; i++)
+    y(i) = ystrict(i) = std::sin(0.1*i);
+  TransformedRungeKutta strict(rhs, a, b, c), loose(rhs, a, b, c);
+  loose.setTolerance(1e-4);
+  strict.DoStep(0.1, ystrict);
+  loose.DoStep(0.1, y);
+  Check (loose.statistics().iterations < strict.statistics().iterations && norm(y - ystrict) < 1e-4,
+         "TransformedRungeKutta: setTolerance, " + std::to_string(loose.statistics().iterations) + " instead of "
+         + std::to_string(strict.statistics().iterations) + " iterations");
+
+  TransformedRungeKutta limited(rhs, a, b, c);
+  limited.setTolerance(1e-10, 1);
+  Check (Throws([&] { limited.DoStep(0.1, y); }) && limited.statistics().failures == 1,
+         "TransformedRungeKutta: Newton iteration limit throws");
+
+  std::cout << (ok ? "all transformed Runge-Kutta tests passed" : "transformed Runge-Kutta tests failed") << std::endl;
+  return ok ? 0 : 1;
+}
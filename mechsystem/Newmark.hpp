@@ -2,6 +2,7 @@
 #define NEWMARK_HPP
 
 #include <nonlinfunc.hpp>
+#include <predictor.hpp>
 
 
 
@@ -10,12 +11,17 @@
   // Newmark and generalized alpha:
   // https://miaodi.github.io/finite%20element%20method/newmark-generalized/
   
-  // Newmark method for  mass*d^2x/dt^2 = rhs
-  void SolveODE_Newmark(double tend, int steps,
+  // Newmark method for  mass*d^2x/dt^2 = rhs,
+  // returns the Newton statistics of all steps
+  NewtonStatistics SolveODE_Newmark(double tend, int steps,
                         VectorView<double> x, VectorView<double> dx,
                         std::shared_ptr<NonlinearFunction> rhs,   
                         std::shared_ptr<NonlinearFunction> mass,  
-                        std::function<void(double,VectorView<double>)> callback = nullptr)
+                        std::function<void(double,VectorView<double>)> callback = nullptr,
+                        NewtonMode newtonmode = NewtonMode::Full,
+                        double tol = 1e-10,
+                        std::function<void(NewtonWorkspace&)> configure = nullptr,
+                        Predictor predictor = Predictor::Constant)
   {
     double dt = tend/steps;
     double gamma = 0.5;
@@ -30,15 +36,27 @@
     rhs->evaluate (xold->get(), aold->get());
 
     auto anew = std::make_shared<IdentityFunction>(a.size());
-    auto vnew = vold + dt*((1-gamma)*aold+gamma*anew);
-    auto xnew = xold + dt*vold + dt*dt/2 * ((1-2*beta)*aold+2*beta*anew);    
-
-    auto equ = Compose(mass, anew) - Compose(rhs, xnew);
+    auto vnew = Simplify(vold + dt*((1-gamma)*aold+gamma*anew));
+    auto xnew = Simplify(xold + dt*vold + dt*dt/2 * ((1-2*beta)*aold+2*beta*anew));    
+
+    auto equ = Simplify(Compose(mass, anew) - Compose(rhs, xnew));
+    // dt is fixed, so a constant Jacobian is factored once for all steps,
+    // in simplified mode any Jacobian is kept while Newton contracts well
+    NewtonWorkspace newton(equ);
+    newton.setMode(newtonmode);
+    if (configure) configure(newton);   // e.g. linear solver and preconditioner
+    // Newton starts from the last acceleration, or its extrapolation
+    if (predictor == Predictor::DenseOutput || predictor == Predictor::StageReuse)
+      throw std::invalid_argument("SolveODE_Newmark: Constant, Linear or Quadratic predictor");
+    ValuePredictor apredict;
+    apredict.set(predictor, a.size());
 
     double t = 0;
     for (int i = 0; i < steps; i++)            
       {
-        NewtonSolver (equ, a);
+        apredict.predict(dt, a);
+        NewtonSolver (newton, a, tol);
+        apredict.update(dt, a);
         xnew -> evaluate (a, x);
         vnew -> evaluate (a, v);
 
@@ -49,17 +67,23 @@
         if (callback) callback(t, x);
       }
     dx = v;
+    return newton.statistics();
   }
 
 
 
 
-  // Generalized alpha method for M d^2x/dt^2 = rhs
-  void SolveODE_Alpha (double tend, int steps, double rhoinf,
+  // Generalized alpha method for M d^2x/dt^2 = rhs,
+  // returns the Newton statistics of all steps
+  NewtonStatistics SolveODE_Alpha (double tend, int steps, double rhoinf,
                        VectorView<double> x, VectorView<double> dx, VectorView<double> ddx,
                        std::shared_ptr<NonlinearFunction> rhs,   
                        std::shared_ptr<NonlinearFunction> mass,  
-                       std::function<void(double,VectorView<double>)> callback = nullptr)
+                       std::function<void(double,VectorView<double>)> callback = nullptr,
+                       NewtonMode newtonmode = NewtonMode::Full,
+                       double tol = 1e-10,
+                       std::function<void(NewtonWorkspace&)> configure = nullptr,
+                       Predictor predictor = Predictor::Constant)
   {
     double dt = tend/steps;
     double alpham = (2*rhoinf-1)/(rhoinf+1);
@@ -76,18 +100,28 @@
     // rhs->evaluate (xold->get(), aold->get()); // solve with M ???
 
     auto anew = std::make_shared<IdentityFunction>(a.size());
-    auto vnew = vold + dt*((1-gamma)*aold+gamma*anew);
-    auto xnew = xold + dt*vold + dt*dt/2 * ((1-2*beta)*aold+2*beta*anew);    
+    auto vnew = Simplify(vold + dt*((1-gamma)*aold+gamma*anew));
+    auto xnew = Simplify(xold + dt*vold + dt*dt/2 * ((1-2*beta)*aold+2*beta*anew));    
 
     // auto equ = Compose(mass, (1-alpham)*anew+alpham*aold) - Compose(rhs, (1-alphaf)*xnew+alphaf*xold);
-    auto equ = Compose(mass, (1-alpham)*anew+alpham*aold) - (1-alphaf)*Compose(rhs,xnew) - alphaf*Compose(rhs, xold);
+    auto equ = Simplify(Compose(mass, (1-alpham)*anew+alpham*aold) - (1-alphaf)*Compose(rhs,xnew) - alphaf*Compose(rhs, xold));
+    NewtonWorkspace newton(equ);
+    newton.setMode(newtonmode);
+    if (configure) configure(newton);   // e.g. linear solver and preconditioner
+    // Newton starts from the last acceleration, or its extrapolation
+    if (predictor == Predictor::DenseOutput || predictor == Predictor::StageReuse)
+      throw std::invalid_argument("SolveODE_Alpha: Constant, Linear or Quadratic predictor");
+    ValuePredictor apredict;
+    apredict.set(predictor, a.size());
 
     double t = 0;
     a = ddx;
 
     for (int i = 0; i < steps; i++)
       {
-        NewtonSolver (equ, a);
+        apredict.predict(dt, a);
+        NewtonSolver (newton, a, tol);
+        apredict.update(dt, a);
         xnew -> evaluate (a, x);
         vnew -> evaluate (a, v);
 
@@ -99,6 +133,7 @@
       }
     dx = v;
     ddx = a;
+    return newton.statistics();
   }
 
 
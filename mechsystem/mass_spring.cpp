@@ -28,6 +28,15 @@ int main()
   auto mass = std::make_shared<IdentityFunction> (x.size());
 
   mss.getState (x, dx, ddx);
+
+  // static equilibrium: Newton on the energy gradient, exact Hessian via AutoDiff
+  Vector<> xeq = x;
+  xeq(1) = -0.1;   // start off the straight line, where the transversal stiffness vanishes
+  xeq(3) = -0.2;
+  NewtonSolver (std::make_shared<MSS_EnergyGradient<2>> (mss), xeq, 1e-10, 20,
+                [](int it, double err, VectorView<double>) { std::cout << "it = " << it
+                                                               << ", |grad E| = " << err << std::endl; });
+  std::cout << "equilibrium = " << Vec<4>(xeq) << std::endl;
   
   SolveODE_Newmark(tend, steps, x, dx,  mss_func, mass,
                    [](double t, VectorView<double> x) { std::cout << "t = " << t
@@ -4,6 +4,9 @@
 #include <nonlinfunc.hpp>
 #include <timestepper.hpp>
 #include <autodiff.hpp>
+#include <reverseAD.hpp>
+#include <hessian.hpp>
+#include <algorithm>
 
 using namespace ASC_ode;
 
@@ -141,22 +144,170 @@ std::ostream & operator<< (std::ostream & ost, MassSpringSystem<D> & mss)
     ost << "m = " << m.mass << ", pos = " << m.pos << std::endl;
 
   ost << "springs: " << std::endl;
-  for (auto sp : mss.springs())et_initial_velocities({
-    mA: (0, 0, 1)})
+  for (auto sp : mss.springs())
     ost << "length = " << sp.length << ", stiffness = " << sp.stiffness
         << ", C1 = " << sp.connectors[0] << ", C2 = " << sp.connectors[1] << std::endl;
   return ost;
 }
 
 
+// Column coloring of the sparse MSS_Function Jacobian.
+// Columns of the same color never share a nonzero row, so one AutoDiff
+// direction per color recovers the whole Jacobian (Curtis-Powell-Reid).
+template <int D>
+class JacobianColoring
+{
+public:
+  size_t ncolors = 0;
+  std::vector<size_t> color;                  // color of every column
+  std::vector<std::vector<size_t>> colrows;   // nonzero rows of every column
+
+  JacobianColoring () = default;
+
+  JacobianColoring (MassSpringSystem<D> & mss)
+  {
+    size_t n_masses = mss.masses().size();
+    size_t n_constraints = mss.constraints().size();
+    size_t N = D*n_masses + n_constraints;
+
+    // masses coupled by a spring or a constraint, and constraints touching a mass
+    std::vector<std::vector<size_t>> neighbours(n_masses);
+    std::vector<std::vector<size_t>> massconstraints(n_masses);
+    for (auto & spring : mss.springs())
+    {
+      auto [c1, c2] = spring.connectors;
+      if (c1.type == Connector::MASS && c2.type == Connector::MASS)
+      {
+        neighbours[c1.nr].push_back(c2.nr);
+        neighbours[c2.nr].push_back(c1.nr);
+      }
+    }
+    for (size_t c = 0; c < n_constraints; c++)
+    {
+      auto [c1, c2] = mss.constraints()[c].connectors;
+      if (c1.type == Connector::MASS && c2.type == Connector::MASS)
+      {
+        neighbours[c1.nr].push_back(c2.nr);
+        neighbours[c2.nr].push_back(c1.nr);
+      }
+      for (auto con : { c1, c2 })
+        if (con.type == Connector::MASS)
+          massconstraints[con.nr].push_back(c);
+    }
+
+    // nonzero rows per column
+    colrows.assign(N, {});
+    for (size_t i = 0; i < n_masses; i++)
+    {
+      std::vector<size_t> rows;
+      for (int d = 0; d < D; d++)
+        rows.push_back(i*D+d);
+      for (size_t nb : neighbours[i])
+        for (int d = 0; d < D; d++)
+          rows.push_back(nb*D+d);
+      for (size_t c : massconstraints[i])
+        rows.push_back(D*n_masses+c);
+      std::sort(rows.begin(), rows.end());
+      rows.erase(std::unique(rows.begin(), rows.end()), rows.end());
+      for (int d = 0; d < D; d++)
+        colrows[i*D+d] = rows;
+    }
+    for (size_t c = 0; c < n_constraints; c++)
+      for (auto con : mss.constraints()[c].connectors)
+        if (con.type == Connector::MASS)
+          for (int d = 0; d < D; d++)
+            colrows[D*n_masses+c].push_back(con.nr*D+d);
+
+    // transposed pattern: nonzero columns per row
+    std::vector<std::vector<size_t>> rowcols(N);
+    for (size_t j = 0; j < N; j++)
+      for (size_t r : colrows[j])
+        rowcols[r].push_back(j);
+
+    // greedy coloring: pick the smallest color not used by any column sharing a row
+    const size_t none = size_t(-1);
+    color.assign(N, none);
+    std::vector<size_t> forbidden;
+    ncolors = 0;
+    for (size_t j = 0; j < N; j++)
+    {
+      forbidden.assign(ncolors+1, none);
+      for (size_t r : colrows[j])
+        for (size_t k : rowcols[r])
+          if (color[k] != none)
+            forbidden[color[k]] = j;
+      size_t col = 0;
+      while (forbidden[col] == j) col++;
+      color[j] = col;
+      ncolors = std::max(ncolors, col+1);
+    }
+  }
+};
+
+
 template <int D>
 class MSS_Function : public NonlinearFunction
 {
   MassSpringSystem<D> & mss;
+
+  // coloring is rebuilt when the connectivity changes: m_topology holds the
+  // number of masses and the connectors of all springs and constraints
+  mutable JacobianColoring<D> m_coloring;
+  mutable std::vector<size_t> m_topology;
+  mutable bool m_coloring_valid = false;
+  mutable DerivArena m_arena;   // derivative storage of the colored AD pass
+  // AD vectors of the colored pass, declared after m_arena: their entries
+  // refer to it and are destroyed first
+  mutable std::unique_ptr<Vector<AutoDiff<>>> m_xad, m_fad;
+  mutable std::unique_ptr<Vector<FixedAutoDiff<1>>> m_xdir, m_fdir;   // of J*v
+  mutable std::unique_ptr<Vector<double>> m_xstate, m_fstate;          // one state of a batch
+
+  template <typename F>
+  static void forTopology (MassSpringSystem<D> & mss, F && f)
+  {
+    f(mss.masses().size());
+    auto connectors = [&](auto & cons)
+      {
+        for (auto con : cons)
+          f(2*con.nr + (con.type == Connector::MASS));
+      };
+    for (auto & spring : mss.springs()) connectors(spring.connectors);
+    f(size_t(-1));   // separates springs from constraints
+    for (auto & c : mss.constraints()) connectors(c.connectors);
+  }
+
+  bool sameTopology () const
+  {
+    size_t i = 0;
+    bool same = m_coloring_valid;
+    forTopology(mss, [&](size_t v)
+      {
+        same = same && i < m_topology.size() && m_topology[i] == v;
+        i++;
+      });
+    return same && i == m_topology.size();
+  }
+
 public:
   MSS_Function (MassSpringSystem<D> & _mss)
     : mss(_mss) { }
 
+  const JacobianColoring<D> & coloring() const
+  {
+    if (!sameTopology())
+    {
+      m_coloring = JacobianColoring<D>(mss);
+      m_topology.clear();
+      forTopology(mss, [&](size_t v) { m_topology.push_back(v); });
+      m_coloring_valid = true;
+    }
+    return m_coloring;
+  }
+
+  // forces a new coloring, e.g. after the springs were rewired; it is also
+  // rebuilt automatically whenever a connector differs from the last coloring
+  void invalidate() { m_coloring_valid = false; }
+
   virtual size_t dimX() const { return D*mss.masses().size() + mss.constraints().size(); }
   virtual size_t dimF() const { return dimX(); }
 
@@ -183,6 +334,14 @@ public:
 
   template <typename T>
   void evaluateT (VectorView<T> x, VectorView<T> f) const
+  {
+    evaluateT(x, f, [&](size_t s) { return T(mss.springs()[s].stiffness); });
+  }
+
+  // stiffness(s) provides the stiffness of spring s, e.g. as tape variable
+  // when differentiating with respect to the spring parameters
+  template <typename T, typename TSTIFF>
+  void evaluateT (VectorView<T> x, VectorView<T> f, TSTIFF && stiffness) const
   {
     size_t n_masses = mss.masses().size();
     size_t n_constraints = mss.constraints().size();
@@ -199,8 +358,9 @@ public:
         fmat(i, d) = T(mss.masses()[i].mass * mss.getGravity()(d));
 
     // Spring forces (elastic) - now using positions from input vector x
-    for (auto spring : mss.springs())
+    for (size_t s = 0; s < mss.springs().size(); s++)
     {
+      auto & spring = mss.springs()[s];
       auto [c1, c2] = spring.connectors;
       Vec<D, T> p1 = getConnectorPos(x, c1);
       Vec<D, T> p2 = getConnectorPos(x, c2);
@@ -210,7 +370,7 @@ public:
         diff(d) = p1(d) - p2(d);
 
       T dist = vecNorm(diff);
-      T force = T(spring.stiffness) * (dist - T(spring.length));
+      T force = stiffness(s) * (dist - T(spring.length));
       Vec<D, T> dir;
       for (int d = 0; d < D; d++)
         dir(d) = (p2(d) - p1(d)) / dist;
@@ -282,26 +442,149 @@ public:
     }
   }
 
-  virtual void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const
+  // potential energy of springs and gravity, lambdas of constraints are ignored
+  template <typename T>
+  T potentialEnergyT (VectorView<T> x) const
   {
-    const size_t N = dimX();
+    T energy = T(0.0);
+    for (auto & spring : mss.springs())
+    {
+      auto [c1, c2] = spring.connectors;
+      Vec<D, T> p1 = getConnectorPos(x, c1);
+      Vec<D, T> p2 = getConnectorPos(x, c2);
+
+      Vec<D, T> diff;
+      for (int d = 0; d < D; d++)
+        diff(d) = p1(d) - p2(d);
+
+      T elong = vecNorm(diff) - T(spring.length);
+      energy = energy + T(0.5 * spring.stiffness) * elong * elong;
+    }
+    for (size_t i = 0; i < mss.masses().size(); i++)
+      for (int d = 0; d < D; d++)
+        energy = energy - T(mss.masses()[i].mass * mss.getGravity()(d)) * x(i*D+d);
+    return energy;
+  }
+
+  // energy and its gradient w.r.t. all unknowns, one backward sweep
+  double energyGradient (Tape<> & tape, VectorView<double> x, VectorView<double> grad) const
+  {
+    return ReverseGradient(tape, [this](auto xad) { return potentialEnergyT(xad); }, x, grad);
+  }
+
+  // energy, gradient and Hessian-vector product H*v w.r.t. all unknowns
+  double energyHessianVector (Tape<FixedAutoDiff<1>> & tape, VectorView<double> x, VectorView<double> v,
+                              VectorView<double> grad, VectorView<double> hv) const
+  {
+    return HessianVectorProduct(tape, [this](auto xad) { return potentialEnergyT(xad); }, x, v, grad, hv);
+  }
+
+  // Gradient of a calibration loss w.r.t. all spring stiffnesses, one backward sweep.
+  // loss(model) returns a ReverseAD<>; model(x, f) evaluates the accelerations f
+  // at a measured state x with the stiffnesses as tape variables, and may be
+  // called for any number of states, e.g. along a trajectory.
+  template <typename LOSS>
+  double stiffnessGradient (Tape<> & tape, LOSS && loss, VectorView<double> grad) const
+  {
+    Vector<> k(mss.springs().size());
+    for (size_t s = 0; s < k.size(); s++)
+      k(s) = mss.springs()[s].stiffness;
+
+    return ReverseGradient(tape, [&](VectorView<ReverseAD<>> kad)
+    {
+      auto model = [&](VectorView<double> x, VectorView<ReverseAD<>> f)
+      {
+        Vector<ReverseAD<>> xad(x.size());
+        for (size_t i = 0; i < x.size(); i++)
+          xad(i) = ReverseAD<>(x(i));   // states are data, not variables
+        evaluateT(VectorView<ReverseAD<>>(xad.size(), xad.data()), f,
+                  [&](size_t s) { return kad(s); });
+      };
+      return loss(model);
+    }, k, grad);
+  }
+
+  // largest number of unknowns for which evaluateDeriv uses FixedAutoDiff
+  static constexpr size_t maxFixedDim = 12;
+
+  // Jacobian with fixed-size AutoDiff, derivatives stay on the stack.
+  // The values are passed to value(i, f_i).
+  template <size_t N, typename VALUE>
+  void evaluateDerivFixed (VectorView<double> x, MatrixView<double> df, VALUE && value) const
+  {
+    std::array<FixedAutoDiff<N>, N> xmem, fmem;
+    VectorView<FixedAutoDiff<N>> xad(N, xmem.data());
+    VectorView<FixedAutoDiff<N>> fad(N, fmem.data());
+    for (size_t i = 0; i < N; i++)
+      xad(i) = FixedAutoDiff<N>(x(i), i);  // value, derivIndex
+
+    evaluateT(xad, fad);
 
-    // Use dynamic AutoDiff - size determined at runtime
-    Vector<AutoDiff<>> xad(N);
     for (size_t i = 0; i < N; i++)
     {
-      xad(i) = AutoDiff<>(x(i), i, N);  // value, derivIndex, size
+      value(i, fad(i).value());
+      for (size_t j = 0; j < N; j++)
+        df(i, j) = derivative(fad(i), j);
+    }
+  }
+
+  // picks the FixedAutoDiff<N> instance matching the runtime dimension
+  template <size_t N = 1, typename VALUE>
+  bool tryEvaluateDerivFixed (VectorView<double> x, MatrixView<double> df, VALUE && value) const
+  {
+    if constexpr (N > maxFixedDim)
+      return false;
+    else
+    {
+      if (dimX() == N)
+      {
+        evaluateDerivFixed<N>(x, df, value);
+        return true;
+      }
+      return tryEvaluateDerivFixed<N+1>(x, df, value);
     }
+  }
+
+  // Compressed Jacobian: one AutoDiff direction per color instead of per unknown.
+  // Every structural nonzero is passed to store(i, j, df_ij), the values to value(i, f_i).
+  template <typename STORE, typename VALUE>
+  void coloredJacobian (VectorView<double> x, STORE && store, VALUE && value) const
+  {
+    // all AutoDiff derivatives below come from m_arena, released at once on return
+    ArenaScope scope(m_arena);
+    const size_t N = dimX();
 
-    Vector<AutoDiff<>> fad(dimF());
-    VectorView<AutoDiff<>> xad_view(N, xad.data());
-    VectorView<AutoDiff<>> fad_view(dimF(), fad.data());
+    auto & col = coloring();
+    const size_t nc = col.ncolors;
 
-    evaluateT(xad_view, fad_view);
+    auto xad = VectorScratch(m_xad, N);
+    for (size_t i = 0; i < N; i++)
+      xad(i) = AutoDiff<>(x(i), col.color[i], nc);  // value, derivIndex, size
 
+    // the entries still hold storage of the last pass, reclaimed by the arena
+    // reset: drop it, so that evaluateT does not write into it
+    auto fad = VectorScratch(m_fad, dimF());
     for (size_t i = 0; i < dimF(); i++)
-      for (size_t j = 0; j < N; j++)
-        df(i, j) = derivative(fad(i), j);
+      fad(i) = AutoDiff<>();
+
+    evaluateT(xad, fad);
+
+    for (size_t i = 0; i < N; i++)
+      value(i, fad(i).value());
+
+    // decompress: entry (i,j) sits in direction color[j] of row i
+    for (size_t j = 0; j < N; j++)
+      for (size_t i : col.colrows[j])
+        store(i, j, derivative(fad(i), col.color[j]));
+  }
+
+  virtual void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const
+  {
+    auto novalue = [](size_t, double) { };
+    if (tryEvaluateDerivFixed(x, df, novalue)) return;
+
+    df = 0.0;
+    coloredJacobian(x, [&](size_t i, size_t j, double val) { df(i, j) = val; }, novalue);
 
     //// Numerical differentiation
     // double eps = 1e-8;
@@ -317,7 +600,178 @@ public:
     //     df.col(i) = 1/(2*eps) * (fr-fl);
     //   }
   }
+
+  // values come from the same AutoDiff pass as the Jacobian
+  virtual void evaluateWithDeriv (VectorView<double> x, VectorView<double> f,
+                                  MatrixView<double> df) const
+  {
+    auto value = [&](size_t i, double val) { f(i) = val; };
+    if (tryEvaluateDerivFixed(x, df, value)) return;
+
+    df = 0.0;
+    coloredJacobian(x, [&](size_t i, size_t j, double val) { df(i, j) = val; }, value);
+  }
+
+  // states are looped inside the function: one virtual call per batch
+  virtual void evaluateBatch (MatrixView<double> x, MatrixView<double> f) const
+  {
+    const size_t N = dimX();
+    auto xm = VectorScratch(m_xstate, N);
+    auto fm = VectorScratch(m_fstate, N);
+    for (size_t m = 0; m < x.cols(); m++)
+    {
+      for (size_t i = 0; i < N; i++) xm(i) = x(i,m);
+      evaluateT(xm, fm);
+      for (size_t i = 0; i < N; i++) f(i,m) = fm(i);
+    }
+  }
+
+  // the coloring and AD storage are shared by all states of the batch
+  virtual void evaluateDerivBatch (MatrixView<double> x, MatrixView<double> df) const
+  {
+    const size_t N = dimX();
+    auto xm = VectorScratch(m_xstate, N);
+    df = 0.0;
+    for (size_t m = 0; m < x.cols(); m++)
+    {
+      for (size_t i = 0; i < N; i++) xm(i) = x(i,m);
+      coloredJacobian(xm, [&](size_t i, size_t j, double val) { df(i*N+j, m) = val; },
+                      [](size_t, double) { });
+    }
+  }
+
+  // J*v with one FixedAutoDiff direction seeded with v
+  virtual void evaluateDirectionalDeriv (VectorView<double> x, VectorView<double> v,
+                                         VectorView<double> dfv) const
+  {
+    const size_t N = dimX();
+    auto xad = VectorScratch(m_xdir, N);
+    auto fad = VectorScratch(m_fdir, dimF());
+    for (size_t i = 0; i < N; i++)
+    {
+      xad(i) = FixedAutoDiff<1>(x(i));
+      xad(i).deriv()[0] = v(i);
+    }
+    evaluateT(xad, fad);
+    for (size_t i = 0; i < dimF(); i++)
+      dfv(i) = derivative(fad(i), 0);
+  }
+
+  // the pattern is the one of the coloring
+  virtual void addJacobianPattern (SparsityPattern & pattern, size_t firstf, size_t firstx) const
+  {
+    auto & col = coloring();
+    for (size_t j = 0; j < col.colrows.size(); j++)
+      for (size_t i : col.colrows[j])
+        pattern.add(firstf+i, firstx+j);
+  }
+
+  virtual void addJacobian (VectorView<double> x, SparseMatrix<double> & df, double fac,
+                            size_t firstf, size_t firstx) const
+  {
+    coloredJacobian(x, [&](size_t i, size_t j, double val) { df.add(firstf+i, firstx+j, fac*val); },
+                    [](size_t, double) { });
+  }
   
 };
 
+
+// Gradient of the potential energy w.r.t. the mass positions, with the exact
+// Hessian as Jacobian. NewtonSolver on this function finds static equilibria
+// with quadratic convergence.
+template <int D>
+class MSS_EnergyGradient : public NonlinearFunction
+{
+  MSS_Function<D> m_func;
+  MassSpringSystem<D> & mss;
+  mutable Tape<> m_tape;
+  mutable Tape<FixedAutoDiff<1>> m_hesstape;
+  mutable std::unique_ptr<Vector<double>> m_grad, m_v, m_hv;   // of the Hessian-vector products
+public:
+  MSS_EnergyGradient (MassSpringSystem<D> & _mss)
+    : m_func(_mss), mss(_mss) { }
+
+  virtual size_t dimX() const { return D*mss.masses().size(); }
+  virtual size_t dimF() const { return dimX(); }
+
+  virtual void evaluate (VectorView<double> x, VectorView<double> f) const
+  {
+    m_func.energyGradient(m_tape, x, f);
+  }
+
+  // Hessian columns of one color are compressed into one Hessian-vector product,
+  // every nonzero is passed to store(i, j, value). Each product also returns
+  // the energy gradient, it is written to 'grad'.
+  template <typename STORE>
+  void coloredHessian (VectorView<double> x, STORE && store, VectorView<double> grad) const
+  {
+    const size_t N = dimX();
+    auto & col = m_func.coloring();
+    auto v = VectorScratch(m_v, N);
+    auto hv = VectorScratch(m_hv, N);
+
+    for (size_t c = 0; c < col.ncolors; c++)
+    {
+      bool used = false;
+      for (size_t j = 0; j < N; j++)
+      {
+        v(j) = (col.color[j] == c) ? 1.0 : 0.0;
+        used |= (col.color[j] == c);
+      }
+      if (!used) continue;
+
+      m_func.energyHessianVector(m_hesstape, x, v, grad, hv);
+
+      for (size_t j = 0; j < N; j++)
+        if (col.color[j] == c)
+          for (size_t i : col.colrows[j])
+            if (i < N)   // rows of constraint equations are not part of the energy
+              store(i, j, hv(i));
+    }
+  }
+
+  virtual void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const
+  {
+    auto grad = VectorScratch(m_grad, dimX());
+    df = 0.0;
+    coloredHessian(x, [&](size_t i, size_t j, double val) { df(i, j) = val; }, grad);
+  }
+
+  // the Hessian-vector products return the gradient as well
+  virtual void evaluateWithDeriv (VectorView<double> x, VectorView<double> f,
+                                  MatrixView<double> df) const
+  {
+    df = 0.0;
+    coloredHessian(x, [&](size_t i, size_t j, double val) { df(i, j) = val; }, f);
+  }
+
+  // Hessian-vector product, one forward-over-reverse sweep
+  virtual void evaluateDirectionalDeriv (VectorView<double> x, VectorView<double> v,
+                                         VectorView<double> dfv) const
+  {
+    auto grad = VectorScratch(m_grad, dimX());
+    m_func.energyHessianVector(m_hesstape, x, v, grad, dfv);
+  }
+
+  virtual void addJacobianPattern (SparsityPattern & pattern, size_t firstf, size_t firstx) const
+  {
+    const size_t N = dimX();
+    auto & col = m_func.coloring();
+    for (size_t j = 0; j < N; j++)
+      for (size_t i : col.colrows[j])
+        if (i < N)
+          pattern.add(firstf+i, firstx+j);
+  }
+
+  virtual void addJacobian (VectorView<double> x, SparseMatrix<double> & df, double fac,
+                            size_t firstf, size_t firstx) const
+  {
+    auto grad = VectorScratch(m_grad, dimX());
+    coloredHessian(x, [&](size_t i, size_t j, double val) { df.add(firstf+i, firstx+j, fac*val); }, grad);
+  }
+
+  // Hessian of the energy
+  virtual JacobianTraits jacobianTraits () const { return { false, false, false, 0, true }; }
+};
+
 #endif
@@ -0,0 +1,117 @@
+#include "mass_spring.hpp"
+#include "Newmark.hpp"
+#include <iostream>
+#include <chrono>
+#include <memory>
+#include <string>
+
+// A rectangular net of nx x ny masses with horizontal, vertical and diagonal
+// springs, hanging from its fixed top row. Finds the static equilibrium
+// (symmetric Hessian: sparse Cholesky) and integrates a few Newmark steps
+// (sparse LU), both through the sparse backend of NewtonWorkspace, then
+// repeats the steps with Broyden updates and with Jacobian-free Newton-Krylov.
+// Round-off in residuals of 10^5 unknowns is far above the default
+// tolerance 1e-10, so all solves use 1e-4.
+//
+//   spring_net [nx ny]      default 200 x 250, about 100000 unknowns
+
+int main (int argc, char ** argv)
+{
+  size_t nx = argc > 2 ? std::stoul(argv[1]) : 200;
+  size_t ny = argc > 2 ? std::stoul(argv[2]) : 250;
+
+  MassSpringSystem<2> mss;
+  mss.setGravity( {0,-9.81} );
+  double stiffness = 1e5, diagstiffness = 5e4;
+
+  std::vector<Connector> nodes;
+  for (size_t j = 0; j < ny; j++)
+    for (size_t i = 0; i < nx; i++)
+      {
+        Vec<2> pos = { double(i), -double(j) };
+        nodes.push_back(j == 0 ? mss.addFix( { pos } ) : mss.addMass( { 1, pos } ));
+      }
+  auto node = [&](size_t i, size_t j) { return nodes[j*nx+i]; };
+  for (size_t j = 0; j < ny; j++)
+    for (size_t i = 0; i < nx; i++)
+      {
+        if (i+1 < nx && j > 0)
+          mss.addSpring( { 1, stiffness, { node(i,j), node(i+1,j) } } );
+        if (j+1 < ny)
+          mss.addSpring( { 1, stiffness, { node(i,j), node(i,j+1) } } );
+        if (i+1 < nx && j+1 < ny)
+          {
+            mss.addSpring( { std::sqrt(2.0), diagstiffness, { node(i,j), node(i+1,j+1) } } );
+            mss.addSpring( { std::sqrt(2.0), diagstiffness, { node(i+1,j), node(i,j+1) } } );
+          }
+      }
+
+  size_t n = 2*mss.masses().size();
+  std::cout << mss.masses().size() << " masses, " << mss.springs().size()
+            << " springs, " << n << " unknowns" << std::endl;
+
+  Vector<> x(n), dx(n), ddx(n);
+  mss.getState (x, dx, ddx);
+
+  auto solvername = [](LinearSolver s)
+  {
+    switch (s)
+      {
+      case LinearSolver::Dense: return "dense LU";
+      case LinearSolver::SparseLU: return "sparse LU";
+      case LinearSolver::SparseCholesky: return "sparse Cholesky";
+      default: return "auto";
+      }
+  };
+
+  // static equilibrium
+  auto start = std::chrono::steady_clock::now();
+  NewtonWorkspace equilibrium(std::make_shared<MSS_EnergyGradient<2>> (mss));
+  Vector<> xeq = x;
+  equilibrium.solve(xeq, 1e-4, 20,
+                    [](int it, double err, VectorView<double>) { std::cout << "it = " << it
+                                                                   << ", |grad E| = " << err << std::endl; });
+  std::chrono::duration<double> time = std::chrono::steady_clock::now() - start;
+  std::cout << "equilibrium by " << solvername(equilibrium.linearSolver()) << ": " << time.count() << " s, "
+            << "lowest corner sags " << -double(ny-1) - xeq(n-1) << std::endl
+            << "  Newton: " << equilibrium.statistics() << std::endl;
+
+  // dynamics from the undeformed net, the factorization is kept over the steps
+  int steps = 10;
+  auto mss_func = std::make_shared<MSS_Function<2>> (mss);
+  auto mass = std::make_shared<IdentityFunction> (n);
+  start = std::chrono::steady_clock::now();
+  auto stats = SolveODE_Newmark(0.01*steps, steps, x, dx, mss_func, mass,
+                                [](double t, VectorView<double> x) { std::cout << "t = " << t
+                                                                          << ", lowest corner y = " << x(x.size()-1) << std::endl; },
+                                NewtonMode::Simplified, 1e-4);
+  time = std::chrono::steady_clock::now() - start;
+  std::cout << steps << " Newmark steps: " << time.count() << " s" << std::endl
+            << "  Newton: " << stats << std::endl;
+
+  // the same steps with Broyden updates of the kept factorization
+  mss.getState (x, dx, ddx);
+  start = std::chrono::steady_clock::now();
+  stats = SolveODE_Newmark(0.01*steps, steps, x, dx, mss_func, mass, nullptr,
+                           NewtonMode::Broyden, 1e-4);
+  time = std::chrono::steady_clock::now() - start;
+  std::cout << steps << " Broyden Newmark steps: " << time.count() << " s, "
+            << "lowest corner y = " << x(n-1) << std::endl
+            << "  Newton: " << stats << std::endl;
+
+  // the same steps Jacobian-free: GMRES on Jacobian-vector products,
+  // preconditioned by the 2x2 block of every mass
+  mss.getState (x, dx, ddx);
+  start = std::chrono::steady_clock::now();
+  stats = SolveODE_Newmark(0.01*steps, steps, x, dx, mss_func, mass, nullptr,
+                           NewtonMode::Simplified, 1e-4,
+                           [](NewtonWorkspace & newton)
+                           {
+                             newton.setLinearSolver(LinearSolver::GMRES);
+                             newton.setPreconditioner(std::make_shared<BlockJacobiPreconditioner>(2));
+                           });
+  time = std::chrono::steady_clock::now() - start;
+  std::cout << steps << " Newton-Krylov Newmark steps: " << time.count() << " s, "
+            << "lowest corner y = " << x(n-1) << std::endl
+            << "  Newton: " << stats << std::endl;
+}
@@ -1,39 +1,642 @@
 #ifndef Newton_h
 #define Newton_h
 
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <ostream>
 #include "nonlinfunc.hpp"
-#include <inverse.hpp>
+#include "denselu.hpp"
+#include "krylov.hpp"
 #include <lapack_interface.hpp>
 
 namespace ASC_ode
 {  
-  void NewtonSolver (std::shared_ptr<NonlinearFunction> func, VectorView<double> x,
+  enum class NewtonMode
+  {
+    Full,        // new Jacobian in every iteration, unless it is constant
+    Simplified,  // keep the factorization over iterations and solves,
+                 // refresh it only when the contraction gets too slow
+    Broyden      // as Simplified, but improve the kept factorization by
+                 // rank-one secant updates from the residuals of every step
+  };
+
+
+  enum class LinearSolver
+  {
+    Auto,            // sparse for large functions with a sparse Jacobian, dense otherwise
+    Dense,           // DenseLU
+    SparseLU,
+    SparseCholesky,  // for symmetric positive definite Jacobians, falls back to SparseLU
+    GMRES,           // Jacobian-free, from Jacobian-vector products
+    CG               // Jacobian-free, for symmetric positive definite Jacobians
+  };
+
+
+  // Jacobian-vector products of the Krylov solvers
+  enum class JacobianProduct
+  {
+    Exact,            // evaluateDirectionalDeriv
+    FiniteDifference  // (F(x + eps v) - F(x)) / eps, one evaluate per product
+  };
+
+
+  // relative tolerance eta_k of the Krylov solve in Newton step k
+  enum class Forcing
+  {
+    Constant,         // eta_k = eta
+    EisenstatWalker   // eta_0 = eta, then 0.9 (|r_k| / |r_k-1|)^2, safeguarded, at most etamax
+  };
+
+
+  // Counters and phase timers of NewtonWorkspace, per solve or summed up.
+  // Jacobian-vector products are those of the Krylov solvers, finite
+  // difference products also count as residual evaluations. Residual and
+  // Jacobian evaluated in one call count as both, the time as Jacobian time.
+  struct NewtonStatistics
+  {
+    size_t solves = 0;
+    size_t failures = 0;            // solves that did not converge
+    size_t iterations = 0;          // Newton corrections
+    size_t residualEvaluations = 0;
+    size_t jacobianEvaluations = 0;
+    size_t jacobianProducts = 0;
+    size_t factorizations = 0;      // or preconditioner setups
+    size_t krylovIterations = 0;
+    size_t broydenUpdates = 0;
+
+    double residualTime = 0;        // seconds
+    double jacobianTime = 0;
+    double factorTime = 0;
+    double linearSolveTime = 0;
+    double totalTime = 0;
+
+    NewtonStatistics & operator+= (const NewtonStatistics & s)
+    {
+      solves += s.solves;
+      failures += s.failures;
+      iterations += s.iterations;
+      residualEvaluations += s.residualEvaluations;
+      jacobianEvaluations += s.jacobianEvaluations;
+      jacobianProducts += s.jacobianProducts;
+      factorizations += s.factorizations;
+      krylovIterations += s.krylovIterations;
+      broydenUpdates += s.broydenUpdates;
+      residualTime += s.residualTime;
+      jacobianTime += s.jacobianTime;
+      factorTime += s.factorTime;
+      linearSolveTime += s.linearSolveTime;
+      totalTime += s.totalTime;
+      return *this;
+    }
+  };
+
+  inline std::ostream & operator<< (std::ostream & ost, const NewtonStatistics & s)
+  {
+    ost << s.solves << " solves (" << s.failures << " failed), "
+        << s.iterations << " iterations, "
+        << s.residualEvaluations << " residuals, "
+        << s.jacobianEvaluations << " Jacobians, "
+        << s.factorizations << " factorizations";
+    if (s.jacobianProducts) ost << ", " << s.jacobianProducts << " Jacobian products";
+    if (s.krylovIterations) ost << ", " << s.krylovIterations << " Krylov iterations";
+    if (s.broydenUpdates) ost << ", " << s.broydenUpdates << " Broyden updates";
+    ost << "; time " << s.totalTime << " s: residual " << s.residualTime
+        << ", Jacobian " << s.jacobianTime << ", factor " << s.factorTime
+        << ", linear solve " << s.linearSolveTime;
+    return ost;
+  }
+
+
+  // adds its lifetime in seconds to a timer, and optionally to a second one.
+  // A null timer reads no clock.
+  class PhaseTimer
+  {
+    double * m_time;
+    double * m_also;
+    std::chrono::steady_clock::time_point m_start;
+  public:
+    PhaseTimer (double * time, double * also = nullptr)
+      : m_time(time), m_also(also)
+    {
+      if (m_time) m_start = std::chrono::steady_clock::now();
+    }
+    PhaseTimer (double & time) : PhaseTimer(&time) { }
+    ~PhaseTimer ()
+    {
+      if (!m_time) return;
+      double t = std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start).count();
+      *m_time += t;
+      if (m_also) *m_also += t;
+    }
+  };
+
+
+  // Newton state kept between solves of the same equation.
+  // Corrections are solved with an LU or Cholesky factorization, no inverse is formed.
+  // If the Jacobian is constant (see JacobianTraits) it is evaluated and
+  // factored once and reused by all later solves. In simplified mode any
+  // Jacobian is reused that way while the residual contracts fast enough.
+  // Diagonal and block-diagonal Jacobians are factored block by block.
+  //
+  // In Broyden mode the corrections of one solve are those of Broyden's good
+  // method started from the kept factorization of J0: the rank-one updates are
+  // stored as the previous steps and applied to J0^{-1} F (Kelley's form), so
+  // no Jacobian is evaluated while the residual contracts. A new J0 is taken
+  // when it does not, or when maxUpdates steps are stored.
+  //
+  // Parameters of the equation, e.g. the time step, are registered with
+  // watch(). The factorization is refreshed when one of them changed: by any
+  // amount in full mode, by more than the relative tolerance in simplified mode.
+  // A constant Jacobian is only reused if every non-constant Parameter it
+  // depends on (addJacobianParameters) is watched, otherwise it is treated
+  // as non-constant.
+  //
+  // With LinearSolver::Auto, functions of at least SparseMinDim unknowns whose
+  // Jacobian pattern fills at most SparseMaxFill of the matrix are solved
+  // sparse: by Cholesky if the Jacobian is symmetric, by LU otherwise. The
+  // symbolic factorization is reused while the pattern stays the same.
+  //
+  // The Krylov solvers never form the Jacobian. Their "factorization" is the
+  // setup of the preconditioner, which is therefore kept by the same rules,
+  // and each correction is solved only to the relative accuracy of the
+  // forcing term (inexact Newton).
+  class NewtonWorkspace
+  {
+    struct Watched
+    {
+      std::shared_ptr<Parameter> param;
+      double factored;   // value at the last factorization
+    };
+
+    std::shared_ptr<NonlinearFunction> m_func;
+    JacobianTraits m_traits;
+    std::vector<std::shared_ptr<Parameter>> m_jacparams;   // the Jacobian depends on
+    bool m_constant;     // constant Jacobian and all its Parameters watched
+    Vector<double> m_res, m_update;
+    bool m_valid = false;       // the factors may be reused
+
+    // statistics of the current or last solve, and of all solves
+    NewtonStatistics m_last, m_total;
+    bool m_timing = true;
+
+    void count (size_t NewtonStatistics::*counter, size_t n = 1)
+    {
+      m_last.*counter += n;
+      m_total.*counter += n;
+    }
+
+    PhaseTimer phaseTimer (double NewtonStatistics::*phase)
+    {
+      if (!m_timing) return PhaseTimer(nullptr);
+      return PhaseTimer(&(m_last.*phase), &(m_total.*phase));
+    }
+
+    void evaluateResidual (VectorView<double> x)
+    {
+      auto timer = phaseTimer(&NewtonStatistics::residualTime);
+      m_func->evaluate(x, m_res);
+      count(&NewtonStatistics::residualEvaluations);
+    }
+
+    // linear solver, the Jacobian storage of the other kinds is never allocated
+    LinearSolver m_solver;
+    std::unique_ptr<Matrix<double>> m_jac;
+    DenseLU<double> m_lu;
+    std::unique_ptr<SparseMatrix<double>> m_spjac;
+    SparseLU<double> m_splu;
+    SparseCholesky<double> m_chol;
+
+    // Krylov solvers
+    std::shared_ptr<Preconditioner> m_precond;
+    GMRES m_gmres;
+    ConjugateGradient m_cg;
+    JacobianProduct m_product = JacobianProduct::Exact;
+    Forcing m_forcing = Forcing::EisenstatWalker;
+    double m_eta = 0.1, m_etamax = 0.9, m_etaold = 0.1;
+    size_t m_maxKrylov = 200;
+    std::unique_ptr<Vector<double>> m_xpert, m_fpert;   // finite differences
+
+    NewtonMode m_mode = NewtonMode::Full;
+    double m_maxContraction = 0.5;
+    double m_paramTolerance = 0.2;
+    std::vector<Watched> m_watched;
+
+    // Broyden: the steps since the last factorization and their squared norms
+    std::vector<Vector<double>> m_steps;
+    std::vector<double> m_stepnorm2;
+    size_t m_nsteps = 0;
+
+    bool watchedChanged () const
+    {
+      double tol = m_mode != NewtonMode::Full ? m_paramTolerance : 0.0;
+      for (auto & w : m_watched)
+        if (std::abs(w.param->get() - w.factored) > tol * std::abs(w.factored))
+          return true;
+      return false;
+    }
+
+    bool krylov () const { return m_solver == LinearSolver::GMRES || m_solver == LinearSolver::CG; }
+
+    void updateConstant ()
+    {
+      m_constant = m_traits.constant;
+      for (auto & p : m_jacparams)
+        if (std::none_of(m_watched.begin(), m_watched.end(),
+                         [&](const Watched & w) { return w.param == p; }))
+          m_constant = false;
+    }
+
+    void evaluateJacobian (VectorView<double> x, bool withValue)
+    {
+      if (krylov())
+        {
+          if (withValue)
+            evaluateResidual(x);
+          return;
+        }
+
+      auto timer = phaseTimer(&NewtonStatistics::jacobianTime);
+      if (m_solver == LinearSolver::Dense)
+        {
+          if (withValue)
+            m_func->evaluateWithDeriv(x, m_res, *m_jac);
+          else
+            m_func->evaluateDeriv(x, *m_jac);
+        }
+      else
+        {
+          if (withValue)
+            m_func->evaluate(x, m_res);
+          m_func->evaluateDerivSparse(x, *m_spjac);
+        }
+      count(&NewtonStatistics::jacobianEvaluations);
+      if (withValue)
+        count(&NewtonStatistics::residualEvaluations);
+    }
+
+    void factor (VectorView<double> x)
+    {
+      auto timer = phaseTimer(&NewtonStatistics::factorTime);
+      switch (m_solver)
+        {
+        case LinearSolver::GMRES:
+        case LinearSolver::CG:
+          if (m_precond)
+            m_precond->setup(*m_func, x);
+          break;
+        case LinearSolver::Dense:
+          m_lu.factor(*m_jac, m_traits.diagonal ? 1 : m_traits.blocksize);
+          break;
+        case LinearSolver::SparseCholesky:
+          try
+            {
+              m_chol.factor(*m_spjac);
+              break;
+            }
+          catch (std::domain_error &)
+            {
+              // not positive definite, stay with LU from now on
+              m_solver = LinearSolver::SparseLU;
+            }
+          [[fallthrough]];
+        default:
+          m_splu.refactor(*m_spjac);
+        }
+      count(&NewtonStatistics::factorizations);
+      m_valid = true;
+      m_nsteps = 0;
+      for (auto & w : m_watched)
+        w.factored = w.param->get();
+    }
+
+    // J(x) v, m_res holds F(x)
+    void jacobianProduct (VectorView<double> x, VectorView<double> v, VectorView<double> jv)
+    {
+      count(&NewtonStatistics::jacobianProducts);
+      if (m_product == JacobianProduct::Exact)
+        {
+          m_func->evaluateDirectionalDeriv(x, v, jv);
+          return;
+        }
+      double nv = norm(v);
+      if (nv == 0)
+        {
+          jv = 0.0;
+          return;
+        }
+      double eps = 1.5e-8 * (1 + norm(x)) / nv;   // sqrt of machine epsilon, scaled
+      *m_xpert = x + eps * v;
+      m_func->evaluate(*m_xpert, *m_fpert);
+      count(&NewtonStatistics::residualEvaluations);
+      jv = (1/eps) * (*m_fpert - m_res);
+    }
+
+    double forcingTerm (int i, double err, double errold, double tol)
+    {
+      if (m_forcing == Forcing::Constant)
+        return m_eta;
+      double eta = m_eta;
+      if (i > 0)
+        {
+          // do not tighten faster than the previous term allows
+          eta = 0.9 * (err/errold) * (err/errold);
+          double prev = 0.9 * m_etaold * m_etaold;
+          if (prev > 0.1)
+            eta = std::max(eta, prev);
+        }
+      // no oversolving of the last step
+      eta = std::min(m_etamax, std::max(eta, 0.5 * tol / err));
+      return m_etaold = eta;
+    }
+
+    void solveCorrection (VectorView<double> x, double eta)
+    {
+      auto timer = phaseTimer(&NewtonStatistics::linearSolveTime);
+      switch (m_solver)
+        {
+        case LinearSolver::Dense: m_lu.solve(m_res, m_update); break;
+        case LinearSolver::SparseCholesky: m_chol.solve(m_res, m_update); break;
+        case LinearSolver::GMRES:
+        case LinearSolver::CG:
+          {
+            LinearOperator jac = [this, &x] (VectorView<double> v, VectorView<double> jv)
+              { jacobianProduct(x, v, jv); };
+            m_update = 0.0;
+            if (m_solver == LinearSolver::GMRES)
+              count(&NewtonStatistics::krylovIterations,
+                    m_gmres.solve(jac, m_precond.get(), m_res, m_update, eta, m_maxKrylov));
+            else
+              count(&NewtonStatistics::krylovIterations,
+                    m_cg.solve(jac, m_precond.get(), m_res, m_update, eta, m_maxKrylov));
+            break;
+          }
+        default: m_splu.solve(m_res, m_update);
+        }
+    }
+
+    bool broyden () const { return m_mode == NewtonMode::Broyden && !krylov(); }
+
+    // turn m_update = J0^{-1} F into the step of the updated Jacobian,
+    // false if the update is singular
+    bool broydenStep ()
+    {
+      auto timer = phaseTimer(&NewtonStatistics::linearSolveTime);
+      if (m_nsteps > 0)
+        {
+          for (size_t j = 0; j+1 < m_nsteps; j++)
+            m_update += (InnerProduct(m_steps[j], m_update) / m_stepnorm2[j]) * m_steps[j+1];
+          double denom = 1 - InnerProduct(m_steps[m_nsteps-1], m_update) / m_stepnorm2[m_nsteps-1];
+          if (std::abs(denom) < 1e-8)
+            return false;
+          m_update *= 1/denom;
+          count(&NewtonStatistics::broydenUpdates);
+        }
+      m_steps[m_nsteps] = m_update;
+      m_stepnorm2[m_nsteps] = InnerProduct(m_update, m_update);
+      m_nsteps++;
+      return true;
+    }
+
+  public:
+    static constexpr size_t SparseMinDim = 200;
+    static constexpr double SparseMaxFill = 0.1;
+
+    NewtonWorkspace (std::shared_ptr<NonlinearFunction> func,
+                     Pivoting pivoting = Pivoting::Partial,
+                     LinearSolver solver = LinearSolver::Auto)
+      : m_func(func), m_traits(func->jacobianTraits()),
+        m_res(func->dimF()), m_update(func->dimX()), m_lu(pivoting)
+    {
+      func->addJacobianParameters(m_jacparams);
+      updateConstant();
+      setLinearSolver(solver);
+    }
+
+    auto function() const { return m_func; }
+    const JacobianTraits & traits() const { return m_traits; }
+    // the Jacobian is reused as constant: constant traits, all its Parameters
+    // watched, and no solve has contracted too slowly with it
+    bool constantJacobian() const { return m_constant; }
+    const DenseLU<double> & lu() const { return m_lu; }
+    size_t factorizations() const { return m_total.factorizations; }
+    size_t krylovIterations() const { return m_total.krylovIterations; }
+    size_t broydenUpdates() const { return m_total.broydenUpdates; }
+
+    // counters and timers of all solves, and of the current or last one
+    const NewtonStatistics & statistics() const { return m_total; }
+    const NewtonStatistics & lastSolve() const { return m_last; }
+    void resetStatistics() { m_last = m_total = NewtonStatistics(); }
+    // the timers read the clock a few times per iteration, which only
+    // matters for very small systems; the counters are always kept
+    void setTiming (bool timing) { m_timing = timing; }
+    void invalidate() { m_valid = false; }
+
+    void setLinearSolver (LinearSolver solver)
+    {
+      size_t n = m_func->dimX();
+      if (solver == LinearSolver::GMRES || solver == LinearSolver::CG)
+        {
+          m_jac.reset();
+          m_spjac.reset();
+        }
+      else if (solver == LinearSolver::Auto && (n < SparseMinDim || m_func->dimF() != n))
+        solver = LinearSolver::Dense;   // small: no pattern is built
+      else if (solver != LinearSolver::Dense)
+        {
+          if (!m_spjac)
+            m_spjac = std::make_unique<SparseMatrix<double>>(m_func->createSparseJacobian());
+          if (solver == LinearSolver::Auto)
+            solver = m_spjac->nze() > SparseMaxFill * n * n ? LinearSolver::Dense
+              : m_traits.symmetric ? LinearSolver::SparseCholesky : LinearSolver::SparseLU;
+        }
+      if (solver == LinearSolver::Dense)
+        {
+          m_spjac.reset();
+          if (!m_jac)
+            m_jac = std::make_unique<Matrix<double>>(m_func->dimF(), n);
+        }
+      m_solver = solver;
+      m_valid = false;
+    }
+    LinearSolver linearSolver() const { return m_solver; }
+
+    // Krylov settings. The preconditioner is optional; with NewtonMode::Simplified
+    // it is kept over iterations and solves like a factorization.
+    void setPreconditioner (std::shared_ptr<Preconditioner> precond)
+    {
+      m_precond = precond;
+      m_valid = false;
+    }
+    void setJacobianProduct (JacobianProduct product)
+    {
+      m_product = product;
+      if (product == JacobianProduct::FiniteDifference && !m_xpert)
+        {
+          m_xpert = std::make_unique<Vector<double>>(m_func->dimX());
+          m_fpert = std::make_unique<Vector<double>>(m_func->dimF());
+        }
+    }
+    // eta: the constant or first forcing term, etamax: bound of Eisenstat-Walker
+    void setForcing (Forcing forcing, double eta = 0.1, double etamax = 0.9)
+    {
+      m_forcing = forcing;
+      m_eta = eta;
+      m_etamax = etamax;
+    }
+    void setKrylov (size_t maxit, size_t restart = 30)
+    {
+      m_maxKrylov = maxit;
+      m_gmres = GMRES(restart);
+    }
+
+    // maxContraction: simplified and Broyden mode refresh the Jacobian when |r_k+1| > maxContraction |r_k|
+    // paramTolerance: relative change of a watched Parameter that forces a refresh
+    // maxUpdates: Broyden updates stored before the Jacobian is refreshed
+    void setMode (NewtonMode mode, double maxContraction = 0.5, double paramTolerance = 0.2,
+                  size_t maxUpdates = 10)
+    {
+      m_mode = mode;
+      m_maxContraction = maxContraction;
+      m_paramTolerance = paramTolerance;
+      m_nsteps = 0;
+      if (mode == NewtonMode::Broyden && m_steps.size() != maxUpdates+1)
+        {
+          m_steps.assign(maxUpdates+1, Vector<double>(m_func->dimX()));
+          m_stepnorm2.resize(maxUpdates+1);
+        }
+    }
+    NewtonMode mode() const { return m_mode; }
+
+    void watch (std::shared_ptr<Parameter> param)
+    {
+      m_watched.push_back( { param, param->get() } );
+      updateConstant();
+    }
+
+    void solve (VectorView<double> x, double tol, int maxsteps,
+                std::function<void(int,double,VectorView<double>)> callback)
+    {
+      m_last = NewtonStatistics();
+      count(&NewtonStatistics::solves);
+      auto timer = phaseTimer(&NewtonStatistics::totalTime);
+
+      if (watchedChanged())
+        m_valid = false;
+      bool keep = m_constant || m_mode != NewtonMode::Full;
+      double errold = 0, errolder = 0;
+      m_nsteps = 0;   // secant information of the last solve is not kept
+
+      for (int i = 0; i < maxsteps; i++)
+        {
+          // The Jacobian is only needed if x does not converge. Residual and
+          // Jacobian come in one call only when the last contraction predicts
+          // an error far above tol (err_i-1 theta^2 for quadratic convergence);
+          // otherwise the residual is tested first.
+          bool refresh = !(keep && m_valid);
+          bool fuse = false;
+          if (refresh && i >= 2)
+            {
+              double theta = errold / errolder;
+              fuse = errold * theta * theta > 100 * tol;
+            }
+          if (fuse)
+            evaluateJacobian(x, true);
+          else
+            evaluateResidual(x);
+          double err= norm(m_res);
+          if (err < tol) return;
+          if (refresh && !fuse)
+            evaluateJacobian(x, false);
+
+          // old factors contract too slowly, or would not reach tol
+          // within maxsteps: new Jacobian at the current iterate. A truly
+          // constant Jacobian converges in one step, so this also catches
+          // a wrong constant claim.
+          // (Krylov: the Jacobian is never old, slow contraction is due to the forcing)
+          if (!refresh && !krylov() && i > 0)
+            {
+              double theta = err / errold;
+              if (theta > m_maxContraction ||
+                  err * std::pow(theta, maxsteps-1-i) > (1-theta) * tol ||
+                  (broyden() && m_nsteps == m_steps.size()))
+                {
+                  if (m_constant)
+                    {
+                      // the Jacobian is not constant after all
+                      m_constant = m_traits.constant = false;
+                      keep = m_mode != NewtonMode::Full;
+                    }
+                  evaluateJacobian(x, false);
+                  refresh = true;
+                }
+            }
+
+          if (refresh)
+            factor(x);
+          solveCorrection(x, krylov() ? forcingTerm(i, err, errold, tol) : 0.0);
+          if (broyden() && !m_constant && !broydenStep())
+            {
+              // degenerate update, restart from the Jacobian at x
+              evaluateJacobian(x, false);
+              factor(x);
+              solveCorrection(x, 0.0);
+              broydenStep();
+            }
+          x -= m_update;
+          errolder = errold;
+          errold = err;
+          count(&NewtonStatistics::iterations);
+
+          if (callback)
+            callback(i, err, x);
+        }
+
+      count(&NewtonStatistics::failures);
+      throw std::domain_error("Newton did not converge");
+    }
+  };
+
+
+  void NewtonSolver (NewtonWorkspace & ws, VectorView<double> x,
                      double tol = 1e-10, int maxsteps = 10,
                      std::function<void(int,double,VectorView<double>)> callback = nullptr)
   {
-    Vector<double> res(func->dimF());
-    Matrix<double> fprime(func->dimF(), func->dimX());
+    ws.solve(x, tol, maxsteps, callback);
+  }
 
-    for (int i = 0; i < maxsteps; i++)
-      {
-        func->evaluate(x, res);
-        double err= norm(res);
-        if (err < tol) return;
+  void NewtonSolver (std::shared_ptr<NonlinearFunction> func, VectorView<double> x,
+                     double tol = 1e-10, int maxsteps = 10,
+                     std::function<void(int,double,VectorView<double>)> callback = nullptr)
+  {
+    NewtonWorkspace ws(func);
+    ws.solve(x, tol, maxsteps, callback);
+  }
 
-        func->evaluateDeriv(x, fprime);
 
-        calcInverse(fprime);
-        x -= fprime*res;
+  // Newton's method with the sparse Jacobian of 'func', solved by a sparse LU.
+  // No dense dimF x dimX matrix is formed.
+  void NewtonSolverSparse (std::shared_ptr<NonlinearFunction> func, VectorView<double> x,
+                           double tol = 1e-10, int maxsteps = 10,
+                           std::function<void(int,double,VectorView<double>)> callback = nullptr)
+  {
+    NewtonWorkspace ws(func, Pivoting::Partial, LinearSolver::SparseLU);
+    ws.solve(x, tol, maxsteps, callback);
+  }
 
-        // LapackLU LU(fprime);
-        // LU.solve(res);
-        // x -= res;
- 
-        if (callback)
-          callback(i, err, x);
-      }
 
-    throw std::domain_error("Newton did not converge");
+  // Jacobian-free Newton-Krylov: GMRES on Jacobian-vector products of 'func',
+  // Eisenstat-Walker forcing, optionally preconditioned. Inexact corrections
+  // need more Newton steps, hence the larger default of maxsteps.
+  void NewtonKrylovSolver (std::shared_ptr<NonlinearFunction> func, VectorView<double> x,
+                           double tol = 1e-10, int maxsteps = 20,
+                           std::function<void(int,double,VectorView<double>)> callback = nullptr,
+                           std::shared_ptr<Preconditioner> precond = nullptr)
+  {
+    NewtonWorkspace ws(func, Pivoting::Partial, LinearSolver::GMRES);
+    ws.setPreconditioner(precond);
+    ws.solve(x, tol, maxsteps, callback);
   }
 
 }
@@ -8,23 +8,296 @@
 #include <vector>
 #include <algorithm>
 #include <type_traits>
+#include <memory>
+#include <new>
+#include <stdexcept>
+
+#include "simd.hpp"
 
 
 namespace ASC_ode
 {
 
-  template <typename T = double>
+  // plain numbers are constants; AutoDiff types and expressions have their own overloads
+  template <typename T = double> requires std::is_arithmetic_v<T>
   auto derivative (T v, size_t /*index*/) { return T(0); } 
 
 
+  // Base class of the lazy AutoDiff expressions (CRTP).
+  //
+  // An expression node computes its value and the local partial derivatives
+  // when it is built, but evaluates derivatives only on demand, per index, via
+  // derivAt(i). Assigning a whole expression to an AutoDiff therefore runs a
+  // single fused loop over the derivative vector, without temporaries.
+  //
+  // Nodes keep AutoDiff operands by reference: assign expressions to an
+  // AutoDiff, do not store them in 'auto' variables beyond the statement.
+  // Debug builds (no NDEBUG) throw std::logic_error if an expression is
+  // evaluated after one of its AutoDiff operands was destroyed.
+  template <typename E>
+  class AutoDiffExpr
+  {
+  public:
+    const E & derived() const { return static_cast<const E&>(*this); }
+  };
+
+
+  // Bump-pointer arena for AutoDiff derivative storage.
+  //
+  // While an ArenaScope is alive, every DerivVector draws its memory from the
+  // scope's arena instead of the global allocator. Releasing the most recent
+  // allocation rolls the pointer back, everything else is reclaimed at once
+  // when the scope ends (O(1) reset, blocks are kept for the next scope).
+  // AutoDiff values allocated inside a scope must not outlive it: every reset
+  // starts a new generation, and debug builds throw std::logic_error when
+  // derivatives of an older generation are used.
+  class DerivArena
+  {
+    struct Block
+    {
+      std::byte * data;
+      size_t size;
+    };
+    std::vector<Block> m_blocks;
+    size_t m_block = 0;     // current block
+    size_t m_offset = 0;    // first free byte in current block
+    size_t m_blocksize;
+    size_t m_generation = 0;  // number of resets
+
+    static size_t aligned (size_t bytes) { return (bytes + SIMDAlignment - 1) / SIMDAlignment * SIMDAlignment; }
+
+  public:
+    DerivArena (size_t blocksize = 1 << 16) : m_blocksize(blocksize) { }
+    DerivArena (const DerivArena &) = delete;
+    DerivArena & operator= (const DerivArena &) = delete;
+
+    ~DerivArena ()
+    {
+      for (auto & b : m_blocks)
+        ::operator delete(b.data, std::align_val_t(SIMDAlignment));
+    }
+
+    // arena that DerivVector allocates from, nullptr for the global allocator
+    static DerivArena *& active ()
+    {
+      thread_local DerivArena * arena = nullptr;
+      return arena;
+    }
+
+    void * allocate (size_t bytes)
+    {
+      bytes = aligned(bytes);
+      while (m_block < m_blocks.size() && m_offset + bytes > m_blocks[m_block].size)
+      {
+        m_block++;
+        m_offset = 0;
+      }
+      if (m_block == m_blocks.size())
+      {
+        size_t size = std::max(m_blocksize, bytes);
+        m_blocks.push_back( { static_cast<std::byte*>(::operator new(size, std::align_val_t(SIMDAlignment))), size } );
+        m_offset = 0;
+      }
+      void * p = m_blocks[m_block].data + m_offset;
+      m_offset += bytes;
+      return p;
+    }
+
+    // only the last allocation is actually given back
+    void deallocate (void * p, size_t bytes)
+    {
+      if (m_block < m_blocks.size() &&
+          static_cast<std::byte*>(p) + aligned(bytes) == m_blocks[m_block].data + m_offset)
+        m_offset -= aligned(bytes);
+    }
+
+    // O(1): all allocations are released, blocks are kept
+    void reset ()
+    {
+      m_block = 0;
+      m_offset = 0;
+      m_generation++;
+    }
+
+    size_t generation () const { return m_generation; }
+
+    // bytes reserved in blocks
+    size_t capacity () const
+    {
+      size_t sum = 0;
+      for (auto & b : m_blocks) sum += b.size;
+      return sum;
+    }
+  };
+
+
+  // makes 'arena' active for the lifetime of the scope, and resets it at the end
+  class ArenaScope
+  {
+    DerivArena & m_arena;
+    DerivArena * m_prev;
+  public:
+    ArenaScope (DerivArena & arena) : m_arena(arena), m_prev(DerivArena::active())
+    {
+      DerivArena::active() = &arena;
+    }
+    ~ArenaScope ()
+    {
+      DerivArena::active() = m_prev;
+      m_arena.reset();
+    }
+    ArenaScope (const ArenaScope &) = delete;
+    ArenaScope & operator= (const ArenaScope &) = delete;
+  };
+
+
+  // Derivative storage of the dynamic AutoDiff: aligned to SIMDAlignment and
+  // with capacity padded to a multiple of SIMDWidth, so that kernels can run
+  // full SIMD packs up to the padded length without a remainder loop.
+  // Entries in the padding are unspecified.
+  template <typename T>
+  class DerivVector
+  {
+    T * m_data = nullptr;
+    size_t m_size = 0;
+    size_t m_capacity = 0;
+    DerivArena * m_arena = nullptr;   // owner of m_data, nullptr for the heap
+    size_t m_generation = 0;          // of m_arena when m_data was allocated
+
+    static size_t padded (size_t n) { return (n + SIMDWidth - 1) / SIMDWidth * SIMDWidth; }
+
+    // from 'arena' if there is one, else from the heap
+    static T * allocate (DerivArena * arena, size_t n)
+    {
+      if (arena)
+        return static_cast<T*>(arena->allocate(n * sizeof(T)));
+      return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(SIMDAlignment)));
+    }
+
+    // storage from an arena that was reset since
+    bool stale () const { return m_arena && m_arena->generation() != m_generation; }
+
+    // debug builds: throws if the storage is stale
+    void checkArena () const
+    {
+#ifndef NDEBUG
+      if (stale())
+        throw std::logic_error("AutoDiff: derivatives used after their ArenaScope ended");
+#endif
+    }
+
+    void release ()
+    {
+      if (!m_data) return;
+      std::destroy_n(m_data, m_capacity);
+      if (m_arena)
+      {
+        // stale storage was reclaimed already, it must not roll back newer allocations
+        if (!stale())
+          m_arena->deallocate(m_data, m_capacity * sizeof(T));
+      }
+      else
+        ::operator delete(m_data, std::align_val_t(SIMDAlignment));
+      m_data = nullptr;
+      m_size = m_capacity = 0;
+      m_arena = nullptr;
+    }
+
+  public:
+    DerivVector () = default;
+
+    DerivVector (size_t n, T val = T(0)) { resize(n, val); }
+
+    DerivVector (const DerivVector & v)
+    {
+      v.checkArena();
+      resize(v.m_size);
+      std::copy_n(v.m_data, v.m_size, m_data);
+    }
+
+    DerivVector (DerivVector && v) noexcept
+      : m_data(v.m_data), m_size(v.m_size), m_capacity(v.m_capacity),
+        m_arena(v.m_arena), m_generation(v.m_generation)
+    {
+      v.m_data = nullptr;
+      v.m_size = v.m_capacity = 0;
+      v.m_arena = nullptr;
+    }
+
+    ~DerivVector () { release(); }
+
+    DerivVector & operator= (const DerivVector & v)
+    {
+      if (this == &v) return *this;
+      v.checkArena();
+      resize(v.m_size);
+      std::copy_n(v.m_data, v.m_size, m_data);
+      return *this;
+    }
+
+    DerivVector & operator= (DerivVector && v) noexcept
+    {
+      std::swap(m_data, v.m_data);
+      std::swap(m_size, v.m_size);
+      std::swap(m_capacity, v.m_capacity);
+      std::swap(m_arena, v.m_arena);
+      std::swap(m_generation, v.m_generation);
+      return *this;
+    }
+
+    // new entries are set to val, existing ones are kept
+    void resize (size_t n, T val = T(0))
+    {
+      checkArena();
+      if (n > m_capacity)
+      {
+        size_t cap = padded(n);
+        DerivArena * arena = DerivArena::active();
+        T * data = allocate(arena, cap);
+        std::uninitialized_fill_n(data, cap, T(0));
+        if (m_data)
+          std::copy_n(m_data, m_size, data);
+        size_t oldsize = m_size;
+        release();
+        m_data = data;
+        m_arena = arena;
+        m_generation = arena ? arena->generation() : 0;
+        m_capacity = cap;
+        m_size = oldsize;
+      }
+      if (n > m_size)
+        std::fill(m_data + m_size, m_data + n, val);
+      m_size = n;
+    }
+
+    size_t size () const { return m_size; }
+    size_t capacity () const { return m_capacity; }
+    T * data () { checkArena(); return m_data; }
+    const T * data () const { checkArena(); return m_data; }
+    T & operator[] (size_t i) { checkArena(); return m_data[i]; }
+    const T & operator[] (size_t i) const { checkArena(); return m_data[i]; }
+    T * begin () { checkArena(); return m_data; }
+    T * end () { return m_data + m_size; }
+    const T * begin () const { checkArena(); return m_data; }
+    const T * end () const { return m_data + m_size; }
+  };
+
+
   // Dynamic AutoDiff class - size determined at runtime
   template <typename T = double>
-  class AutoDiff
+  class AutoDiff : public AutoDiffExpr<AutoDiff<T>>
   {
   private:
     T m_val;
-    std::vector<T> m_deriv;
+    DerivVector<T> m_deriv;
+#ifndef NDEBUG
+    // set while the object lives, checked when expressions read it
+    static constexpr unsigned alive = 0xad1fe;
+    unsigned m_alive = alive;
+#endif
   public:
+    using value_type = T;
+
     // Default constructor
     AutoDiff () : m_val(0), m_deriv() {}
 
@@ -38,16 +311,181 @@ namespace ASC_ode
         m_deriv[derivIndex] = T(1);
     }
 
+    AutoDiff (const AutoDiff &) = default;
+    AutoDiff (AutoDiff &&) = default;
+    AutoDiff & operator= (const AutoDiff &) = default;
+    AutoDiff & operator= (AutoDiff &&) = default;
+
+#ifndef NDEBUG
+    // volatile, so the store is not dropped as dead
+    ~AutoDiff () { static_cast<volatile unsigned &>(m_alive) = 0; }
+#endif
+
+    // debug builds: throws if this operand of an expression was destroyed
+    void checkAlive () const
+    {
+#ifndef NDEBUG
+      if (m_alive != alive)
+        throw std::logic_error("AutoDiff: expression evaluated after its operand was destroyed");
+#endif
+    }
+
+    // Evaluate an expression in one loop
+    template <typename E>
+    AutoDiff (const AutoDiffExpr<E> & e) { *this = e; }
+
+    // Evaluate an expression in one loop, reusing the derivative storage.
+    // Safe if *this appears in e: entry i only depends on entries i of the operands.
+    template <typename E>
+    AutoDiff & operator= (const AutoDiffExpr<E> & e)
+    {
+      const E & ex = e.derived();
+      T val = ex.value();
+      size_t n = ex.size();
+      m_deriv.resize(n, T(0));
+
+      // SIMD kernel over the padded length if no operand needs zero-extension
+      if constexpr (std::is_same_v<T, double> && SIMDWidth > 1)
+        if (ex.uniformSize(n))
+        {
+          using P = SIMD<double, SIMDWidth>;
+          double * dst = m_deriv.data();
+          for (size_t i = 0; i < n; i += SIMDWidth)
+            ex.template derivPack<P>(i).store(dst + i);
+          m_val = val;
+          return *this;
+        }
+
+      for (size_t i = 0; i < n; i++)
+        m_deriv[i] = ex.derivAt(i);
+      m_val = val;
+      return *this;
+    }
+
     T value() const { return m_val; }
-    std::vector<T>& deriv() { return m_deriv; }
-    const std::vector<T>& deriv() const { return m_deriv; }
-    size_t size() const { return m_deriv.size(); }
+    DerivVector<T>& deriv() { return m_deriv; }
+    const DerivVector<T>& deriv() const { return m_deriv; }
+    size_t size() const
+    {
+      checkAlive();
+      return m_deriv.size();
+    }
+
+    // derivative i, zero beyond the stored size
+    T derivAt (size_t i) const
+    {
+      checkAlive();
+      return (i < m_deriv.size()) ? m_deriv[i] : T(0);
+    }
+
+    // SIMD pack of derivatives i..i+W-1, requires uniformSize
+    template <typename P>
+    P derivPack (size_t i) const { return m_deriv.size() ? P::load(m_deriv.data()+i) : P(T(0)); }
+
+    // true if the derivatives can be read in packs up to length n
+    bool uniformSize (size_t n) const { return m_deriv.size() == n || m_deriv.size() == 0; }
 
     // Resize the derivative vector
     void resize(size_t n) { m_deriv.resize(n, T(0)); }
   };
 
 
+  // operands are stored by value, AutoDiff leaves by reference
+  template <typename E> struct ADStorage { using type = E; };
+  template <typename T> struct ADStorage<AutoDiff<T>> { using type = const AutoDiff<T>&; };
+
+
+  // result' = a'   (shift by a scalar)
+  template <typename A>
+  class ADShift : public AutoDiffExpr<ADShift<A>>
+  {
+  public:
+    using value_type = typename A::value_type;
+  private:
+    typename ADStorage<A>::type m_a;
+    value_type m_val;
+  public:
+    ADShift (const A & a, value_type val) : m_a(a), m_val(val) { }
+    value_type value() const { return m_val; }
+    size_t size() const { return m_a.size(); }
+    value_type derivAt (size_t i) const { return m_a.derivAt(i); }
+    template <typename P> P derivPack (size_t i) const { return m_a.template derivPack<P>(i); }
+    bool uniformSize (size_t n) const { return m_a.uniformSize(n); }
+  };
+
+  // result' = da * a'   (unary functions, scaling)
+  template <typename A>
+  class ADScale : public AutoDiffExpr<ADScale<A>>
+  {
+  public:
+    using value_type = typename A::value_type;
+  private:
+    typename ADStorage<A>::type m_a;
+    value_type m_val, m_da;
+  public:
+    ADScale (const A & a, value_type val, value_type da) : m_a(a), m_val(val), m_da(da) { }
+    value_type value() const { return m_val; }
+    size_t size() const { return m_a.size(); }
+    value_type derivAt (size_t i) const { return m_da * m_a.derivAt(i); }
+    template <typename P> P derivPack (size_t i) const { return P(m_da) * m_a.template derivPack<P>(i); }
+    bool uniformSize (size_t n) const { return m_a.uniformSize(n); }
+  };
+
+  // result' = a' + sb * b'  with sb = +1 or -1
+  template <typename A, typename B, int SB>
+  class ADAddSub : public AutoDiffExpr<ADAddSub<A,B,SB>>
+  {
+  public:
+    using value_type = typename A::value_type;
+  private:
+    typename ADStorage<A>::type m_a;
+    typename ADStorage<B>::type m_b;
+    value_type m_val;
+  public:
+    ADAddSub (const A & a, const B & b, value_type val) : m_a(a), m_b(b), m_val(val) { }
+    value_type value() const { return m_val; }
+    size_t size() const { return std::max(m_a.size(), m_b.size()); }
+    value_type derivAt (size_t i) const
+    {
+      if constexpr (SB > 0)
+        return m_a.derivAt(i) + m_b.derivAt(i);
+      else
+        return m_a.derivAt(i) - m_b.derivAt(i);
+    }
+    template <typename P> P derivPack (size_t i) const
+    {
+      if constexpr (SB > 0)
+        return m_a.template derivPack<P>(i) + m_b.template derivPack<P>(i);
+      else
+        return m_a.template derivPack<P>(i) - m_b.template derivPack<P>(i);
+    }
+    bool uniformSize (size_t n) const { return m_a.uniformSize(n) && m_b.uniformSize(n); }
+  };
+
+  // result' = da * a' + db * b'   (products, quotients)
+  template <typename A, typename B>
+  class ADLinear : public AutoDiffExpr<ADLinear<A,B>>
+  {
+  public:
+    using value_type = typename A::value_type;
+  private:
+    typename ADStorage<A>::type m_a;
+    typename ADStorage<B>::type m_b;
+    value_type m_val, m_da, m_db;
+  public:
+    ADLinear (const A & a, value_type da, const B & b, value_type db, value_type val)
+      : m_a(a), m_b(b), m_val(val), m_da(da), m_db(db) { }
+    value_type value() const { return m_val; }
+    size_t size() const { return std::max(m_a.size(), m_b.size()); }
+    value_type derivAt (size_t i) const { return m_da * m_a.derivAt(i) + m_db * m_b.derivAt(i); }
+    template <typename P> P derivPack (size_t i) const
+    {
+      return P(m_da) * m_a.template derivPack<P>(i) + P(m_db) * m_b.template derivPack<P>(i);
+    }
+    bool uniformSize (size_t n) const { return m_a.uniformSize(n) && m_b.uniformSize(n); }
+  };
+
+
   template <typename T = double>
   auto derivative (const AutoDiff<T>& v, size_t index)
   {
@@ -56,6 +494,12 @@ namespace ASC_ode
     return T(0);
   }
 
+  template <typename E>
+  auto derivative (const AutoDiffExpr<E>& v, size_t index)
+  {
+    return v.derived().derivAt(index);
+  }
+
 
   template <typename T>
   std::ostream & operator<< (std::ostream& os, const AutoDiff<T>& ad)
@@ -70,6 +514,12 @@ namespace ASC_ode
     return os;
   }
 
+  template <typename E>
+  std::ostream & operator<< (std::ostream& os, const AutoDiffExpr<E>& e)
+  {
+    return os << AutoDiff<typename E::value_type>(e);
+  }
+
   // Helper to get max size of two AutoDiff objects
   template <typename T>
   size_t maxSize(const AutoDiff<T>& a, const AutoDiff<T>& b)
@@ -81,188 +531,444 @@ namespace ASC_ode
   template <typename T>
   T safeGetDeriv(const AutoDiff<T>& a, size_t i)
   {
-    return (i < a.size()) ? a.deriv()[i] : T(0);
+    return a.derivAt(i);
   }
 
-  template <typename T = double>
-  AutoDiff<T> operator+ (const AutoDiff<T>& a, const AutoDiff<T>& b)
+
+  // Operators build expression nodes. Scalar operands are taken as
+  // E::value_type (not deduced) and never allocate a derivative vector.
+
+  template <typename A, typename B>
+  auto operator+ (const AutoDiffExpr<A>& a, const AutoDiffExpr<B>& b)
   {
-    size_t n = maxSize(a, b);
-    AutoDiff<T> result(a.value() + b.value(), n);
-    for (size_t i = 0; i < n; i++)
-      result.deriv()[i] = safeGetDeriv(a, i) + safeGetDeriv(b, i);
+    const A & ea = a.derived();
+    const B & eb = b.derived();
+    return ADAddSub<A,B,1>(ea, eb, ea.value() + eb.value());
+  }
+
+  template <typename E>
+  auto operator+ (typename E::value_type a, const AutoDiffExpr<E>& b)
+  {
+    return ADShift<E>(b.derived(), a + b.derived().value());
+  }
+
+  template <typename E>
+  auto operator+ (const AutoDiffExpr<E>& a, typename E::value_type b)
+  {
+    return ADShift<E>(a.derived(), a.derived().value() + b);
+  }
+
+  template <typename A, typename B>
+  auto operator* (const AutoDiffExpr<A>& a, const AutoDiffExpr<B>& b)
+  {
+    const A & ea = a.derived();
+    const B & eb = b.derived();
+    return ADLinear<A,B>(ea, eb.value(), eb, ea.value(), ea.value() * eb.value());
+  }
+
+  template <typename E>
+  auto operator* (typename E::value_type s, const AutoDiffExpr<E>& b)
+  {
+    return ADScale<E>(b.derived(), s * b.derived().value(), s);
+  }
+
+  template <typename E>
+  auto operator* (const AutoDiffExpr<E>& a, typename E::value_type s)
+  {
+    return ADScale<E>(a.derived(), a.derived().value() * s, s);
+  }
+
+  // unary minus: -ad
+  template <typename E>
+  auto operator- (const AutoDiffExpr<E>& a)
+  {
+    using T = typename E::value_type;
+    return ADScale<E>(a.derived(), -a.derived().value(), T(-1));
+  }
+
+  // binary subtraction: ad1 - ad2
+  template <typename A, typename B>
+  auto operator- (const AutoDiffExpr<A>& a, const AutoDiffExpr<B>& b)
+  {
+    const A & ea = a.derived();
+    const B & eb = b.derived();
+    return ADAddSub<A,B,-1>(ea, eb, ea.value() - eb.value());
+  }
+
+  // AutoDiff - scalar
+  template <typename E>
+  auto operator- (const AutoDiffExpr<E>& a, typename E::value_type b)
+  {
+    return ADShift<E>(a.derived(), a.derived().value() - b);
+  }
+
+  // scalar - AutoDiff
+  template <typename E>
+  auto operator- (typename E::value_type a, const AutoDiffExpr<E>& b)
+  {
+    using T = typename E::value_type;
+    return ADScale<E>(b.derived(), a - b.derived().value(), T(-1));
+  }
+
+  // division: ad1 / ad2
+  template <typename A, typename B>
+  auto operator/ (const AutoDiffExpr<A>& a, const AutoDiffExpr<B>& b)
+  {
+    using T = typename A::value_type;
+    const A & ea = a.derived();
+    const B & eb = b.derived();
+    T inv = T(1) / eb.value();
+    T val = ea.value() * inv;
+    return ADLinear<A,B>(ea, inv, eb, -val * inv, val);
+  }
+
+  // AutoDiff / scalar
+  template <typename E>
+  auto operator/ (const AutoDiffExpr<E>& a, typename E::value_type b)
+  {
+    using T = typename E::value_type;
+    return ADScale<E>(a.derived(), a.derived().value() / b, T(1) / b);
+  }
+
+  // scalar / AutoDiff
+  template <typename E>
+  auto operator/ (typename E::value_type a, const AutoDiffExpr<E>& b)
+  {
+    using T = typename E::value_type;
+    T val = a / b.derived().value();
+    return ADScale<E>(b.derived(), val, -val / b.derived().value());
+  }
+
+  // compound assignment updates the derivative vector in place
+  template <typename T, typename E>
+  AutoDiff<T> & operator+= (AutoDiff<T>& a, const AutoDiffExpr<E>& b)
+  {
+    return a = a + b;
+  }
+
+  template <typename T, typename E>
+  AutoDiff<T> & operator-= (AutoDiff<T>& a, const AutoDiffExpr<E>& b)
+  {
+    return a = a - b;
+  }
+
+  template <typename T, typename E>
+  AutoDiff<T> & operator*= (AutoDiff<T>& a, const AutoDiffExpr<E>& b)
+  {
+    return a = a * b;
+  }
+
+  template <typename T, typename E>
+  AutoDiff<T> & operator/= (AutoDiff<T>& a, const AutoDiffExpr<E>& b)
+  {
+    return a = a / b;
+  }
+
+  using std::sin;
+  using std::cos;
+
+  template <typename E>
+  auto sin(const AutoDiffExpr<E> &a)
+  {
+    auto v = a.derived().value();
+    return ADScale<E>(a.derived(), sin(v), cos(v));
+  }
+
+  template <typename E>
+  auto cos(const AutoDiffExpr<E> &a)
+  {
+    auto v = a.derived().value();
+    return ADScale<E>(a.derived(), cos(v), -sin(v));
+  }
+
+  using std::exp;
+  using std::log;
+
+  template <typename E>
+  auto exp(const AutoDiffExpr<E>& a)
+  {
+    auto v = exp(a.derived().value());
+    return ADScale<E>(a.derived(), v, v);   // d/dx exp(u) = exp(u)*u'
+  }
+
+  template <typename E>
+  auto log(const AutoDiffExpr<E>& a)
+  {
+    using T = typename E::value_type;
+    T v = a.derived().value();
+    return ADScale<E>(a.derived(), log(v), T(1) / v);   // d/dx log(u) = u'/u
+  }
+
+  using std::sqrt;
+
+  template <typename E>
+  auto sqrt(const AutoDiffExpr<E>& a)
+  {
+    using T = typename E::value_type;
+    T v = sqrt(a.derived().value());
+    return ADScale<E>(a.derived(), v, T(1) / (T(2) * v));   // d/dx sqrt(u) = u'/(2*sqrt(u))
+  }
+
+  // norm2 for scalar AutoDiff (squared magnitude, used by nanoblas internally)
+  template <typename E>
+  auto norm2(const AutoDiffExpr<E>& a)
+  {
+    using T = typename E::value_type;
+    T v = a.derived().value();
+    return ADScale<E>(a.derived(), v * v, T(2) * v);   // For real numbers, |x|^2 = x^2
+  }
+
+
+  // Fixed-size AutoDiff class - number of derivatives N known at compile time.
+  // Derivatives live in a std::array, so arithmetic never touches the heap.
+  // T may itself be an AutoDiff type (nesting gives higher derivatives).
+  template <size_t N, typename T = double>
+  class FixedAutoDiff
+  {
+  private:
+    T m_val;
+    std::array<T, N> m_deriv;
+  public:
+    // Default constructor
+    FixedAutoDiff () : m_val(0) { m_deriv.fill(T(0)); }
+
+    // Construct from value (all derivatives zero)
+    FixedAutoDiff (T v) : m_val(v) { m_deriv.fill(T(0)); }
+
+    // Construct as variable: value v, derivative 1 at index derivIndex
+    FixedAutoDiff (T v, size_t derivIndex) : m_val(v)
+    {
+      m_deriv.fill(T(0));
+      if (derivIndex < N)
+        m_deriv[derivIndex] = T(1);
+    }
+
+    T value() const { return m_val; }
+    std::array<T, N>& deriv() { return m_deriv; }
+    const std::array<T, N>& deriv() const { return m_deriv; }
+    static constexpr size_t size() { return N; }
+  };
+
+
+  template <size_t N, typename T>
+  auto derivative (const FixedAutoDiff<N, T>& v, size_t index)
+  {
+    if (index < N)
+      return v.deriv()[index];
+    return T(0);
+  }
+
+
+  template <size_t N, typename T>
+  std::ostream & operator<< (std::ostream& os, const FixedAutoDiff<N, T>& ad)
+  {
+    os << "Value: " << ad.value() << ", Deriv: [";
+    for (size_t i = 0; i < N; i++)
+    {
+      os << ad.deriv()[i];
+      if (i < N - 1) os << ", ";
+    }
+    os << "]";
+    return os;
+  }
+
+  // The scalar operand is taken as std::type_identity_t<T> so that it is not
+  // deduced: plain doubles then also combine with nested FixedAutoDiff types.
+
+  template <size_t N, typename T>
+  FixedAutoDiff<N, T> operator+ (const FixedAutoDiff<N, T>& a, const FixedAutoDiff<N, T>& b)
+  {
+    FixedAutoDiff<N, T> result(a.value() + b.value());
+    for (size_t i = 0; i < N; i++)
+      result.deriv()[i] = a.deriv()[i] + b.deriv()[i];
     return result;
   }
 
-  template <typename T = double>
-  auto operator+ (T a, const AutoDiff<T>& b) { return AutoDiff<T>(a, b.size()) + b; }
+  template <size_t N, typename T>
+  FixedAutoDiff<N, T> operator+ (std::type_identity_t<T> a, const FixedAutoDiff<N, T>& b)
+  {
+    FixedAutoDiff<N, T> result(a + b.value());
+    result.deriv() = b.deriv();
+    return result;
+  }
 
-  template <typename T = double>
-  auto operator+ (const AutoDiff<T>& a, T b) { return a + AutoDiff<T>(b, a.size()); }
+  template <size_t N, typename T>
+  FixedAutoDiff<N, T> operator+ (const FixedAutoDiff<N, T>& a, std::type_identity_t<T> b) { return b + a; }
 
-  template <typename T = double>
-  AutoDiff<T> operator* (const AutoDiff<T>& a, const AutoDiff<T>& b)
+  template <size_t N, typename T>
+  FixedAutoDiff<N, T> operator* (const FixedAutoDiff<N, T>& a, const FixedAutoDiff<N, T>& b)
   {
-    size_t n = maxSize(a, b);
-    AutoDiff<T> result(a.value() * b.value(), n);
-    for (size_t i = 0; i < n; i++)
-      result.deriv()[i] = safeGetDeriv(a, i) * b.value() + a.value() * safeGetDeriv(b, i);
+    FixedAutoDiff<N, T> result(a.value() * b.value());
+    for (size_t i = 0; i < N; i++)
+      result.deriv()[i] = a.deriv()[i] * b.value() + a.value() * b.deriv()[i];
     return result;
   }
 
-  template <typename T = double>
-  auto operator* (T s, const AutoDiff<T>& b) { return AutoDiff<T>(s, b.size()) * b; }
+  template <size_t N, typename T>
+  FixedAutoDiff<N, T> operator* (std::type_identity_t<T> s, const FixedAutoDiff<N, T>& b)
+  {
+    FixedAutoDiff<N, T> result(s * b.value());
+    for (size_t i = 0; i < N; i++)
+      result.deriv()[i] = s * b.deriv()[i];
+    return result;
+  }
 
-  template <typename T = double>
-  auto operator* (const AutoDiff<T>& a, T s) { return a * AutoDiff<T>(s, a.size()); }
+  template <size_t N, typename T>
+  FixedAutoDiff<N, T> operator* (const FixedAutoDiff<N, T>& a, std::type_identity_t<T> s) { return s * a; }
 
   // unary minus: -ad
-  template <typename T = double>
-  AutoDiff<T> operator- (const AutoDiff<T>& a)
+  template <size_t N, typename T>
+  FixedAutoDiff<N, T> operator- (const FixedAutoDiff<N, T>& a)
   {
-    AutoDiff<T> result(-a.value(), a.size());
-    for (size_t i = 0; i < a.size(); ++i)
+    FixedAutoDiff<N, T> result(-a.value());
+    for (size_t i = 0; i < N; i++)
       result.deriv()[i] = -a.deriv()[i];
     return result;
   }
 
   // binary subtraction: ad1 - ad2
-  template <typename T = double>
-  AutoDiff<T> operator- (const AutoDiff<T>& a, const AutoDiff<T>& b)
+  template <size_t N, typename T>
+  FixedAutoDiff<N, T> operator- (const FixedAutoDiff<N, T>& a, const FixedAutoDiff<N, T>& b)
   {
-    size_t n = maxSize(a, b);
-    AutoDiff<T> result(a.value() - b.value(), n);
-    for (size_t i = 0; i < n; ++i)
-      result.deriv()[i] = safeGetDeriv(a, i) - safeGetDeriv(b, i);
+    FixedAutoDiff<N, T> result(a.value() - b.value());
+    for (size_t i = 0; i < N; i++)
+      result.deriv()[i] = a.deriv()[i] - b.deriv()[i];
     return result;
   }
 
   // AutoDiff - scalar
-  template <typename T = double>
-  AutoDiff<T> operator- (const AutoDiff<T>& a, T b)
+  template <size_t N, typename T>
+  FixedAutoDiff<N, T> operator- (const FixedAutoDiff<N, T>& a, std::type_identity_t<T> b)
   {
-    return a - AutoDiff<T>(b, a.size());
+    FixedAutoDiff<N, T> result(a.value() - b);
+    result.deriv() = a.deriv();
+    return result;
   }
 
   // scalar - AutoDiff
-  template <typename T = double>
-  AutoDiff<T> operator- (T a, const AutoDiff<T>& b)
+  template <size_t N, typename T>
+  FixedAutoDiff<N, T> operator- (std::type_identity_t<T> a, const FixedAutoDiff<N, T>& b)
   {
-    return AutoDiff<T>(a, b.size()) - b;
+    FixedAutoDiff<N, T> result(a - b.value());
+    for (size_t i = 0; i < N; i++)
+      result.deriv()[i] = -b.deriv()[i];
+    return result;
   }
 
   // division: ad1 / ad2
-  template <typename T = double>
-  AutoDiff<T> operator/ (const AutoDiff<T>& a, const AutoDiff<T>& b)
+  template <size_t N, typename T>
+  FixedAutoDiff<N, T> operator/ (const FixedAutoDiff<N, T>& a, const FixedAutoDiff<N, T>& b)
   {
-    size_t n = maxSize(a, b);
-    AutoDiff<T> result(a.value() / b.value(), n);
+    FixedAutoDiff<N, T> result(a.value() / b.value());
     T denom = b.value() * b.value();
-    for (size_t i = 0; i < n; ++i)
-      result.deriv()[i] = (safeGetDeriv(a, i) * b.value() - a.value() * safeGetDeriv(b, i)) / denom;
+    for (size_t i = 0; i < N; i++)
+      result.deriv()[i] = (a.deriv()[i] * b.value() - a.value() * b.deriv()[i]) / denom;
     return result;
   }
 
   // AutoDiff / scalar
-  template <typename T = double>
-  AutoDiff<T> operator/ (const AutoDiff<T>& a, T b)
+  template <size_t N, typename T>
+  FixedAutoDiff<N, T> operator/ (const FixedAutoDiff<N, T>& a, std::type_identity_t<T> b)
   {
-    return a / AutoDiff<T>(b, a.size());
+    FixedAutoDiff<N, T> result(a.value() / b);
+    for (size_t i = 0; i < N; i++)
+      result.deriv()[i] = a.deriv()[i] / b;
+    return result;
   }
 
   // scalar / AutoDiff
-  template <typename T = double>
-  auto operator/ (T a, const AutoDiff<T>& b) { return AutoDiff<T>(a, b.size()) / b; }
+  template <size_t N, typename T>
+  FixedAutoDiff<N, T> operator/ (std::type_identity_t<T> a, const FixedAutoDiff<N, T>& b)
+  {
+    FixedAutoDiff<N, T> result(a / b.value());
+    T fac = -a / (b.value() * b.value());
+    for (size_t i = 0; i < N; i++)
+      result.deriv()[i] = fac * b.deriv()[i];
+    return result;
+  }
 
-  // operator +=
-  template <typename T = double>
-  auto operator+= (AutoDiff<T>& a, const AutoDiff<T>& b)
+  template <size_t N, typename T>
+  auto operator+= (FixedAutoDiff<N, T>& a, const FixedAutoDiff<N, T>& b)
   {
     a = a + b;
     return a;
   }
 
-  template <typename T = double>
-  auto operator-= (AutoDiff<T>& a, const AutoDiff<T>& b)
+  template <size_t N, typename T>
+  auto operator-= (FixedAutoDiff<N, T>& a, const FixedAutoDiff<N, T>& b)
   {
     a = a - b;
     return a;
   }
 
-  template <typename T = double>
-  auto operator*= (AutoDiff<T>& a, const AutoDiff<T>& b)
+  template <size_t N, typename T>
+  auto operator*= (FixedAutoDiff<N, T>& a, const FixedAutoDiff<N, T>& b)
   {
     a = a * b;
     return a;
   }
 
-  template <typename T = double>
-  auto operator/= (AutoDiff<T>& a, const AutoDiff<T>& b)
+  template <size_t N, typename T>
+  auto operator/= (FixedAutoDiff<N, T>& a, const FixedAutoDiff<N, T>& b)
   {
     a = a / b;
     return a;
   }
 
-  using std::sin;
-  using std::cos;
-
-  template <typename T = double>
-  AutoDiff<T> sin(const AutoDiff<T> &a)
+  template <size_t N, typename T>
+  FixedAutoDiff<N, T> sin(const FixedAutoDiff<N, T> &a)
   {
-    AutoDiff<T> result(sin(a.value()), a.size());
-    for (size_t i = 0; i < a.size(); i++)
-      result.deriv()[i] = cos(a.value()) * a.deriv()[i];
+    FixedAutoDiff<N, T> result(sin(a.value()));
+    T c = cos(a.value());
+    for (size_t i = 0; i < N; i++)
+      result.deriv()[i] = c * a.deriv()[i];
     return result;
   }
 
-  template <typename T = double>
-  AutoDiff<T> cos(const AutoDiff<T> &a)
+  template <size_t N, typename T>
+  FixedAutoDiff<N, T> cos(const FixedAutoDiff<N, T> &a)
   {
-    AutoDiff<T> result(cos(a.value()), a.size());
-    for (size_t i = 0; i < a.size(); i++)
-      result.deriv()[i] = -sin(a.value()) * a.deriv()[i];
+    FixedAutoDiff<N, T> result(cos(a.value()));
+    T s = -sin(a.value());
+    for (size_t i = 0; i < N; i++)
+      result.deriv()[i] = s * a.deriv()[i];
     return result;
   }
 
-  using std::exp;
-  using std::log;
-
-  template <typename T = double>
-  AutoDiff<T> exp(const AutoDiff<T>& a)
+  template <size_t N, typename T>
+  FixedAutoDiff<N, T> exp(const FixedAutoDiff<N, T>& a)
   {
     T v = exp(a.value());
-    AutoDiff<T> result(v, a.size());
-    for (size_t i = 0; i < a.size(); ++i)
-      result.deriv()[i] = v * a.deriv()[i]; // d/dx exp(u) = exp(u)*u'
+    FixedAutoDiff<N, T> result(v);
+    for (size_t i = 0; i < N; i++)
+      result.deriv()[i] = v * a.deriv()[i];
     return result;
   }
 
-  template <typename T = double>
-  AutoDiff<T> log(const AutoDiff<T>& a)
+  template <size_t N, typename T>
+  FixedAutoDiff<N, T> log(const FixedAutoDiff<N, T>& a)
   {
-    AutoDiff<T> result(log(a.value()), a.size());
-    for (size_t i = 0; i < a.size(); ++i)
-      result.deriv()[i] = a.deriv()[i] / a.value(); // d/dx log(u) = u'/u
+    FixedAutoDiff<N, T> result(log(a.value()));
+    for (size_t i = 0; i < N; i++)
+      result.deriv()[i] = a.deriv()[i] / a.value();
     return result;
   }
 
-  using std::sqrt;
-
-  template <typename T = double>
-  AutoDiff<T> sqrt(const AutoDiff<T>& a)
+  template <size_t N, typename T>
+  FixedAutoDiff<N, T> sqrt(const FixedAutoDiff<N, T>& a)
   {
     T v = sqrt(a.value());
-    AutoDiff<T> result(v, a.size());
-    for (size_t i = 0; i < a.size(); ++i)
-      result.deriv()[i] = a.deriv()[i] / (T(2) * v);  // d/dx sqrt(u) = u'/(2*sqrt(u))
+    FixedAutoDiff<N, T> result(v);
+    T fac = T(1) / (T(2) * v);
+    for (size_t i = 0; i < N; i++)
+      result.deriv()[i] = fac * a.deriv()[i];
     return result;
   }
 
-  // norm2 for scalar AutoDiff (squared magnitude, used by nanoblas internally)
-  template <typename T = double>
-  AutoDiff<T> norm2(const AutoDiff<T>& a)
+  template <size_t N, typename T>
+  FixedAutoDiff<N, T> norm2(const FixedAutoDiff<N, T>& a)
   {
-    return a * a;  // For real numbers, |x|^2 = x^2
+    return a * a;
   }
 
   // Vector norm for any indexable container of AutoDiff (or double)
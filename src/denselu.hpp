@@ -0,0 +1,154 @@
+#ifndef DENSELU_HPP
+#define DENSELU_HPP
+
+#include <cstddef>
+#include <cmath>
+#include <complex>
+#include <vector>
+#include <numeric>
+#include <algorithm>
+#include <stdexcept>
+
+#include <vector.hpp>
+#include <matrix.hpp>
+
+
+namespace ASC_ode
+{
+  using namespace nanoblas;
+
+
+  enum class Pivoting
+  {
+    None,       // keep the natural order, for matrices known to be safe
+    Partial,    // largest entry of the column
+    Complete    // largest entry of the remaining matrix
+  };
+
+
+  // Dense LU factorization  P A Q = L U,  computed in place.
+  //
+  // The storage is kept between factorizations of matrices of the same
+  // size, so refactoring does not allocate. With blocksize > 0 the matrix
+  // is taken as block-diagonal with square blocks of that size: pivoting,
+  // elimination and the triangular solves stay inside the blocks.
+  // T may be complex.
+  template <typename T = double>
+  class DenseLU
+  {
+    size_t m_n = 0;
+    size_t m_blocksize = 0;
+    Pivoting m_pivoting;
+    std::vector<T> m_lu;                      // L below, U on and above the diagonal, row-major
+    std::vector<size_t> m_rowperm, m_colperm; // row / column of A in position k
+    mutable std::vector<T> m_y;
+
+    T & lu (size_t i, size_t j) { return m_lu[i*m_n+j]; }
+    const T & lu (size_t i, size_t j) const { return m_lu[i*m_n+j]; }
+
+    size_t blockBegin (size_t k) const { return m_blocksize ? k / m_blocksize * m_blocksize : 0; }
+    size_t blockEnd (size_t k) const
+    {
+      return m_blocksize ? std::min(m_n, blockBegin(k) + m_blocksize) : m_n;
+    }
+
+  public:
+    DenseLU (Pivoting pivoting = Pivoting::Partial) : m_pivoting(pivoting) { }
+
+    DenseLU (MatrixView<T> a, Pivoting pivoting = Pivoting::Partial)
+      : m_pivoting(pivoting) { factor(a); }
+
+    size_t size() const { return m_n; }
+    Pivoting pivoting() const { return m_pivoting; }
+    void setPivoting (Pivoting pivoting) { m_pivoting = pivoting; }
+
+    void factor (MatrixView<T> a, size_t blocksize = 0)
+    {
+      if (a.rows() != a.cols())
+        throw std::invalid_argument("DenseLU: matrix must be square");
+      size_t n = m_n = a.rows();
+      m_blocksize = blocksize < n ? blocksize : 0;
+
+      m_lu.resize(n*n);
+      m_rowperm.resize(n);
+      m_colperm.resize(n);
+      m_y.resize(n);
+      for (size_t i = 0; i < n; i++)
+        for (size_t j = 0; j < n; j++)
+          lu(i,j) = a(i,j);
+      std::iota(m_rowperm.begin(), m_rowperm.end(), 0);
+      std::iota(m_colperm.begin(), m_colperm.end(), 0);
+
+      for (size_t k = 0; k < n; k++)
+        {
+          size_t first = blockBegin(k), end = blockEnd(k);
+
+          size_t pr = k, pc = k;
+          if (m_pivoting == Pivoting::Partial)
+            {
+              for (size_t i = k+1; i < end; i++)
+                if (std::abs(lu(i,k)) > std::abs(lu(pr,k)))
+                  pr = i;
+            }
+          else if (m_pivoting == Pivoting::Complete)
+            {
+              for (size_t i = k; i < end; i++)
+                for (size_t j = k; j < end; j++)
+                  if (std::abs(lu(i,j)) > std::abs(lu(pr,pc)))
+                    { pr = i; pc = j; }
+            }
+          if (std::abs(lu(pr,pc)) == 0)
+            throw std::domain_error("DenseLU: matrix is singular");
+
+          if (pr != k)
+            {
+              for (size_t j = first; j < end; j++)
+                std::swap(lu(k,j), lu(pr,j));
+              std::swap(m_rowperm[k], m_rowperm[pr]);
+            }
+          if (pc != k)
+            {
+              for (size_t i = first; i < end; i++)
+                std::swap(lu(i,k), lu(i,pc));
+              std::swap(m_colperm[k], m_colperm[pc]);
+            }
+
+          T piv = lu(k,k);
+          for (size_t i = k+1; i < end; i++)
+            {
+              T l = lu(i,k) /= piv;
+              if (l == T(0)) continue;
+              for (size_t j = k+1; j < end; j++)
+                lu(i,j) -= l * lu(k,j);
+            }
+        }
+    }
+
+    // solve A x = b, x and b may be the same vector
+    void solve (VectorView<T> b, VectorView<T> x) const
+    {
+      for (size_t i = 0; i < m_n; i++)
+        m_y[i] = b(m_rowperm[i]);
+      for (size_t i = 0; i < m_n; i++)
+        {
+          T sum = m_y[i];
+          for (size_t j = blockBegin(i); j < i; j++)
+            sum -= lu(i,j) * m_y[j];
+          m_y[i] = sum;
+        }
+      for (size_t i = m_n; i-- > 0; )
+        {
+          T sum = m_y[i];
+          size_t end = blockEnd(i);
+          for (size_t j = i+1; j < end; j++)
+            sum -= lu(i,j) * m_y[j];
+          m_y[i] = sum / lu(i,i);
+        }
+      for (size_t i = 0; i < m_n; i++)
+        x(m_colperm[i]) = m_y[i];
+    }
+  };
+
+}
+
+#endif
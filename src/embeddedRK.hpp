@@ -0,0 +1,291 @@
+#ifndef EMBEDDEDRK_HPP
+#define EMBEDDEDRK_HPP
+
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+#include <vector.hpp>
+#include <matrix.hpp>
+
+#include "timestepper.hpp"
+#include "implicitRK.hpp"
+
+
+namespace ASC_ode
+{
+  using namespace nanoblas;
+
+
+  // Explicit Butcher tableau with a second weight vector bhat: the difference
+  // y_n+1 - yhat_n+1 = tau sum_j (b_j - bhat_j) k_j estimates the local error.
+  struct EmbeddedTableau
+  {
+    Matrix<> a;
+    Vector<> b, bhat, c;
+    int order;      // of the error estimate, the lower one of b and bhat
+    bool fsal;      // first same as last: the last stage is f(y_n+1)
+  };
+
+  // order 3(2), 4 stages, FSAL
+  inline EmbeddedTableau BogackiShampine()
+  {
+    return { Matrix<> { { 0, 0, 0, 0 },
+                        { 1.0/2, 0, 0, 0 },
+                        { 0, 3.0/4, 0, 0 },
+                        { 2.0/9, 1.0/3, 4.0/9, 0 } },
+             Vector<> { 2.0/9, 1.0/3, 4.0/9, 0 },
+             Vector<> { 7.0/24, 1.0/4, 1.0/3, 1.0/8 },
+             Vector<> { 0, 1.0/2, 3.0/4, 1 },
+             2, true };
+  }
+
+  // order 5(4), 7 stages, FSAL
+  inline EmbeddedTableau DormandPrince()
+  {
+    return { Matrix<> { { 0, 0, 0, 0, 0, 0, 0 },
+                        { 1.0/5, 0, 0, 0, 0, 0, 0 },
+                        { 3.0/40, 9.0/40, 0, 0, 0, 0, 0 },
+                        { 44.0/45, -56.0/15, 32.0/9, 0, 0, 0, 0 },
+                        { 19372.0/6561, -25360.0/2187, 64448.0/6561, -212.0/729, 0, 0, 0 },
+                        { 9017.0/3168, -355.0/33, 46732.0/5247, 49.0/176, -5103.0/18656, 0, 0 },
+                        { 35.0/384, 0, 500.0/1113, 125.0/192, -2187.0/6784, 11.0/84, 0 } },
+             Vector<> { 35.0/384, 0, 500.0/1113, 125.0/192, -2187.0/6784, 11.0/84, 0 },
+             Vector<> { 5179.0/57600, 0, 7571.0/16695, 393.0/640, -92097.0/339200, 187.0/2100, 1.0/40 },
+             Vector<> { 0, 1.0/5, 3.0/10, 4.0/5, 8.0/9, 1, 1 },
+             4, true };
+  }
+
+  // order 5(4), 6 stages
+  inline EmbeddedTableau CashKarp()
+  {
+    return { Matrix<> { { 0, 0, 0, 0, 0, 0 },
+                        { 1.0/5, 0, 0, 0, 0, 0 },
+                        { 3.0/40, 9.0/40, 0, 0, 0, 0 },
+                        { 3.0/10, -9.0/10, 6.0/5, 0, 0, 0 },
+                        { -11.0/54, 5.0/2, -70.0/27, 35.0/27, 0, 0 },
+                        { 1631.0/55296, 175.0/512, 575.0/13824, 44275.0/110592, 253.0/4096, 0 } },
+             Vector<> { 37.0/378, 0, 250.0/621, 125.0/594, 0, 512.0/1771 },
+             Vector<> { 2825.0/27648, 0, 18575.0/48384, 13525.0/55296, 277.0/14336, 1.0/4 },
+             Vector<> { 0, 1.0/5, 3.0/10, 3.0/5, 1, 7.0/8 },
+             4, false };
+  }
+
+
+  // PI step size controller (Gustafsson): for a scaled error err <= 1 of an
+  // estimate of order q the next step is tau fac with
+  //   fac = safety err^-alpha errold^beta,  alpha = 0.7/(q+1), beta = 0.4/(q+1),
+  // limited to [minfac, maxfac]. beta = 0 gives the classical I controller.
+  // A rejected step is retried with safety err^-1/(q+1), and the step after
+  // a rejection may not grow.
+  class PIController
+  {
+    double m_alpha, m_beta;
+    double m_safety = 0.9, m_minfac = 0.2, m_maxfac = 5;
+    double m_errold = 1e-4;
+    bool m_rejected = false;
+    int m_order;
+
+  public:
+    PIController (int order = 4) { setOrder(order); }
+
+    // sets the default gains for an error estimate of the given order
+    void setOrder (int order)
+    {
+      m_order = order;
+      m_alpha = 0.7 / (order+1);
+      m_beta = 0.4 / (order+1);
+    }
+    void setGains (double alpha, double beta) { m_alpha = alpha; m_beta = beta; }
+    void setLimits (double safety, double minfac, double maxfac)
+    {
+      if (minfac <= 0 || minfac >= 1 || maxfac <= 1 || safety <= 0 || safety > 1)
+        throw std::invalid_argument("PIController: needs 0 < minfac < 1 < maxfac, 0 < safety <= 1");
+      m_safety = safety; m_minfac = minfac; m_maxfac = maxfac;
+    }
+    void reset() { m_errold = 1e-4; m_rejected = false; }
+
+    // factor for the step after an accepted one
+    double accept (double err)
+    {
+      err = std::max(err, 1e-10);
+      double fac = m_safety * std::pow(err, -m_alpha) * std::pow(m_errold, m_beta);
+      fac = std::clamp(fac, m_minfac, m_rejected ? 1.0 : m_maxfac);
+      m_errold = std::max(err, 1e-4);
+      m_rejected = false;
+      return fac;
+    }
+
+    // factor for the retry of a rejected step
+    double reject (double err)
+    {
+      m_rejected = true;
+      return std::clamp(m_safety * std::pow(err, -1.0/(m_order+1)), m_minfac, m_safety);
+    }
+  };
+
+
+  // Explicit Runge-Kutta method with an embedded error estimate. DoStep takes
+  // the given step, AdaptiveStep chooses it: the scaled error
+  //   err = sqrt(1/n sum_i (e_i / (atol + rtol max(|y_n,i|, |y_n+1,i|)))^2)
+  // of a step must be at most 1, otherwise it is rejected and retried with a
+  // smaller one. The controller proposes the next step size.
+  class EmbeddedRungeKutta : public ExplicitRungeKutta
+  {
+    Vector<> m_d;       // b - bhat
+    int m_order;
+    bool m_fsal;
+    Vector<> m_ynew, m_errvec;
+    double m_err = 0;
+    PIController m_controller;
+
+    double m_atol = 1e-6, m_rtol = 1e-6;
+    double m_tau = 0;                   // proposed step size, 0: estimate
+    double m_taumin = 1e-14, m_taumax = 0;
+    int m_maxrejections = 20;
+    bool m_k0valid = false;             // k_0 = f(y) from the last accepted step
+
+    int m_accepted = 0, m_rejected = 0, m_evaluations = 0;
+
+  public:
+    EmbeddedRungeKutta (std::shared_ptr<NonlinearFunction> rhs, const EmbeddedTableau & tab)
+      : ExplicitRungeKutta(rhs, tab.a, tab.b, tab.c),
+        m_d(tab.b - tab.bhat), m_order(tab.order), m_fsal(tab.fsal),
+        m_ynew(m_n), m_errvec(m_n), m_controller(tab.order)
+    { }
+
+    void setTolerance (double atol, double rtol)
+    {
+      if (atol < 0 || rtol < 0 || atol + rtol == 0)
+        throw std::invalid_argument("EmbeddedRungeKutta: tolerances must be >= 0, not both 0");
+      m_atol = atol; m_rtol = rtol;
+    }
+    // bounds of the step size, taumax = 0: unbounded
+    void setStepLimits (double taumin, double taumax) { m_taumin = taumin; m_taumax = taumax; }
+    // a step failing maxrejections times in a row, or below taumin, throws
+    void setMaxRejections (int maxrejections) { m_maxrejections = maxrejections; }
+    // first step size, otherwise estimated from f(y_0)
+    void setInitialStep (double tau) { m_tau = tau; }
+    // after y was changed between adaptive steps
+    void restart() { m_k0valid = false; m_controller.reset(); }
+
+    PIController & controller() { return m_controller; }
+    double proposedStep() const { return m_tau; }
+    // scaled error of the last step
+    double error() const { return m_err; }
+    int accepted() const { return m_accepted; }
+    int rejected() const { return m_rejected; }
+    int evaluations() const { return m_evaluations; }
+
+    // fixed step size, the error estimate is available from error()
+    void DoStep (double tau, VectorView<> y) override
+    {
+      trialStep(tau, y, 0);
+      y = m_ynew;
+      m_k0valid = false;
+    }
+
+    // one accepted step of at most tmax, returns its size
+    double AdaptiveStep (VectorView<> y, double tmax)
+    {
+      auto k_0 = m_k.range(0, m_n);
+      if (!m_k0valid)
+      {
+        m_rhs->evaluate(y, k_0);
+        m_evaluations++;
+        m_k0valid = true;
+      }
+      if (m_tau == 0)
+        m_tau = initialStep(y);
+
+      for (int rejections = 0; ; rejections++)
+      {
+        double tau = std::min(m_tau, tmax);
+        if (m_taumax > 0) tau = std::min(tau, m_taumax);
+        trialStep(tau, y, 1);
+
+        if (m_err <= 1)
+        {
+          y = m_ynew;
+          m_accepted++;
+          if (m_fsal)
+            k_0 = m_k.range((m_stages-1) * m_n, m_stages * m_n);
+          else
+            m_k0valid = false;
+          // a step cut at tmax keeps the larger proposal, unless the controller shrinks
+          double fac = m_controller.accept(m_err);
+          m_tau = tau < m_tau && fac >= 1 ? std::max(m_tau, tau * fac) : tau * fac;
+          return tau;
+        }
+
+        m_rejected++;
+        m_tau = tau * m_controller.reject(m_err);
+        if (m_tau < m_taumin || rejections+1 >= m_maxrejections)
+          throw std::domain_error("EmbeddedRungeKutta: step size too small at tolerance "
+                                  + std::to_string(m_rtol));
+      }
+    }
+
+  private:
+    // y_n+1 into m_ynew and its scaled error into m_err
+    void trialStep (double tau, VectorView<> y, int first)
+    {
+      computeStages(tau, y, first);
+      m_evaluations += m_stages - first;
+
+      m_ynew = y;
+      m_errvec = 0.0;
+      for (int j = 0; j < m_stages; j++)
+      {
+        auto k_j = m_k.range(j * m_n, (j + 1) * m_n);
+        if (m_b(j) != 0.0) m_ynew += tau * m_b(j) * k_j;
+        if (m_d(j) != 0.0) m_errvec += tau * m_d(j) * k_j;
+      }
+
+      double sum = 0;
+      for (int i = 0; i < m_n; i++)
+      {
+        double sc = m_atol + m_rtol * std::max(std::abs(y(i)), std::abs(m_ynew(i)));
+        sum += (m_errvec(i) / sc) * (m_errvec(i) / sc);
+      }
+      m_err = std::sqrt(sum / m_n);
+    }
+
+    double scaledNorm (VectorView<> v, VectorView<> y) const
+    {
+      double sum = 0;
+      for (int i = 0; i < m_n; i++)
+      {
+        double sc = m_atol + m_rtol * std::abs(y(i));
+        sum += (v(i) / sc) * (v(i) / sc);
+      }
+      return std::sqrt(sum / m_n);
+    }
+
+    // Hairer, Norsett, Wanner: an explicit Euler step of the size making
+    // |tau f| 1% of |y| tests the variation of f; k_0 = f(y) is given
+    double initialStep (VectorView<> y)
+    {
+      auto k_0 = m_k.range(0, m_n);
+      auto k_1 = m_k.range(m_n, 2 * m_n);
+      double d0 = scaledNorm(y, y), d1 = scaledNorm(k_0, y);
+      double tau0 = (d0 < 1e-5 || d1 < 1e-5) ? 1e-6 : 0.01 * d0 / d1;
+
+      m_ystage = y;
+      m_ystage += tau0 * k_0;
+      m_rhs->evaluate(m_ystage, k_1);
+      m_evaluations++;
+      k_1 -= k_0;
+      double d2 = scaledNorm(k_1, y) / tau0;
+
+      double dmax = std::max(d1, d2);
+      double tau1 = dmax <= 1e-15 ? std::max(1e-6, 1e-3 * tau0)
+                                  : std::pow(0.01 / dmax, 1.0 / (m_order+2));
+      return std::min(100 * tau0, tau1);
+    }
+  };
+
+}
+
+#endif
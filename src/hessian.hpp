@@ -0,0 +1,80 @@
+#ifndef HESSIAN_HPP
+#define HESSIAN_HPP
+
+#include <vector.hpp>
+#include <matrix.hpp>
+
+#include "autodiff.hpp"
+#include "reverseAD.hpp"
+
+
+namespace ASC_ode
+{
+  using namespace nanoblas;
+
+  // Second-order automatic differentiation, built by nesting the AD types.
+
+  // Hessian-vector products: reverse mode over one forward direction.
+  // The adjoint of x_i is  dE/dx_i + eps * (H v)_i
+  template <typename T = double>
+  using HessVecAD = ReverseAD<FixedAutoDiff<1, T>>;
+
+  // full Hessian of functions with N variables: forward over forward,
+  // value().deriv()[i] is dE/dx_i, deriv()[j].deriv()[i] is d2E/dx_i dx_j
+  template <size_t N, typename T = double>
+  using HessianAD = FixedAutoDiff<N, FixedAutoDiff<N, T>>;
+
+
+  // Value, gradient and Hessian-vector product H*v of a scalar function in one
+  // forward and one backward sweep. 'func' gets x as VectorView<HessVecAD<>>
+  // and returns a HessVecAD<>.
+  template <typename FUNC>
+  double HessianVectorProduct (Tape<FixedAutoDiff<1>> & tape, FUNC && func,
+                               VectorView<double> x, VectorView<double> v,
+                               VectorView<double> grad, VectorView<double> hv)
+  {
+    TapeScope<FixedAutoDiff<1>> scope(tape);
+    Vector<HessVecAD<>> xad(x.size());
+    for (size_t i = 0; i < x.size(); i++)
+    {
+      FixedAutoDiff<1> xi(x(i));
+      xi.deriv()[0] = v(i);               // forward direction v
+      xad(i) = HessVecAD<>::variable(xi); // variables are the nodes 0..n-1
+    }
+
+    HessVecAD<> res = func(VectorView<HessVecAD<>>(x.size(), xad.data()));
+
+    auto & adj = tape.gradient(res.index());
+    for (size_t i = 0; i < x.size(); i++)
+    {
+      grad(i) = res.isConstant() ? 0.0 : adj[i].value();
+      hv(i) = res.isConstant() ? 0.0 : adj[i].deriv()[0];
+    }
+    return res.value().value();
+  }
+
+
+  // Value, gradient and Hessian of a scalar function of N variables.
+  // 'func' gets x as VectorView<HessianAD<N>> and returns a HessianAD<N>.
+  template <size_t N, typename FUNC>
+  double HessianFixed (FUNC && func, VectorView<double> x,
+                       VectorView<double> grad, MatrixView<double> hess)
+  {
+    std::array<HessianAD<N>, N> xmem;
+    for (size_t i = 0; i < N; i++)
+      xmem[i] = HessianAD<N>(FixedAutoDiff<N>(x(i), i), i);
+
+    HessianAD<N> res = func(VectorView<HessianAD<N>>(N, xmem.data()));
+
+    for (size_t i = 0; i < N; i++)
+    {
+      grad(i) = res.value().deriv()[i];
+      for (size_t j = 0; j < N; j++)
+        hess(i, j) = res.deriv()[j].deriv()[i];
+    }
+    return res.value().value();
+  }
+
+}
+
+#endif
@@ -1,6 +1,13 @@
 #ifndef IMPLICITRK_HPP
 #define IMPLICITRK_HPP
 
+#include <complex>
+#include <tuple>
+#include <vector>
+#include <limits>
+#include <string>
+#include <stdexcept>
+
 #include <vector.hpp>
 #include <matrix.hpp>
 #include <inverse.hpp>
@@ -20,19 +27,32 @@ namespace ASC_ode {
     int m_stages;
     int m_n;
     Vector<> m_k, m_y;
+    std::shared_ptr<NewtonWorkspace> m_newton;
+    StagePredictor m_predictor;
   public:
     ImplicitRungeKutta(std::shared_ptr<NonlinearFunction> rhs,
-      const Matrix<> &a, const Vector<> &b, const Vector<> &c) 
+      const Matrix<> &a, const Vector<> &b, const Vector<> &c, bool sparse = false) 
     : TimeStepper(rhs), m_a(a), m_b(b), m_c(c),
     m_tau(std::make_shared<Parameter>(0.0)),
-    m_stages(c.size()), m_n(rhs->dimX()), m_k(m_stages*m_n), m_y(m_stages*m_n)
+    m_stages(c.size()), m_n(rhs->dimX()), m_k(m_stages*m_n), m_y(m_stages*m_n),
+    m_predictor(c, rhs->dimX())
     {
       auto multiple_rhs = make_shared<MultipleFunc>(rhs, m_stages);
       m_yold = std::make_shared<ConstantFunction>(m_stages*m_n);
       auto knew = std::make_shared<IdentityFunction>(m_stages*m_n);
-      m_equ = knew - Compose(multiple_rhs, m_yold+m_tau*std::make_shared<MatVecFunc>(a, m_n));
+      m_equ = Simplify(knew - Compose(multiple_rhs, m_yold+m_tau*std::make_shared<MatVecFunc>(a, m_n)));
+      // sparse: solve the s*n stage system with the sparse Jacobian
+      m_newton = std::make_shared<NewtonWorkspace>(m_equ, Pivoting::Partial,
+                                                   sparse ? LinearSolver::SparseLU : LinearSolver::Auto);
+      m_newton->watch(m_tau);
     }
 
+    NewtonWorkspace & newton() { return *m_newton; }
+    NewtonStatistics statistics() const override { return m_newton->statistics(); }
+
+    // initial stages of Newton, Constant: k = 0
+    void setPredictor (Predictor predictor) { m_predictor.set(predictor); }
+
     void DoStep(double tau, VectorView<double> y) override
     {
       for (int j = 0; j < m_stages; j++)
@@ -40,20 +60,461 @@ namespace ASC_ode {
       m_yold->set(m_y);
 
       m_tau->set(tau);
-      m_k = 0.0;  
-      NewtonSolver(m_equ, m_k);
+      m_predictor.predict(tau, m_k);
+      NewtonSolver(*m_newton, m_k);
+      m_predictor.update(tau, m_k);
 
       for (int j = 0; j < m_stages; j++)
         y += tau * m_b(j) * m_k.range(j*m_n, (j+1)*m_n);
     }
   };
 
+  // Eigenvalues lambda and eigenvectors of a small real matrix, a = V diag(lambda) V^{-1}.
+  // Shifted QR iteration in complex arithmetic, then one inverse iteration
+  // per eigenvalue. Real eigenvalues get real eigenvectors, conjugate pairs
+  // conjugate ones. Column i of V belongs to lambda[i]. Throws if the matrix
+  // is not diagonalizable, detected by the residual of the eigenvectors and
+  // the condition number of V.
+  inline std::tuple<std::vector<std::complex<double>>, Matrix<std::complex<double>>>
+  EigenDecomposition (const Matrix<> & a)
+  {
+    using Complex = std::complex<double>;
+    size_t s = a.rows();
+    double scale = 0;
+    for (size_t i = 0; i < s; i++)
+      for (size_t j = 0; j < s; j++)
+        scale = std::max(scale, std::abs(a(i,j)));
+    double eps = 1e-14 * (scale > 0 ? scale : 1);
+
+    // QR iteration on the active leading block 0..m, Wilkinson shifts
+    Matrix<Complex> h(s, s), q(s, s), r(s, s);
+    for (size_t i = 0; i < s; i++)
+      for (size_t j = 0; j < s; j++)
+        h(i,j) = a(i,j);
+    std::vector<Complex> lambda(s);
+    size_t m = s-1, iterations = 0;
+    while (m > 0)
+      {
+        double offdiag = 0;
+        for (size_t j = 0; j < m; j++)
+          offdiag = std::max(offdiag, std::abs(h(m,j)));
+        if (offdiag < eps)
+          {
+            m--;
+            continue;
+          }
+        if (++iterations > 100*s)
+          throw std::domain_error("EigenDecomposition: QR iteration did not converge");
+
+        Complex tr = h(m-1,m-1) + h(m,m), det = h(m-1,m-1)*h(m,m) - h(m-1,m)*h(m,m-1);
+        Complex disc = std::sqrt(tr*tr/4.0 - det);
+        Complex mu1 = tr/2.0 + disc, mu2 = tr/2.0 - disc;
+        Complex mu = std::abs(mu1-h(m,m)) < std::abs(mu2-h(m,m)) ? mu1 : mu2;
+
+        // h - mu = q r by modified Gram-Schmidt, then h = r q + mu
+        for (size_t i = 0; i <= m; i++)
+          for (size_t j = 0; j <= m; j++)
+            q(i,j) = h(i,j) - (i == j ? mu : Complex(0));
+        for (size_t j = 0; j <= m; j++)
+          {
+            for (size_t k = 0; k < j; k++)
+              {
+                Complex dot = 0;
+                for (size_t i = 0; i <= m; i++)
+                  dot += std::conj(q(i,k)) * q(i,j);
+                r(k,j) = dot;
+                for (size_t i = 0; i <= m; i++)
+                  q(i,j) -= dot * q(i,k);
+              }
+            double nrm = 0;
+            for (size_t i = 0; i <= m; i++)
+              nrm += std::norm(q(i,j));
+            nrm = std::sqrt(nrm);
+            r(j,j) = nrm;
+            for (size_t k = j+1; k <= m; k++)
+              r(k,j) = 0;
+            for (size_t i = 0; i <= m; i++)
+              q(i,j) = nrm > 0 ? q(i,j) / nrm : Complex(i == j);
+          }
+        for (size_t i = 0; i <= m; i++)
+          for (size_t j = 0; j <= m; j++)
+            {
+              Complex sum = (i == j) ? mu : Complex(0);
+              for (size_t k = i; k <= m; k++)
+                sum += r(i,k) * q(k,j);
+              h(i,j) = sum;
+            }
+      }
+    for (size_t i = 0; i < s; i++)
+      lambda[i] = h(i,i);
+
+    // make real eigenvalues exactly real and pairs exactly conjugate
+    std::vector<bool> paired(s, false);
+    for (size_t i = 0; i < s; i++)
+      {
+        if (std::abs(lambda[i].imag()) < 1e-10 * (1 + std::abs(lambda[i])))
+          lambda[i] = lambda[i].real();
+        else if (lambda[i].imag() > 0 && !paired[i])
+          {
+            size_t best = s;
+            for (size_t j = 0; j < s; j++)
+              if (j != i && !paired[j] && lambda[j].imag() < 0 &&
+                  (best == s || std::abs(lambda[j]-std::conj(lambda[i])) <
+                                std::abs(lambda[best]-std::conj(lambda[i]))))
+                best = j;
+            if (best == s)
+              throw std::domain_error("EigenDecomposition: unpaired complex eigenvalue");
+            lambda[best] = std::conj(lambda[i]);
+            paired[i] = paired[best] = true;
+          }
+      }
+
+    // eigenvectors by inverse iteration with a slightly perturbed shift
+    Matrix<Complex> v(s, s), shifted(s, s);
+    Vector<Complex> x(s);
+    DenseLU<Complex> lu;
+    for (size_t i = 0; i < s; i++)
+      {
+        if (lambda[i].imag() < 0) continue;   // conjugate of its partner
+        for (size_t k = 0; k < s; k++)
+          for (size_t j = 0; j < s; j++)
+            shifted(k,j) = a(k,j) - (k == j ? lambda[i] + 1e-10*(1+std::abs(lambda[i])) : Complex(0));
+        lu.factor(shifted);
+        // start vectors differ per column, so a repeated eigenvalue with
+        // several eigenvectors gets independent ones
+        for (size_t k = 0; k < s; k++)
+          x(k) = 1.0 + 0.1*k + (k == i ? 1.0 : 0.0);
+        for (int it = 0; it < 3; it++)
+          {
+            lu.solve(x, x);
+            // normalize, the largest component real and positive
+            size_t kmax = 0;
+            for (size_t k = 1; k < s; k++)
+              if (std::abs(x(k)) > std::abs(x(kmax))) kmax = k;
+            Complex fac = std::abs(x(kmax)) / x(kmax);
+            double nrm = 0;
+            for (size_t k = 0; k < s; k++)
+              nrm += std::norm(x(k));
+            for (size_t k = 0; k < s; k++)
+              x(k) *= fac / std::sqrt(nrm);
+          }
+        for (size_t k = 0; k < s; k++)
+          v(k,i) = lambda[i].imag() == 0 ? Complex(x(k).real()) : x(k);
+        if (lambda[i].imag() > 0)
+          for (size_t j = 0; j < s; j++)
+            if (paired[j] && lambda[j] == std::conj(lambda[i]))
+              for (size_t k = 0; k < s; k++)
+                v(k,j) = std::conj(v(k,i));
+      }
+
+    // A defective matrix still gives small residuals |a v_i - lambda_i v_i|,
+    // but (nearly) parallel eigenvectors: check both, the columns have norm 1
+    double res = 0;
+    for (size_t i = 0; i < s; i++)
+      for (size_t k = 0; k < s; k++)
+        {
+          Complex sum = -lambda[i] * v(k,i);
+          for (size_t j = 0; j < s; j++)
+            sum += a(k,j) * v(j,i);
+          res = std::max(res, std::abs(sum));
+        }
+    if (res > 1e-8 * (scale > 0 ? scale : 1))
+      throw std::domain_error("EigenDecomposition: eigenvectors inaccurate, |a v - lambda v| > 1e-8 |a|");
+
+    // condition number of V in the 1-norm, from its inverse
+    double cond = std::numeric_limits<double>::infinity();
+    try
+      {
+        lu.factor(v);
+        double norm1 = 0, norm1inv = 0;
+        for (size_t j = 0; j < s; j++)
+          {
+            for (size_t k = 0; k < s; k++)
+              x(k) = (k == j) ? 1.0 : 0.0;
+            lu.solve(x, x);
+            double col = 0, colinv = 0;
+            for (size_t k = 0; k < s; k++)
+              {
+                col += std::abs(v(k,j));
+                colinv += std::abs(x(k));
+              }
+            norm1 = std::max(norm1, col);
+            norm1inv = std::max(norm1inv, colinv);
+          }
+        cond = norm1 * norm1inv;
+      }
+    catch (std::domain_error &) { }
+    if (!(cond < 1e8))
+      throw std::domain_error("EigenDecomposition: matrix is not diagonalizable, cond(V) > 1e8");
+    return { lambda, v };
+  }
+
+
+  // Implicit Runge-Kutta method with the stage system solved in transformed
+  // coordinates, as in Radau IIA codes. Simplified Newton with J = f'(y_n)
+  // needs I - tau A (x) J, and with A = V diag(mu) V^{-1} this is
+  // (V (x) I) (I - tau diag(mu) (x) J) (V^{-1} (x) I): one n x n system
+  // I - tau mu_i J per real eigenvalue, one complex system per conjugate
+  // pair. For 5-stage Radau this replaces an LU of size 5n by one real and
+  // two complex LUs of size n.
+  //
+  // J and the factors are refreshed in every step, or only when tau changes
+  // if the Jacobian is constant. Large functions with a sparse Jacobian
+  // (see NewtonWorkspace) use SparseLU for the stage blocks.
+  class TransformedRungeKutta : public TimeStepper
+  {
+    using Complex = std::complex<double>;
+
+    Matrix<> m_a;
+    Vector<> m_b, m_c;
+    size_t m_stages, m_n;
+    std::vector<Complex> m_mu;            // eigenvalues of A
+    Matrix<Complex> m_v, m_vinv;          // eigenvectors and their inverse
+    std::vector<size_t> m_real, m_pairs;  // eigenvalues with a system of their own
+    JacobianTraits m_traits;
+    bool m_sparse = false;
+    double m_factoredTau = 0;
+    double m_tol = 1e-10;
+    int m_maxsteps = 20;
+    NewtonStatistics m_stats;   // one solve per step, factorizations count the calls of factor
+
+    // Jacobian, the blocks I - tau mu_i J and their factors; only one kind is allocated
+    std::unique_ptr<Matrix<double>> m_jac, m_block;
+    std::unique_ptr<Matrix<Complex>> m_cblock;
+    std::vector<DenseLU<double>> m_lu;
+    std::vector<DenseLU<Complex>> m_clu;
+    std::unique_ptr<SparseMatrix<double>> m_spjac, m_spblock;
+    std::unique_ptr<SparseMatrix<Complex>> m_cspblock;
+    std::vector<SparseLU<double>> m_splu;
+    std::vector<SparseLU<Complex>> m_csplu;
+
+    Vector<> m_k, m_g, m_dk, m_ystage, m_w;
+    Vector<Complex> m_cw;
+    StagePredictor m_predictor;
+
+    void factor (double tau, VectorView<double> y)
+    {
+      size_t n = m_n;
+      if (m_sparse)
+        {
+          auto & jac = *m_spjac;
+          auto & block = *m_spblock;
+          auto & cblock = *m_cspblock;
+          {
+            PhaseTimer timer(m_stats.jacobianTime);
+            jac = 0.0;
+            m_rhs->addJacobian(y, jac, 1.0, 0, 0);
+          }
+          PhaseTimer timer(m_stats.factorTime);
+          for (size_t r = 0; r < m_real.size(); r++)
+            {
+              double fac = -tau * m_mu[m_real[r]].real();
+              for (size_t i = 0; i < n; i++)
+                for (size_t k = jac.rowBegin(i); k < jac.rowEnd(i); k++)
+                  block.value(k) = (jac.colIndex(k) == i ? 1.0 : 0.0) + fac * jac.value(k);
+              m_splu[r].refactor(block);
+            }
+          for (size_t p = 0; p < m_pairs.size(); p++)
+            {
+              Complex fac = -tau * m_mu[m_pairs[p]];
+              for (size_t i = 0; i < n; i++)
+                for (size_t k = jac.rowBegin(i); k < jac.rowEnd(i); k++)
+                  cblock.value(k) = (jac.colIndex(k) == i ? 1.0 : 0.0) + fac * jac.value(k);
+              m_csplu[p].refactor(cblock);
+            }
+        }
+      else
+        {
+          auto & jac = *m_jac;
+          {
+            PhaseTimer timer(m_stats.jacobianTime);
+            m_rhs->evaluateDeriv(y, jac);
+          }
+          PhaseTimer timer(m_stats.factorTime);
+          for (size_t r = 0; r < m_real.size(); r++)
+            {
+              double fac = -tau * m_mu[m_real[r]].real();
+              for (size_t i = 0; i < n; i++)
+                for (size_t j = 0; j < n; j++)
+                  (*m_block)(i,j) = (i == j ? 1.0 : 0.0) + fac * jac(i,j);
+              m_lu[r].factor(*m_block);
+            }
+          for (size_t p = 0; p < m_pairs.size(); p++)
+            {
+              Complex fac = -tau * m_mu[m_pairs[p]];
+              for (size_t i = 0; i < n; i++)
+                for (size_t j = 0; j < n; j++)
+                  (*m_cblock)(i,j) = (i == j ? 1.0 : 0.0) + fac * jac(i,j);
+              m_clu[p].factor(*m_cblock);
+            }
+        }
+      m_factoredTau = tau;
+      m_stats.jacobianEvaluations++;
+      m_stats.factorizations++;
+    }
+
+  public:
+    TransformedRungeKutta (std::shared_ptr<NonlinearFunction> rhs,
+                           const Matrix<> & a, const Vector<> & b, const Vector<> & c)
+      : TimeStepper(rhs), m_a(a), m_b(b), m_c(c),
+        m_stages(c.size()), m_n(rhs->dimX()), m_v(m_stages, m_stages), m_vinv(m_stages, m_stages),
+        m_traits(rhs->jacobianTraits()),
+        m_k(m_stages*m_n), m_g(m_stages*m_n), m_dk(m_stages*m_n), m_ystage(m_n), m_w(m_n), m_cw(m_n),
+        m_predictor(c, rhs->dimX())
+    {
+      // Parameters inside rhs are not watched: its Jacobian may change between steps
+      std::vector<std::shared_ptr<Parameter>> params;
+      rhs->addJacobianParameters(params);
+      if (!params.empty())
+        m_traits.constant = false;
+
+      try
+        {
+          auto [mu, v] = EigenDecomposition(a);
+          m_mu = mu;
+          m_v = v;
+        }
+      catch (std::domain_error & e)
+        {
+          throw std::domain_error(std::string("TransformedRungeKutta: Butcher matrix: ") + e.what());
+        }
+      DenseLU<Complex> vlu;
+      vlu.factor(m_v);
+      Vector<Complex> e(m_stages);
+      for (size_t j = 0; j < m_stages; j++)
+        {
+          for (size_t i = 0; i < m_stages; i++)
+            e(i) = (i == j) ? 1.0 : 0.0;
+          vlu.solve(e, e);
+          for (size_t i = 0; i < m_stages; i++)
+            m_vinv(i,j) = e(i);
+        }
+      for (size_t i = 0; i < m_stages; i++)
+        {
+          if (m_mu[i].imag() == 0) m_real.push_back(i);
+          else if (m_mu[i].imag() > 0) m_pairs.push_back(i);
+        }
+
+      // same choice as LinearSolver::Auto of NewtonWorkspace,
+      // the pattern is only built for large systems
+      size_t n = m_n;
+      if (n >= NewtonWorkspace::SparseMinDim)
+        {
+          SparsityPattern pattern(n, n);
+          rhs->addJacobianPattern(pattern);
+          pattern.addDiag(0, 0, n);   // the blocks have a full diagonal
+          m_spjac = std::make_unique<SparseMatrix<double>>(pattern);
+          m_sparse = m_spjac->nze() <= NewtonWorkspace::SparseMaxFill * n * n;
+          if (m_sparse)
+            {
+              m_spblock = std::make_unique<SparseMatrix<double>>(pattern);
+              m_cspblock = std::make_unique<SparseMatrix<Complex>>(pattern);
+              m_splu.resize(m_real.size());
+              m_csplu.resize(m_pairs.size());
+            }
+          else
+            m_spjac.reset();
+        }
+      if (!m_sparse)
+        {
+          m_jac = std::make_unique<Matrix<double>>(n, n);
+          m_block = std::make_unique<Matrix<double>>(n, n);
+          m_cblock = std::make_unique<Matrix<Complex>>(n, n);
+          m_lu.resize(m_real.size());
+          m_clu.resize(m_pairs.size());
+        }
+    }
+
+    const std::vector<Complex> & eigenvalues() const { return m_mu; }
+    size_t factorizations() const { return m_stats.factorizations; }
+    NewtonStatistics statistics() const override { return m_stats; }
+    void setPredictor (Predictor predictor) { m_predictor.set(predictor); }
+    bool sparse() const { return m_sparse; }
+    // Newton stops at |G(k)| < tol, and throws after maxsteps iterations
+    void setTolerance (double tol, int maxsteps = 20) { m_tol = tol; m_maxsteps = maxsteps; }
+
+    void DoStep (double tau, VectorView<double> y) override
+    {
+      size_t n = m_n, s = m_stages;
+      m_stats.solves++;
+      PhaseTimer timer(m_stats.totalTime);
+      if (!m_traits.constant || tau != m_factoredTau || m_stats.factorizations == 0)
+        factor(tau, y);
+
+      m_predictor.predict(tau, m_k);
+      for (int it = 0; ; it++)
+        {
+          // G_j = k_j - f(y + tau sum_l a_jl k_l)
+          {
+            PhaseTimer timer(m_stats.residualTime);
+            for (size_t j = 0; j < s; j++)
+              {
+                m_ystage = y;
+                for (size_t l = 0; l < s; l++)
+                  if (m_a(j,l) != 0.0)
+                    m_ystage += tau * m_a(j,l) * m_k.range(l*n, (l+1)*n);
+                auto g_j = m_g.range(j*n, (j+1)*n);
+                m_rhs->evaluate(m_ystage, g_j);
+                g_j = m_k.range(j*n, (j+1)*n) - g_j;
+              }
+          }
+          m_stats.residualEvaluations++;
+          if (norm(m_g) < m_tol) break;
+          if (it == m_maxsteps)
+            {
+              m_stats.failures++;
+              throw std::domain_error("TransformedRungeKutta: Newton did not converge");
+            }
+
+          // dk = (V (x) I) (I - tau diag(mu) (x) J)^{-1} (V^{-1} (x) I) G
+          PhaseTimer soltimer(m_stats.linearSolveTime);
+          m_dk = 0.0;
+          for (size_t r = 0; r < m_real.size(); r++)
+            {
+              size_t i = m_real[r];
+              m_w = 0.0;
+              for (size_t j = 0; j < s; j++)
+                m_w += m_vinv(i,j).real() * m_g.range(j*n, (j+1)*n);
+              if (m_sparse) m_splu[r].solve(m_w, m_w);
+              else m_lu[r].solve(m_w, m_w);
+              for (size_t j = 0; j < s; j++)
+                m_dk.range(j*n, (j+1)*n) += m_v(j,i).real() * m_w;
+            }
+          for (size_t p = 0; p < m_pairs.size(); p++)
+            {
+              // the conjugate eigenvalue contributes the conjugate, hence 2 Re
+              size_t i = m_pairs[p];
+              for (size_t q = 0; q < n; q++)
+                {
+                  Complex sum = 0;
+                  for (size_t j = 0; j < s; j++)
+                    sum += m_vinv(i,j) * m_g(j*n+q);
+                  m_cw(q) = sum;
+                }
+              if (m_sparse) m_csplu[p].solve(m_cw, m_cw);
+              else m_clu[p].solve(m_cw, m_cw);
+              for (size_t j = 0; j < s; j++)
+                for (size_t q = 0; q < n; q++)
+                  m_dk(j*n+q) += 2 * (m_v(j,i) * m_cw(q)).real();
+            }
+          m_k -= m_dk;
+          m_stats.iterations++;
+        }
+
+      m_predictor.update(tau, m_k);
+      for (size_t j = 0; j < s; j++)
+        y += tau * m_b(j) * m_k.range(j*n, (j+1)*n);
+    }
+  };
+
+
 /*
   explicit runge kutta methods
 */
 
   class ExplicitRungeKutta : public TimeStepper
   {
+  protected:
     Matrix<> m_a;
     Vector<> m_b, m_c;
     int m_stages;
@@ -75,7 +536,20 @@ namespace ASC_ode {
 
     void DoStep(double tau, VectorView<> y) override
     {
+      computeStages(tau, y);
+      // y_{n+1} = y_n + tau * sum_j b_j k_j
       for (int j = 0; j < m_stages; j++)
+      {
+        auto k_j = m_k.range(j * m_n, (j + 1) * m_n);
+        y += tau * m_b(j) * k_j;
+      }
+    }
+
+  protected:
+    // the stages k_j, j >= first, from y; the ones before are given
+    void computeStages(double tau, VectorView<> y, int first = 0)
+    {
+      for (int j = first; j < m_stages; j++)
       {
         // ystage = y + tau * sum_{l=0}^{j-1} a_{j,l} * k_l
         m_ystage = y;
@@ -90,12 +564,6 @@ namespace ASC_ode {
         auto k_j = m_k.range(j * m_n, (j + 1) * m_n);
         m_rhs->evaluate(m_ystage, k_j);
       }
-      // y_{n+1} = y_n + tau * sum_j b_j k_j
-      for (int j = 0; j < m_stages; j++)
-      {
-        auto k_j = m_k.range(j * m_n, (j + 1) * m_n);
-        y += tau * m_b(j) * k_j;
-      }
     }
   };
 
@@ -0,0 +1,391 @@
+#ifndef KRYLOV_HPP
+#define KRYLOV_HPP
+
+#include <cstddef>
+#include <cmath>
+#include <memory>
+#include <vector>
+#include <functional>
+#include <stdexcept>
+
+#include <vector.hpp>
+#include "nonlinfunc.hpp"
+#include "sparsematrix.hpp"
+
+
+namespace ASC_ode
+{
+  using namespace nanoblas;
+
+  inline double InnerProduct (VectorView<double> a, VectorView<double> b)
+  {
+    double sum = 0;
+    for (size_t i = 0; i < a.size(); i++)
+      sum += a(i) * b(i);
+    return sum;
+  }
+
+  // y = A x, applied without forming A
+  using LinearOperator = std::function<void(VectorView<double> x, VectorView<double> y)>;
+
+
+  // Approximate inverse of the Jacobian for the Krylov solvers.
+  // setup() linearizes at x, apply() computes z = M^{-1} r.
+  class Preconditioner
+  {
+  public:
+    virtual ~Preconditioner() = default;
+    virtual void setup (const NonlinearFunction & func, VectorView<double> x) = 0;
+    virtual void apply (VectorView<double> r, VectorView<double> z) const = 0;
+  };
+
+
+  // Preconditioners built from the sparse Jacobian of the function, or of a
+  // cheaper approximation of it, e.g. with linearized springs. The
+  // approximation must have the same dimensions as the function.
+  class SparsePreconditioner : public Preconditioner
+  {
+    std::shared_ptr<NonlinearFunction> m_approx;
+    std::unique_ptr<SparseMatrix<double>> m_mat;
+  protected:
+    virtual void build (const SparseMatrix<double> & a) = 0;
+  public:
+    SparsePreconditioner (std::shared_ptr<NonlinearFunction> approx = nullptr)
+      : m_approx(approx) { }
+
+    void setup (const NonlinearFunction & func, VectorView<double> x) override
+    {
+      const NonlinearFunction & f = m_approx ? *m_approx : func;
+      if (!m_mat)
+        m_mat = std::make_unique<SparseMatrix<double>>(f.createSparseJacobian());
+      f.evaluateDerivSparse(x, *m_mat);
+      build(*m_mat);
+    }
+  };
+
+
+  // inverse of the diagonal
+  class JacobiPreconditioner : public SparsePreconditioner
+  {
+    std::vector<double> m_invdiag;
+  protected:
+    void build (const SparseMatrix<double> & a) override
+    {
+      m_invdiag.assign(a.rows(), 0.0);
+      for (size_t i = 0; i < a.rows(); i++)
+        {
+          double d = a(i,i);
+          if (d == 0)
+            throw std::domain_error("JacobiPreconditioner: zero on the diagonal");
+          m_invdiag[i] = 1/d;
+        }
+    }
+  public:
+    using SparsePreconditioner::SparsePreconditioner;
+
+    void apply (VectorView<double> r, VectorView<double> z) const override
+    {
+      for (size_t i = 0; i < m_invdiag.size(); i++)
+        z(i) = m_invdiag[i] * r(i);
+    }
+  };
+
+
+  // inverses of the diagonal blocks of size bs, e.g. bs = D for one block per mass
+  class BlockJacobiPreconditioner : public SparsePreconditioner
+  {
+    size_t m_bs;
+    std::vector<double> m_inv;   // inverted blocks, row-major, one after the other
+    std::vector<double> m_blk;   // block being eliminated
+  protected:
+    void build (const SparseMatrix<double> & a) override
+    {
+      size_t n = a.rows(), bs = m_bs;
+      if (n % bs != 0)
+        throw std::invalid_argument("BlockJacobiPreconditioner: size is not a multiple of the block size");
+      m_inv.assign(n*bs, 0.0);
+      m_blk.resize(bs*bs);
+      double * blk = m_blk.data();
+      for (size_t first = 0; first < n; first += bs)
+        {
+          double * inv = &m_inv[first*bs];
+          for (size_t i = 0; i < bs; i++)
+            {
+              for (size_t j = 0; j < bs; j++)
+                blk[i*bs+j] = a(first+i, first+j);
+              inv[i*bs+i] = 1;
+            }
+
+          // Gauss-Jordan with partial pivoting
+          for (size_t k = 0; k < bs; k++)
+            {
+              size_t piv = k;
+              for (size_t i = k+1; i < bs; i++)
+                if (std::abs(blk[i*bs+k]) > std::abs(blk[piv*bs+k]))
+                  piv = i;
+              if (blk[piv*bs+k] == 0)
+                throw std::domain_error("BlockJacobiPreconditioner: singular diagonal block");
+              for (size_t j = 0; j < bs; j++)
+                {
+                  std::swap(blk[k*bs+j], blk[piv*bs+j]);
+                  std::swap(inv[k*bs+j], inv[piv*bs+j]);
+                }
+              double d = 1/blk[k*bs+k];
+              for (size_t j = 0; j < bs; j++)
+                {
+                  blk[k*bs+j] *= d;
+                  inv[k*bs+j] *= d;
+                }
+              for (size_t i = 0; i < bs; i++)
+                if (i != k && blk[i*bs+k] != 0)
+                  {
+                    double l = blk[i*bs+k];
+                    for (size_t j = 0; j < bs; j++)
+                      {
+                        blk[i*bs+j] -= l * blk[k*bs+j];
+                        inv[i*bs+j] -= l * inv[k*bs+j];
+                      }
+                  }
+            }
+        }
+    }
+  public:
+    BlockJacobiPreconditioner (size_t bs, std::shared_ptr<NonlinearFunction> approx = nullptr)
+      : SparsePreconditioner(approx), m_bs(bs) { }
+
+    void apply (VectorView<double> r, VectorView<double> z) const override
+    {
+      size_t bs = m_bs;
+      for (size_t first = 0; first < z.size(); first += bs)
+        {
+          const double * inv = &m_inv[first*bs];
+          for (size_t i = 0; i < bs; i++)
+            {
+              double sum = 0;
+              for (size_t j = 0; j < bs; j++)
+                sum += inv[i*bs+j] * r(first+j);
+              z(first+i) = sum;
+            }
+        }
+    }
+  };
+
+
+  // incomplete LU without fill-in, ILU(0): L and U on the pattern of the matrix
+  class ILUPreconditioner : public SparsePreconditioner
+  {
+    std::vector<size_t> m_rowptr, m_colind, m_diag;
+    std::vector<double> m_val;
+    std::vector<size_t> m_pos;   // work: position of column j in the current row
+  protected:
+    void build (const SparseMatrix<double> & a) override
+    {
+      static constexpr size_t none = size_t(-1);
+      size_t n = a.rows();
+      m_rowptr = a.rowPointers();
+      m_colind = a.columnIndices();
+      m_val.resize(a.nze());
+      for (size_t k = 0; k < a.nze(); k++)
+        m_val[k] = a.value(k);
+      m_diag.assign(n, none);
+      m_pos.assign(n, none);
+
+      for (size_t i = 0; i < n; i++)
+        {
+          for (size_t k = m_rowptr[i]; k < m_rowptr[i+1]; k++)
+            {
+              m_pos[m_colind[k]] = k;
+              if (m_colind[k] == i) m_diag[i] = k;
+            }
+          if (m_diag[i] == none)
+            throw std::domain_error("ILUPreconditioner: diagonal not in pattern");
+
+          // columns are sorted, so the row is eliminated left to right
+          for (size_t k = m_rowptr[i]; k < m_diag[i]; k++)
+            {
+              size_t c = m_colind[k];
+              double l = m_val[k] /= m_val[m_diag[c]];
+              for (size_t ku = m_diag[c]+1; ku < m_rowptr[c+1]; ku++)
+                if (size_t p = m_pos[m_colind[ku]]; p != none)
+                  m_val[p] -= l * m_val[ku];
+            }
+          if (m_val[m_diag[i]] == 0)
+            throw std::domain_error("ILUPreconditioner: zero pivot");
+
+          for (size_t k = m_rowptr[i]; k < m_rowptr[i+1]; k++)
+            m_pos[m_colind[k]] = none;
+        }
+    }
+  public:
+    using SparsePreconditioner::SparsePreconditioner;
+
+    void apply (VectorView<double> r, VectorView<double> z) const override
+    {
+      size_t n = m_diag.size();
+      for (size_t i = 0; i < n; i++)
+        {
+          double sum = r(i);
+          for (size_t k = m_rowptr[i]; k < m_diag[i]; k++)
+            sum -= m_val[k] * z(m_colind[k]);
+          z(i) = sum;
+        }
+      for (size_t i = n; i-- > 0; )
+        {
+          double sum = z(i);
+          for (size_t k = m_diag[i]+1; k < m_rowptr[i+1]; k++)
+            sum -= m_val[k] * z(m_colind[k]);
+          z(i) = sum / m_val[m_diag[i]];
+        }
+    }
+  };
+
+
+  // Restarted GMRES(restart) with right preconditioning, so the residual it
+  // monitors is the true one. Solves A x = b from the initial x until
+  // |b - A x| <= rtol |b| or maxit iterations, returns the iterations done.
+  // The Krylov basis is kept between calls.
+  class GMRES
+  {
+    size_t m_restart;
+    std::vector<Vector<double>> m_v;   // orthonormal basis, then two work vectors
+    std::vector<double> m_h, m_cs, m_sn, m_g;
+
+    double & h (size_t i, size_t j) { return m_h[i*m_restart+j]; }
+
+  public:
+    GMRES (size_t restart = 30) : m_restart(restart) { }
+
+    size_t solve (const LinearOperator & a, const Preconditioner * precond,
+                  VectorView<double> b, VectorView<double> x, double rtol, size_t maxit)
+    {
+      size_t n = b.size(), m = m_restart;
+      if (m_v.size() != m+3 || m_v[0].size() != n)
+        {
+          m_v.assign(m+3, Vector<double>(n));
+          m_h.assign((m+1)*m, 0.0);
+          m_cs.assign(m, 0.0);
+          m_sn.assign(m, 0.0);
+          m_g.assign(m+1, 0.0);
+        }
+
+      auto & w = m_v[m+1];
+      auto & z = m_v[m+2];
+      double target = rtol * norm(b);
+      size_t it = 0;
+      while (true)
+        {
+          a(x, w);
+          m_v[0] = b - w;
+          double beta = norm(m_v[0]);
+          if (beta <= target || it >= maxit) return it;
+          m_v[0] *= 1/beta;
+          std::fill(m_g.begin(), m_g.end(), 0.0);
+          m_g[0] = beta;
+
+          size_t k = 0;
+          for ( ; k < m && it < maxit; k++, it++)
+            {
+              // w = A M^{-1} v_k, orthogonalized by modified Gram-Schmidt
+              if (precond)
+                {
+                  precond->apply(m_v[k], z);
+                  a(z, w);
+                }
+              else
+                a(m_v[k], w);
+              for (size_t i = 0; i <= k; i++)
+                {
+                  h(i,k) = InnerProduct(w, m_v[i]);
+                  w -= h(i,k) * m_v[i];
+                }
+              h(k+1,k) = norm(w);
+              if (h(k+1,k) > 0)
+                m_v[k+1] = (1/h(k+1,k)) * w;
+
+              // Givens rotations keep the Hessenberg matrix triangular
+              for (size_t i = 0; i < k; i++)
+                {
+                  double t = m_cs[i]*h(i,k) + m_sn[i]*h(i+1,k);
+                  h(i+1,k) = -m_sn[i]*h(i,k) + m_cs[i]*h(i+1,k);
+                  h(i,k) = t;
+                }
+              double r = std::hypot(h(k,k), h(k+1,k));
+              m_cs[k] = h(k,k) / r;
+              m_sn[k] = h(k+1,k) / r;
+              h(k,k) = r;
+              h(k+1,k) = 0;
+              m_g[k+1] = -m_sn[k] * m_g[k];
+              m_g[k] *= m_cs[k];
+
+              if (std::abs(m_g[k+1]) <= target)
+                {
+                  k++; it++;
+                  break;
+                }
+            }
+
+          // x += M^{-1} V y,  with H y = g
+          for (size_t i = k; i-- > 0; )
+            {
+              for (size_t j = i+1; j < k; j++)
+                m_g[i] -= h(i,j) * m_g[j];
+              m_g[i] /= h(i,i);
+            }
+          w = 0.0;
+          for (size_t i = 0; i < k; i++)
+            w += m_g[i] * m_v[i];
+          if (precond)
+            {
+              precond->apply(w, z);
+              x += z;
+            }
+          else
+            x += w;
+        }
+    }
+  };
+
+
+  // Preconditioned conjugate gradients for symmetric positive definite A
+  // and M, same conventions as GMRES.
+  class ConjugateGradient
+  {
+    std::vector<Vector<double>> m_vecs;   // r, z, p, q
+  public:
+    size_t solve (const LinearOperator & a, const Preconditioner * precond,
+                  VectorView<double> b, VectorView<double> x, double rtol, size_t maxit)
+    {
+      size_t n = b.size();
+      if (m_vecs.empty() || m_vecs[0].size() != n)
+        m_vecs.assign(4, Vector<double>(n));
+      auto & r = m_vecs[0];
+      auto & z = m_vecs[1];
+      auto & p = m_vecs[2];
+      auto & q = m_vecs[3];
+
+      double target = rtol * norm(b);
+      a(x, q);
+      r = b - q;
+      if (precond) precond->apply(r, z); else z = r;
+      p = z;
+      double rz = InnerProduct(r, z);
+
+      size_t it = 0;
+      for ( ; it < maxit && norm(r) > target; it++)
+        {
+          a(p, q);
+          double alpha = rz / InnerProduct(p, q);
+          x += alpha * p;
+          r -= alpha * q;
+          if (precond) precond->apply(r, z); else z = r;
+          double rznew = InnerProduct(r, z);
+          p = z + (rznew/rz) * p;
+          rz = rznew;
+        }
+      return it;
+    }
+  };
+
+}
+
+#endif
@@ -3,7 +3,12 @@
 
 #include <cstddef>
 #include <memory>
+#include <array>
+#include <vector>
+#include <algorithm>
+#include <numeric>
 #include <autodiff.hpp>
+#include <sparsematrix.hpp>
 
 #include <vector.hpp>
 #include <matrix.hpp>
@@ -13,14 +18,192 @@ namespace ASC_ode
 {
   using namespace nanoblas;
 
+  // scratch matrix of size h x w, reallocated only when the size changes
+  inline MatrixView<double> BatchScratch (std::unique_ptr<Matrix<double>> & mat, size_t h, size_t w)
+  {
+    if (!mat || mat->rows() != h || mat->cols() != w)
+      mat = std::make_unique<Matrix<double>>(h, w);
+    return *mat;
+  }
+
+  // scratch vector of size n, reallocated only when the size changes
+  template <typename T>
+  inline VectorView<T> VectorScratch (std::unique_ptr<Vector<T>> & vec, size_t n)
+  {
+    if (!vec || vec->size() != n)
+      vec = std::make_unique<Vector<T>>(n);
+    return *vec;
+  }
+
+  // adds the batched Jacobian 'sub' of a function with dimensions subf x subx
+  // to the batched Jacobian 'df' (row i*dimx+j) at offset (firstf, firstx)
+  inline void AddBatchJacobian (MatrixView<double> sub, size_t subf, size_t subx,
+                                MatrixView<double> df, size_t dimx, size_t firstf, size_t firstx)
+  {
+    for (size_t i = 0; i < subf; i++)
+      for (size_t j = 0; j < subx; j++)
+      {
+        size_t row = (firstf+i)*dimx + firstx+j;
+        for (size_t m = 0; m < df.cols(); m++)
+          df(row, m) += sub(i*subx+j, m);
+      }
+  }
+
+
+  // Structure of the Jacobian that holds for every x, so solvers can skip work.
+  // Nodes combine the traits of their operands.
+  struct JacobianTraits
+  {
+    bool constant = false;   // df/dx does not depend on x (Parameters may still change it)
+    bool linear = false;     // f(x) = A x, implies constant
+    bool diagonal = false;   // df/dx is diagonal
+    size_t blocksize = 0;    // square diagonal blocks of this size tile df/dx, 0 if unknown
+    bool symmetric = false;  // df/dx is symmetric, e.g. the Hessian of an energy
+  };
+
+  inline size_t CommonBlocksize (size_t a, size_t b)
+  {
+    return (a && b) ? std::lcm(a, b) : 0;
+  }
+
+  // traits of fa + fb, and of fa(fb): Jacobians of sums add, those of
+  // compositions multiply, and both keep exactly the properties shared by a and b.
+  // Only a product of diagonal matrices is sure to stay symmetric.
+  inline JacobianTraits CombineTraits (const JacobianTraits & a, const JacobianTraits & b,
+                                       bool product = false)
+  {
+    bool diagonal = a.diagonal && b.diagonal;
+    return { a.constant && b.constant, a.linear && b.linear,
+             diagonal, CommonBlocksize(a.blocksize, b.blocksize),
+             product ? diagonal : a.symmetric && b.symmetric };
+  }
+
+
+  class Parameter;
+
+  // Nodes needing temporaries own mutable scratch buffers, allocated once,
+  // so evaluate/evaluateDeriv do not allocate. A function graph must therefore
+  // not be evaluated from several threads at once.
   class NonlinearFunction
   {
+    // dense Jacobian of the default sparse derivative
+    mutable std::unique_ptr<Matrix<double>> m_densejac;
+    // x + eps v and f(x) of the default directional derivative
+    mutable std::unique_ptr<Vector<double>> m_xpert, m_fx;
+    // one state of the default batch loops
+    mutable std::unique_ptr<Vector<double>> m_xstate, m_fstate;
+    mutable std::unique_ptr<Matrix<double>> m_dfstate;
   public:
     virtual ~NonlinearFunction() = default;
     virtual size_t dimX() const = 0;
     virtual size_t dimF() const = 0;
     virtual void evaluate (VectorView<double> x, VectorView<double> f) const = 0;
     virtual void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const = 0;
+
+    // f and df at the same x. Nodes override it to share the work of
+    // both, e.g. the value part of an AutoDiff pass.
+    virtual void evaluateWithDeriv (VectorView<double> x, VectorView<double> f,
+                                    MatrixView<double> df) const
+    {
+      evaluate(x, f);
+      evaluateDeriv(x, df);
+    }
+
+    // Batched evaluation of M states in structure-of-arrays layout:
+    // column m of x (dimX x M) is one state, column m of f (dimF x M) its value,
+    // so every row runs contiguously over the states.
+    // The default loops over the states.
+    virtual void evaluateBatch (MatrixView<double> x, MatrixView<double> f) const
+    {
+      auto xm = VectorScratch(m_xstate, dimX());
+      auto fm = VectorScratch(m_fstate, dimF());
+      for (size_t m = 0; m < x.cols(); m++)
+      {
+        for (size_t i = 0; i < dimX(); i++) xm(i) = x(i,m);
+        evaluate(xm, fm);
+        for (size_t i = 0; i < dimF(); i++) f(i,m) = fm(i);
+      }
+    }
+
+    // Batched Jacobians: row i*dimX+j of df ((dimF*dimX) x M) holds df_i/dx_j of all states.
+    virtual void evaluateDerivBatch (MatrixView<double> x, MatrixView<double> df) const
+    {
+      auto xm = VectorScratch(m_xstate, dimX());
+      auto dfm = BatchScratch(m_dfstate, dimF(), dimX());
+      for (size_t m = 0; m < x.cols(); m++)
+      {
+        for (size_t i = 0; i < dimX(); i++) xm(i) = x(i,m);
+        evaluateDeriv(xm, dfm);
+        for (size_t i = 0; i < dimF(); i++)
+          for (size_t j = 0; j < dimX(); j++)
+            df(i*dimX()+j, m) = dfm(i,j);
+      }
+    }
+
+    // Directional derivative dfv = df/dx(x) * v, without forming the Jacobian.
+    // The default is the forward difference (f(x + eps v) - f(x)) / eps, two
+    // evaluations, accurate to about sqrt of machine epsilon; functions with
+    // an exact product override it.
+    virtual void evaluateDirectionalDeriv (VectorView<double> x, VectorView<double> v,
+                                           VectorView<double> dfv) const
+    {
+      double nv = norm(v);
+      if (nv == 0)
+      {
+        dfv = 0.0;
+        return;
+      }
+      double eps = 1.5e-8 * (1 + norm(x)) / nv;
+      auto xpert = VectorScratch(m_xpert, dimX());
+      auto fx = VectorScratch(m_fx, dimF());
+      xpert = x + eps * v;
+      evaluate(xpert, dfv);
+      evaluate(x, fx);
+      dfv -= fx;
+      dfv *= 1/eps;
+    }
+
+    // Sparse Jacobian: nonzero pattern of df/dx, placed at (firstf, firstx).
+    // The default is a dense block.
+    virtual void addJacobianPattern (SparsityPattern & pattern,
+                                     size_t firstf = 0, size_t firstx = 0) const
+    {
+      pattern.addBlock(firstf, firstx, dimF(), dimX());
+    }
+
+    // df(firstf+i, firstx+j) += fac * df_i/dx_j, df must contain the pattern.
+    // The default goes through the dense evaluateDeriv.
+    virtual void addJacobian (VectorView<double> x, SparseMatrix<double> & df, double fac = 1,
+                              size_t firstf = 0, size_t firstx = 0) const
+    {
+      auto dense = BatchScratch(m_densejac, dimF(), dimX());
+      evaluateDeriv(x, dense);
+      for (size_t i = 0; i < dimF(); i++)
+        for (size_t j = 0; j < dimX(); j++)
+          df.add(firstf+i, firstx+j, fac*dense(i,j));
+    }
+
+    // sparse matrix with the pattern of the Jacobian
+    SparseMatrix<double> createSparseJacobian () const
+    {
+      SparsityPattern pattern(dimF(), dimX());
+      addJacobianPattern(pattern);
+      return SparseMatrix<double>(std::move(pattern));
+    }
+
+    void evaluateDerivSparse (VectorView<double> x, SparseMatrix<double> & df) const
+    {
+      df = 0.0;
+      addJacobian(x, df);
+    }
+
+    // Structure of df/dx valid for all x. The default promises nothing.
+    virtual JacobianTraits jacobianTraits () const { return { }; }
+
+    // Non-constant Parameters df/dx depends on. A constant Jacobian
+    // (JacobianTraits::constant) only stays valid while they do not change,
+    // so NewtonWorkspace reuses it only if all of them are watched.
+    virtual void addJacobianParameters (std::vector<std::shared_ptr<Parameter>> & params) const { }
   };
 
 
@@ -41,6 +224,45 @@ namespace ASC_ode
       df = 0.0;
       df.diag() = 1.0;
     }
+
+    void evaluateWithDeriv (VectorView<double> x, VectorView<double> f,
+                            MatrixView<double> df) const override
+    {
+      f = x;
+      df = 0.0;
+      df.diag() = 1.0;
+    }
+
+    void evaluateBatch (MatrixView<double> x, MatrixView<double> f) const override
+    {
+      f = x;
+    }
+    void evaluateDerivBatch (MatrixView<double> x, MatrixView<double> df) const override
+    {
+      df = 0.0;
+      for (size_t i = 0; i < m_n; i++)
+        for (size_t m = 0; m < df.cols(); m++)
+          df(i*m_n+i, m) = 1.0;
+    }
+
+    void evaluateDirectionalDeriv (VectorView<double> x, VectorView<double> v,
+                                   VectorView<double> dfv) const override
+    {
+      dfv = v;
+    }
+
+    void addJacobianPattern (SparsityPattern & pattern, size_t firstf, size_t firstx) const override
+    {
+      pattern.addDiag(firstf, firstx, m_n);
+    }
+    void addJacobian (VectorView<double> x, SparseMatrix<double> & df, double fac,
+                      size_t firstf, size_t firstx) const override
+    {
+      for (size_t i = 0; i < m_n; i++)
+        df.add(firstf+i, firstx+i, fac);
+    }
+
+    JacobianTraits jacobianTraits () const override { return { true, true, true, 1, true }; }
   };
 
 
@@ -63,6 +285,37 @@ namespace ASC_ode
     {
       df = 0.0;
     }
+
+    void evaluateWithDeriv (VectorView<double> x, VectorView<double> f,
+                            MatrixView<double> df) const override
+    {
+      f = m_val;
+      df = 0.0;
+    }
+
+    void evaluateBatch (MatrixView<double> x, MatrixView<double> f) const override
+    {
+      for (size_t i = 0; i < m_val.size(); i++)
+        for (size_t m = 0; m < f.cols(); m++)
+          f(i,m) = m_val(i);
+    }
+    void evaluateDerivBatch (MatrixView<double> x, MatrixView<double> df) const override
+    {
+      df = 0.0;
+    }
+
+    void evaluateDirectionalDeriv (VectorView<double> x, VectorView<double> v,
+                                   VectorView<double> dfv) const override
+    {
+      dfv = 0.0;
+    }
+
+    void addJacobianPattern (SparsityPattern & pattern, size_t firstf, size_t firstx) const override { }
+    void addJacobian (VectorView<double> x, SparseMatrix<double> & df, double fac,
+                      size_t firstf, size_t firstx) const override { }
+
+    // zero Jacobian
+    JacobianTraits jacobianTraits () const override { return { true, false, true, 1, true }; }
   };
 
   
@@ -71,11 +324,22 @@ namespace ASC_ode
   {
     std::shared_ptr<NonlinearFunction> m_fa, m_fb;
     double m_faca, m_facb;
+    // scratch for the value and the dense Jacobian of fb,
+    // the matrix is allocated on the first dense evaluateDeriv
+    mutable Vector<> m_tmpf;
+    mutable std::unique_ptr<Matrix<double>> m_tmpdf;
+    mutable std::unique_ptr<Matrix<double>> m_batchf, m_batchdf;
   public:
     SumFunction (std::shared_ptr<NonlinearFunction> fa,
                  std::shared_ptr<NonlinearFunction> fb,
                  double faca, double facb)
-      : m_fa(fa), m_fb(fb), m_faca(faca), m_facb(facb) { }
+      : m_fa(fa), m_fb(fb), m_faca(faca), m_facb(facb),
+        m_tmpf(fa->dimF()) { }
+
+    auto fa() const { return m_fa; }
+    auto fb() const { return m_fb; }
+    double faca() const { return m_faca; }
+    double facb() const { return m_facb; }
 
     size_t dimX() const override { return m_fa->dimX(); }
     size_t dimF() const override { return m_fa->dimF(); }
@@ -83,18 +347,81 @@ namespace ASC_ode
     {
       m_fa->evaluate(x, f);
       f *= m_faca;
-      Vector<> tmp(dimF());
-      m_fb->evaluate(x, tmp);
-      f += m_facb*tmp;
+      m_fb->evaluate(x, m_tmpf);
+      f += m_facb*m_tmpf;
     }
     void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const override
     {
+      if (!m_tmpdf)
+        m_tmpdf = std::make_unique<Matrix<double>>(dimF(), dimX());
       m_fa->evaluateDeriv(x, df);
       df *= m_faca;
-      Matrix<double> tmp(dimF(), dimX());
-      m_fb->evaluateDeriv(x, tmp);
+      m_fb->evaluateDeriv(x, *m_tmpdf);
+      *m_tmpdf *= m_facb;   // in place, no temporary matrix
+      df += *m_tmpdf;
+    }
+
+    void evaluateWithDeriv (VectorView<double> x, VectorView<double> f,
+                            MatrixView<double> df) const override
+    {
+      if (!m_tmpdf)
+        m_tmpdf = std::make_unique<Matrix<double>>(dimF(), dimX());
+      m_fa->evaluateWithDeriv(x, f, df);
+      f *= m_faca;
+      df *= m_faca;
+      m_fb->evaluateWithDeriv(x, m_tmpf, *m_tmpdf);
+      f += m_facb*m_tmpf;
+      *m_tmpdf *= m_facb;
+      df += *m_tmpdf;
+    }
+
+    void evaluateBatch (MatrixView<double> x, MatrixView<double> f) const override
+    {
+      auto tmp = BatchScratch(m_batchf, dimF(), x.cols());
+      m_fa->evaluateBatch(x, f);
+      f *= m_faca;
+      m_fb->evaluateBatch(x, tmp);
+      f += m_facb*tmp;
+    }
+    void evaluateDerivBatch (MatrixView<double> x, MatrixView<double> df) const override
+    {
+      auto tmp = BatchScratch(m_batchdf, dimF()*dimX(), x.cols());
+      m_fa->evaluateDerivBatch(x, df);
+      df *= m_faca;
+      m_fb->evaluateDerivBatch(x, tmp);
       df += m_facb*tmp;
     }
+
+    void evaluateDirectionalDeriv (VectorView<double> x, VectorView<double> v,
+                                   VectorView<double> dfv) const override
+    {
+      m_fa->evaluateDirectionalDeriv(x, v, dfv);
+      dfv *= m_faca;
+      m_fb->evaluateDirectionalDeriv(x, v, m_tmpf);
+      dfv += m_facb*m_tmpf;
+    }
+
+    void addJacobianPattern (SparsityPattern & pattern, size_t firstf, size_t firstx) const override
+    {
+      m_fa->addJacobianPattern(pattern, firstf, firstx);
+      m_fb->addJacobianPattern(pattern, firstf, firstx);
+    }
+    void addJacobian (VectorView<double> x, SparseMatrix<double> & df, double fac,
+                      size_t firstf, size_t firstx) const override
+    {
+      m_fa->addJacobian(x, df, fac*m_faca, firstf, firstx);
+      m_fb->addJacobian(x, df, fac*m_facb, firstf, firstx);
+    }
+
+    JacobianTraits jacobianTraits () const override
+    {
+      return CombineTraits(m_fa->jacobianTraits(), m_fb->jacobianTraits());
+    }
+    void addJacobianParameters (std::vector<std::shared_ptr<Parameter>> & params) const override
+    {
+      m_fa->addJacobianParameters(params);
+      m_fb->addJacobianParameters(params);
+    }
   };
 
 
@@ -108,13 +435,17 @@ namespace ASC_ode
     return std::make_shared<SumFunction>(fa, fb, 1, 1);
   }
 
+  // A constant parameter (a plain number in an expression) may be folded
+  // into coefficients by Simplify, so it must not be set afterwards.
   class Parameter 
   {
     double m_value;
+    bool m_constant;
   public:
-    Parameter(double value) : m_value(value) {}
+    Parameter(double value, bool constant = false) : m_value(value), m_constant(constant) {}
     double get() const { return m_value; }
     void set(double value) { m_value = value; }
+    bool isConstant() const { return m_constant; }
   };
 
   class ScaleFunction : public NonlinearFunction
@@ -126,6 +457,9 @@ namespace ASC_ode
                    std::shared_ptr<Parameter> fac)
       : m_fa(fa), m_fac(fac) { }
 
+    auto fa() const { return m_fa; }
+    auto parameter() const { return m_fac; }
+
     size_t dimX() const override { return m_fa->dimX(); }
     size_t dimF() const override { return m_fa->dimF(); }
     void evaluate (VectorView<double> x, VectorView<double> f) const override
@@ -139,6 +473,51 @@ namespace ASC_ode
       m_fa->evaluateDeriv(x, df);
       df *= m_fac->get();
     }
+
+    void evaluateWithDeriv (VectorView<double> x, VectorView<double> f,
+                            MatrixView<double> df) const override
+    {
+      m_fa->evaluateWithDeriv(x, f, df);
+      f *= m_fac->get();
+      df *= m_fac->get();
+    }
+
+    void evaluateBatch (MatrixView<double> x, MatrixView<double> f) const override
+    {
+      m_fa->evaluateBatch(x, f);
+      f *= m_fac->get();
+    }
+    void evaluateDerivBatch (MatrixView<double> x, MatrixView<double> df) const override
+    {
+      m_fa->evaluateDerivBatch(x, df);
+      df *= m_fac->get();
+    }
+
+    void evaluateDirectionalDeriv (VectorView<double> x, VectorView<double> v,
+                                   VectorView<double> dfv) const override
+    {
+      m_fa->evaluateDirectionalDeriv(x, v, dfv);
+      dfv *= m_fac->get();
+    }
+
+    void addJacobianPattern (SparsityPattern & pattern, size_t firstf, size_t firstx) const override
+    {
+      m_fa->addJacobianPattern(pattern, firstf, firstx);
+    }
+    void addJacobian (VectorView<double> x, SparseMatrix<double> & df, double fac,
+                      size_t firstf, size_t firstx) const override
+    {
+      m_fa->addJacobian(x, df, fac*m_fac->get(), firstf, firstx);
+    }
+
+    // constant Jacobians stay constant only while the factor does
+    JacobianTraits jacobianTraits () const override { return m_fa->jacobianTraits(); }
+    void addJacobianParameters (std::vector<std::shared_ptr<Parameter>> & params) const override
+    {
+      if (!m_fac->isConstant())
+        params.push_back(m_fac);
+      m_fa->addJacobianParameters(params);
+    }
   };
 
   inline auto operator* (std::shared_ptr<Parameter> parama, 
@@ -149,7 +528,7 @@ namespace ASC_ode
 
   inline auto operator* (double a, std::shared_ptr<NonlinearFunction> f)
   {
-    return std::make_shared<Parameter>(a) * f;
+    return std::make_shared<Parameter>(a, true) * f;
   } 
 
 
@@ -159,31 +538,120 @@ namespace ASC_ode
   class ComposeFunction : public NonlinearFunction
   {
     std::shared_ptr<NonlinearFunction> m_fa, m_fb;
+    // scratch for fb(x), Jb*v and both Jacobians, the dense or sparse
+    // matrices are allocated on the first call that needs them
+    mutable Vector<> m_tmp, m_tmpv;
+    mutable std::unique_ptr<Matrix<double>> m_jaca, m_jacb;
+    mutable std::unique_ptr<SparseMatrix<double>> m_spjaca, m_spjacb;
+    mutable std::unique_ptr<Matrix<double>> m_batchtmp, m_batchjaca, m_batchjacb;
+
+    void createSparseJacobians () const
+    {
+      if (m_spjaca) return;
+      m_spjaca = std::make_unique<SparseMatrix<double>>(m_fa->createSparseJacobian());
+      m_spjacb = std::make_unique<SparseMatrix<double>>(m_fb->createSparseJacobian());
+    }
   public:
     ComposeFunction (std::shared_ptr<NonlinearFunction> fa,
                      std::shared_ptr<NonlinearFunction> fb)
-      : m_fa(fa), m_fb(fb) { }
+      : m_fa(fa), m_fb(fb), m_tmp(fb->dimF()), m_tmpv(fb->dimF()) { }
+
+    auto fa() const { return m_fa; }
+    auto fb() const { return m_fb; }
 
     size_t dimX() const override { return m_fb->dimX(); }
     size_t dimF() const override { return m_fa->dimF(); }
     void evaluate (VectorView<double> x, VectorView<double> f) const override
     {
-      Vector<> tmp(m_fb->dimF());
-      m_fb->evaluate (x, tmp);
-      m_fa->evaluate (tmp, f);
+      m_fb->evaluate (x, m_tmp);
+      m_fa->evaluate (m_tmp, f);
     }
     void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const override
     {
-      Vector<> tmp(m_fb->dimF());
-      m_fb->evaluate (x, tmp);
+      if (!m_jaca)
+      {
+        m_jaca = std::make_unique<Matrix<double>>(m_fa->dimF(), m_fa->dimX());
+        m_jacb = std::make_unique<Matrix<double>>(m_fb->dimF(), m_fb->dimX());
+      }
+      m_fb->evaluateWithDeriv(x, m_tmp, *m_jacb);
+      m_fa->evaluateDeriv(m_tmp, *m_jaca);
 
-      Matrix<double> jaca(m_fa->dimF(), m_fa->dimX());
-      Matrix<double> jacb(m_fb->dimF(), m_fb->dimX());
+      df = *m_jaca * *m_jacb;
+    }
 
-      m_fb->evaluateDeriv(x, jacb);
-      m_fa->evaluateDeriv(tmp, jaca);
+    void evaluateWithDeriv (VectorView<double> x, VectorView<double> f,
+                            MatrixView<double> df) const override
+    {
+      if (!m_jaca)
+      {
+        m_jaca = std::make_unique<Matrix<double>>(m_fa->dimF(), m_fa->dimX());
+        m_jacb = std::make_unique<Matrix<double>>(m_fb->dimF(), m_fb->dimX());
+      }
+      m_fb->evaluateWithDeriv(x, m_tmp, *m_jacb);
+      m_fa->evaluateWithDeriv(m_tmp, f, *m_jaca);
+      df = *m_jaca * *m_jacb;
+    }
+
+    void evaluateBatch (MatrixView<double> x, MatrixView<double> f) const override
+    {
+      auto tmp = BatchScratch(m_batchtmp, m_fb->dimF(), x.cols());
+      m_fb->evaluateBatch(x, tmp);
+      m_fa->evaluateBatch(tmp, f);
+    }
+
+    // one small matrix product per state, innermost loop over the states
+    void evaluateDerivBatch (MatrixView<double> x, MatrixView<double> df) const override
+    {
+      size_t M = x.cols();
+      size_t nf = m_fa->dimF(), nk = m_fb->dimF(), nx = m_fb->dimX();
+      auto tmp = BatchScratch(m_batchtmp, nk, M);
+      auto jaca = BatchScratch(m_batchjaca, nf*nk, M);
+      auto jacb = BatchScratch(m_batchjacb, nk*nx, M);
+
+      m_fb->evaluateBatch(x, tmp);
+      m_fb->evaluateDerivBatch(x, jacb);
+      m_fa->evaluateDerivBatch(tmp, jaca);
+
+      df = 0.0;
+      for (size_t i = 0; i < nf; i++)
+        for (size_t k = 0; k < nk; k++)
+          for (size_t j = 0; j < nx; j++)
+            for (size_t m = 0; m < M; m++)
+              df(i*nx+j, m) += jaca(i*nk+k, m) * jacb(k*nx+j, m);
+    }
+
+    // chain rule on the vector: Ja(fb(x)) * (Jb(x) * v)
+    void evaluateDirectionalDeriv (VectorView<double> x, VectorView<double> v,
+                                   VectorView<double> dfv) const override
+    {
+      m_fb->evaluate (x, m_tmp);
+      m_fb->evaluateDirectionalDeriv(x, v, m_tmpv);
+      m_fa->evaluateDirectionalDeriv(m_tmp, m_tmpv, dfv);
+    }
+
+    void addJacobianPattern (SparsityPattern & pattern, size_t firstf, size_t firstx) const override
+    {
+      createSparseJacobians();
+      addProductPattern(*m_spjaca, *m_spjacb, pattern, firstf, firstx);
+    }
+    void addJacobian (VectorView<double> x, SparseMatrix<double> & df, double fac,
+                      size_t firstf, size_t firstx) const override
+    {
+      createSparseJacobians();
+      m_fb->evaluate (x, m_tmp);
+      m_fb->evaluateDerivSparse(x, *m_spjacb);
+      m_fa->evaluateDerivSparse(m_tmp, *m_spjaca);
+      addProduct(*m_spjaca, *m_spjacb, df, fac, firstf, firstx);
+    }
 
-      df = jaca*jacb;
+    JacobianTraits jacobianTraits () const override
+    {
+      return CombineTraits(m_fa->jacobianTraits(), m_fb->jacobianTraits(), true);
+    }
+    void addJacobianParameters (std::vector<std::shared_ptr<Parameter>> & params) const override
+    {
+      m_fa->addJacobianParameters(params);
+      m_fb->addJacobianParameters(params);
     }
   };
   
@@ -198,6 +666,7 @@ namespace ASC_ode
     std::shared_ptr<NonlinearFunction> m_fa;
     size_t m_firstx, m_dimx, m_firstf, m_dimf;
     size_t m_nextx, m_nextf;
+    mutable std::unique_ptr<Matrix<double>> m_batchdf;
   public:
     EmbedFunction (std::shared_ptr<NonlinearFunction> fa,
                    size_t firstx, size_t dimx,
@@ -220,6 +689,62 @@ namespace ASC_ode
       m_fa->evaluateDeriv(x.range(m_firstx, m_nextx),
                         df.rows(m_firstf, m_nextf).cols(m_firstx, m_nextx));
     }
+
+    void evaluateWithDeriv (VectorView<double> x, VectorView<double> f,
+                            MatrixView<double> df) const override
+    {
+      f = 0.0;
+      df = 0;
+      m_fa->evaluateWithDeriv(x.range(m_firstx, m_nextx), f.range(m_firstf, m_nextf),
+                              df.rows(m_firstf, m_nextf).cols(m_firstx, m_nextx));
+    }
+
+    void evaluateBatch (MatrixView<double> x, MatrixView<double> f) const override
+    {
+      f = 0.0;
+      m_fa->evaluateBatch(x.rows(m_firstx, m_nextx), f.rows(m_firstf, m_nextf));
+    }
+    void evaluateDerivBatch (MatrixView<double> x, MatrixView<double> df) const override
+    {
+      auto sub = BatchScratch(m_batchdf, m_fa->dimF()*m_fa->dimX(), x.cols());
+      m_fa->evaluateDerivBatch(x.rows(m_firstx, m_nextx), sub);
+      df = 0.0;
+      AddBatchJacobian(sub, m_fa->dimF(), m_fa->dimX(), df, m_dimx, m_firstf, m_firstx);
+    }
+
+    void evaluateDirectionalDeriv (VectorView<double> x, VectorView<double> v,
+                                   VectorView<double> dfv) const override
+    {
+      dfv = 0.0;
+      m_fa->evaluateDirectionalDeriv(x.range(m_firstx, m_nextx), v.range(m_firstx, m_nextx),
+                                     dfv.range(m_firstf, m_nextf));
+    }
+
+    void addJacobianPattern (SparsityPattern & pattern, size_t firstf, size_t firstx) const override
+    {
+      m_fa->addJacobianPattern(pattern, firstf+m_firstf, firstx+m_firstx);
+    }
+    void addJacobian (VectorView<double> x, SparseMatrix<double> & df, double fac,
+                      size_t firstf, size_t firstx) const override
+    {
+      m_fa->addJacobian(x.range(m_firstx, m_nextx), df, fac, firstf+m_firstf, firstx+m_firstx);
+    }
+
+    // fa's block only stays on the diagonal if it starts on it
+    JacobianTraits jacobianTraits () const override
+    {
+      JacobianTraits traits = m_fa->jacobianTraits();
+      traits.diagonal = traits.diagonal && m_firstx == m_firstf;
+      traits.symmetric = traits.symmetric && m_firstx == m_firstf && m_dimx == m_dimf;
+      size_t bs = traits.blocksize;
+      if (bs == 0 || m_firstx != m_firstf || m_dimx != m_dimf || m_firstx % bs != 0 || m_dimx % bs != 0)
+        traits.blocksize = 0;
+      return traits;
+    }
+    void addJacobianParameters (std::vector<std::shared_ptr<Parameter>> & params) const override
+    {
+      m_fa->addJacobianParameters(params);
+    }
   };
 
   
@@ -243,6 +768,45 @@ namespace ASC_ode
       df = 0.0;
       df.diag().range(m_first, m_next) = 1;
     }
+
+    void evaluateWithDeriv (VectorView<double> x, VectorView<double> f,
+                            MatrixView<double> df) const override
+    {
+      evaluate(x, f);
+      evaluateDeriv(x, df);
+    }
+
+    void evaluateBatch (MatrixView<double> x, MatrixView<double> f) const override
+    {
+      f = 0.0;
+      f.rows(m_first, m_next) = x.rows(m_first, m_next);
+    }
+    void evaluateDerivBatch (MatrixView<double> x, MatrixView<double> df) const override
+    {
+      df = 0.0;
+      for (size_t i = m_first; i < m_next; i++)
+        for (size_t m = 0; m < df.cols(); m++)
+          df(i*m_size+i, m) = 1.0;
+    }
+
+    void evaluateDirectionalDeriv (VectorView<double> x, VectorView<double> v,
+                                   VectorView<double> dfv) const override
+    {
+      evaluate(v, dfv);
+    }
+
+    void addJacobianPattern (SparsityPattern & pattern, size_t firstf, size_t firstx) const override
+    {
+      pattern.addDiag(firstf+m_first, firstx+m_first, m_next-m_first);
+    }
+    void addJacobian (VectorView<double> x, SparseMatrix<double> & df, double fac,
+                      size_t firstf, size_t firstx) const override
+    {
+      for (size_t i = m_first; i < m_next; i++)
+        df.add(firstf+i, firstx+i, fac);
+    }
+
+    JacobianTraits jacobianTraits () const override { return { true, true, true, 1, true }; }
   };
 
   
@@ -250,6 +814,7 @@ namespace ASC_ode
   {
     std::shared_ptr<NonlinearFunction> func;
     size_t num, fdimx, fdimf;
+    mutable std::unique_ptr<Matrix<double>> m_batchdf;
   public:
     MultipleFunc (std::shared_ptr<NonlinearFunction> _func, int _num)
       : func(_func), num(_num)
@@ -273,6 +838,71 @@ namespace ASC_ode
         func->evaluateDeriv(x.range(i*fdimx, (i+1)*fdimx),
                             df.rows(i*fdimf, (i+1)*fdimf).cols(i*fdimx, (i+1)*fdimx));
     }
+
+    void evaluateWithDeriv (VectorView<double> x, VectorView<double> f,
+                            MatrixView<double> df) const override
+    {
+      df = 0.0;
+      for (size_t i = 0; i < num; i++)
+        func->evaluateWithDeriv(x.range(i*fdimx, (i+1)*fdimx),
+                                f.range(i*fdimf, (i+1)*fdimf),
+                                df.rows(i*fdimf, (i+1)*fdimf).cols(i*fdimx, (i+1)*fdimx));
+    }
+
+    void evaluateBatch (MatrixView<double> x, MatrixView<double> f) const override
+    {
+      for (size_t i = 0; i < num; i++)
+        func->evaluateBatch(x.rows(i*fdimx, (i+1)*fdimx),
+                            f.rows(i*fdimf, (i+1)*fdimf));
+    }
+    void evaluateDerivBatch (MatrixView<double> x, MatrixView<double> df) const override
+    {
+      auto sub = BatchScratch(m_batchdf, fdimf*fdimx, x.cols());
+      df = 0.0;
+      for (size_t i = 0; i < num; i++)
+      {
+        func->evaluateDerivBatch(x.rows(i*fdimx, (i+1)*fdimx), sub);
+        AddBatchJacobian(sub, fdimf, fdimx, df, dimX(), i*fdimf, i*fdimx);
+      }
+    }
+
+    void evaluateDirectionalDeriv (VectorView<double> x, VectorView<double> v,
+                                   VectorView<double> dfv) const override
+    {
+      for (size_t i = 0; i < num; i++)
+        func->evaluateDirectionalDeriv(x.range(i*fdimx, (i+1)*fdimx),
+                                       v.range(i*fdimx, (i+1)*fdimx),
+                                       dfv.range(i*fdimf, (i+1)*fdimf));
+    }
+
+    void addJacobianPattern (SparsityPattern & pattern, size_t firstf, size_t firstx) const override
+    {
+      for (size_t i = 0; i < num; i++)
+        func->addJacobianPattern(pattern, firstf+i*fdimf, firstx+i*fdimx);
+    }
+    void addJacobian (VectorView<double> x, SparseMatrix<double> & df, double fac,
+                      size_t firstf, size_t firstx) const override
+    {
+      for (size_t i = 0; i < num; i++)
+        func->addJacobian(x.range(i*fdimx, (i+1)*fdimx), df, fac,
+                          firstf+i*fdimf, firstx+i*fdimx);
+    }
+
+    // one diagonal block per copy
+    JacobianTraits jacobianTraits () const override
+    {
+      JacobianTraits traits = func->jacobianTraits();
+      traits.symmetric = traits.symmetric && fdimx == fdimf;
+      if (fdimx != fdimf)
+        traits.blocksize = 0;
+      else if (traits.blocksize == 0)
+        traits.blocksize = fdimx;
+      return traits;
+    }
+    void addJacobianParameters (std::vector<std::shared_ptr<Parameter>> & params) const override
+    {
+      func->addJacobianParameters(params);
+    }
   };
 
 
@@ -299,6 +929,78 @@ namespace ASC_ode
         for (size_t j = 0; j < m_a.cols(); j++)
           df.rows(i*m_n, (i+1)*m_n).cols(j*m_n, (j+1)*m_n).diag() = m_a(i,j);
     }
+
+    void evaluateWithDeriv (VectorView<double> x, VectorView<double> f,
+                            MatrixView<double> df) const override
+    {
+      evaluate(x, f);
+      evaluateDeriv(x, df);
+    }
+
+    // f(i*n+k) = sum_j a(i,j) x(j*n+k) for all states at once
+    virtual void evaluateBatch (MatrixView<double> x, MatrixView<double> f) const override
+    {
+      f = 0.0;
+      for (size_t i = 0; i < m_a.rows(); i++)
+        for (size_t j = 0; j < m_a.cols(); j++)
+        {
+          double aij = m_a(i,j);
+          if (aij == 0.0) continue;
+          for (size_t k = 0; k < m_n; k++)
+            for (size_t m = 0; m < f.cols(); m++)
+              f(i*m_n+k, m) += aij * x(j*m_n+k, m);
+        }
+    }
+    virtual void evaluateDerivBatch (MatrixView<double> x, MatrixView<double> df) const override
+    {
+      df = 0.0;
+      size_t dimx = dimX();
+      for (size_t i = 0; i < m_a.rows(); i++)
+        for (size_t j = 0; j < m_a.cols(); j++)
+          for (size_t k = 0; k < m_n; k++)
+            for (size_t m = 0; m < df.cols(); m++)
+              df((i*m_n+k)*dimx + j*m_n+k, m) = m_a(i,j);
+    }
+
+    // the function is linear: (A kron I) v
+    virtual void evaluateDirectionalDeriv (VectorView<double> x, VectorView<double> v,
+                                           VectorView<double> dfv) const override
+    {
+      evaluate(v, dfv);
+    }
+
+    // one diagonal block per nonzero coefficient of A
+    void addJacobianPattern (SparsityPattern & pattern, size_t firstf, size_t firstx) const override
+    {
+      for (size_t i = 0; i < m_a.rows(); i++)
+        for (size_t j = 0; j < m_a.cols(); j++)
+          if (m_a(i,j) != 0.0)
+            pattern.addDiag(firstf+i*m_n, firstx+j*m_n, m_n);
+    }
+    void addJacobian (VectorView<double> x, SparseMatrix<double> & df, double fac,
+                      size_t firstf, size_t firstx) const override
+    {
+      for (size_t i = 0; i < m_a.rows(); i++)
+        for (size_t j = 0; j < m_a.cols(); j++)
+          if (m_a(i,j) != 0.0)
+            for (size_t k = 0; k < m_n; k++)
+              df.add(firstf+i*m_n+k, firstx+j*m_n+k, fac*m_a(i,j));
+    }
+
+    JacobianTraits jacobianTraits () const override
+    {
+      bool square = m_a.rows() == m_a.cols();
+      bool diagonal = true, symmetric = square;
+      for (size_t i = 0; i < m_a.rows(); i++)
+        for (size_t j = 0; j < m_a.cols(); j++)
+          {
+            if (i != j && m_a(i,j) != 0.0)
+              diagonal = false;
+            if (square && m_a(i,j) != m_a(j,i))
+              symmetric = false;
+          }
+      return { true, true, diagonal, diagonal && square ? size_t(1) : size_t(0), symmetric };
+    }
   };
 
   class PendulumAD : public NonlinearFunction
@@ -321,19 +1023,97 @@ namespace ASC_ode
     void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const override
     {
       const size_t N = 2;
-      Vector<AutoDiff<>> x_ad(N);
-      Vector<AutoDiff<>> f_ad(N);
+      // Dimension is known, so use fixed-size AutoDiff on the stack (no heap allocation)
+      std::array<FixedAutoDiff<N>, N> x_mem, f_mem;
+      VectorView<FixedAutoDiff<N>> x_ad(N, x_mem.data());
+      VectorView<FixedAutoDiff<N>> f_ad(N, f_mem.data());
 
-      // Use dynamic AutoDiff with runtime size
-      x_ad(0) = AutoDiff<>(x(0), 0, N);  // value, derivIndex, size
-      x_ad(1) = AutoDiff<>(x(1), 1, N);
-      T_evaluate<AutoDiff<>>(x_ad, f_ad);
+      x_ad(0) = FixedAutoDiff<N>(x(0), 0);  // value, derivIndex
+      x_ad(1) = FixedAutoDiff<N>(x(1), 1);
+      T_evaluate<FixedAutoDiff<N>>(x_ad, f_ad);
 
       for (size_t i = 0; i < N; i++)
         for (size_t j = 0; j < N; j++)
           df(i,j) = derivative(f_ad(i), j);
     }
 
+    // the AD pass returns the values as well
+    void evaluateWithDeriv (VectorView<double> x, VectorView<double> f,
+                            MatrixView<double> df) const override
+    {
+      const size_t N = 2;
+      std::array<FixedAutoDiff<N>, N> x_mem, f_mem;
+      VectorView<FixedAutoDiff<N>> x_ad(N, x_mem.data());
+      VectorView<FixedAutoDiff<N>> f_ad(N, f_mem.data());
+
+      x_ad(0) = FixedAutoDiff<N>(x(0), 0);
+      x_ad(1) = FixedAutoDiff<N>(x(1), 1);
+      T_evaluate<FixedAutoDiff<N>>(x_ad, f_ad);
+
+      for (size_t i = 0; i < N; i++)
+      {
+        f(i) = f_ad(i).value();
+        for (size_t j = 0; j < N; j++)
+          df(i,j) = derivative(f_ad(i), j);
+      }
+    }
+
+    // states are looped inside the node: one virtual call per batch
+    void evaluateBatch (MatrixView<double> x, MatrixView<double> f) const override
+    {
+      double fac = -m_gravity/m_length;
+      for (size_t m = 0; m < x.cols(); m++)
+      {
+        f(0,m) = x(1,m);
+        f(1,m) = fac*sin(x(0,m));
+      }
+    }
+    // the Jacobian entries written directly, so the loop over the states stays plain arithmetic
+    void evaluateDerivBatch (MatrixView<double> x, MatrixView<double> df) const override
+    {
+      double fac = -m_gravity/m_length;
+      for (size_t m = 0; m < x.cols(); m++)
+      {
+        df(0,m) = 0;                    // df0/dx0
+        df(1,m) = 1;                    // df0/dx1
+        df(2,m) = fac*cos(x(0,m));      // df1/dx0
+        df(3,m) = 0;                    // df1/dx1
+      }
+    }
+
+    // one AutoDiff direction seeded with v
+    void evaluateDirectionalDeriv (VectorView<double> x, VectorView<double> v,
+                                   VectorView<double> dfv) const override
+    {
+      std::array<FixedAutoDiff<1>, 2> x_mem, f_mem;
+      VectorView<FixedAutoDiff<1>> x_ad(2, x_mem.data());
+      VectorView<FixedAutoDiff<1>> f_ad(2, f_mem.data());
+      for (size_t i = 0; i < 2; i++)
+      {
+        x_ad(i) = FixedAutoDiff<1>(x(i));
+        x_ad(i).deriv()[0] = v(i);
+      }
+      T_evaluate<FixedAutoDiff<1>>(x_ad, f_ad);
+      for (size_t i = 0; i < 2; i++)
+        dfv(i) = derivative(f_ad(i), 0);
+    }
+
+    // f0 depends on x1 only, f1 on x0 only
+    void addJacobianPattern (SparsityPattern & pattern, size_t firstf, size_t firstx) const override
+    {
+      pattern.add(firstf, firstx+1);
+      pattern.add(firstf+1, firstx);
+    }
+    void addJacobian (VectorView<double> x, SparseMatrix<double> & df, double fac,
+                      size_t firstf, size_t firstx) const override
+    {
+      std::array<double,4> mem;
+      MatrixView<double> dense(2, 2, 2, mem.data());
+      evaluateDeriv(x, dense);
+      df.add(firstf, firstx+1, fac*dense(0,1));
+      df.add(firstf+1, firstx, fac*dense(1,0));
+    }
+
     template <typename T>
     void T_evaluate (VectorView<T> x, VectorView<T> f) const
 
@@ -344,6 +1124,397 @@ namespace ASC_ode
   };
 
 
+
+  // Fused sum  c_id * x + sum_k c_k * const_k + sum_j c_j * f_j(x).
+  // Every coefficient is a number times a product of Parameters. Identity and
+  // constant terms are applied in one pass over f and never call
+  // evaluateDeriv: the identity contributes a diagonal, constants nothing.
+  // Built by Simplify.
+  class LinearCombinationFunction : public NonlinearFunction
+  {
+  public:
+    struct Term
+    {
+      double coef;
+      std::vector<std::shared_ptr<Parameter>> params;
+      std::shared_ptr<NonlinearFunction> func;   // unused for identity terms
+
+      double factor() const
+      {
+        double fac = coef;
+        for (auto & p : params) fac *= p->get();
+        return fac;
+      }
+    };
+
+  private:
+    size_t m_dimx, m_dimf;
+    std::vector<Term> m_identity, m_constants, m_terms;
+    // scratch, the matrix is allocated on the first dense evaluateDeriv with several terms
+    mutable Vector<> m_tmpf;
+    mutable std::vector<double> m_constfac;
+    mutable std::unique_ptr<Matrix<double>> m_tmpdf;
+    mutable std::unique_ptr<Matrix<double>> m_batchf, m_batchdf;
+
+    // adds to a term with the same function and parameters, or appends
+    static void addTo (std::vector<Term> & terms, Term term)
+    {
+      for (auto & t : terms)
+        if (t.func == term.func && t.params == term.params)
+        {
+          t.coef += term.coef;
+          return;
+        }
+      terms.push_back(std::move(term));
+    }
+
+    double identityFactor() const
+    {
+      double fac = 0;
+      for (auto & t : m_identity) fac += t.factor();
+      return fac;
+    }
+
+  public:
+    LinearCombinationFunction (size_t dimx, size_t dimf)
+      : m_dimx(dimx), m_dimf(dimf), m_tmpf(dimf) { }
+
+    void addIdentity (double coef, std::vector<std::shared_ptr<Parameter>> params = {})
+    {
+      addTo(m_identity, { coef, std::move(params), nullptr });
+    }
+    void addConstant (double coef, std::vector<std::shared_ptr<Parameter>> params,
+                      std::shared_ptr<ConstantFunction> func)
+    {
+      addTo(m_constants, { coef, std::move(params), func });
+      m_constfac.resize(m_constants.size());
+    }
+    void addTerm (double coef, std::vector<std::shared_ptr<Parameter>> params,
+                  std::shared_ptr<NonlinearFunction> func)
+    {
+      addTo(m_terms, { coef, std::move(params), func });
+    }
+
+    const std::vector<Term> & identityTerms() const { return m_identity; }
+    const std::vector<Term> & constantTerms() const { return m_constants; }
+    const std::vector<Term> & terms() const { return m_terms; }
+
+    // drops terms whose coefficient folded to zero
+    void removeZeroTerms ()
+    {
+      for (auto * terms : { &m_identity, &m_constants, &m_terms })
+        terms->erase(std::remove_if(terms->begin(), terms->end(),
+                                    [](const Term & t) { return t.coef == 0.0; }),
+                     terms->end());
+      m_constfac.resize(m_constants.size());
+    }
+
+    size_t dimX() const override { return m_dimx; }
+    size_t dimF() const override { return m_dimf; }
+
+    void evaluate (VectorView<double> x, VectorView<double> f) const override
+    {
+      if (m_terms.empty())
+        f = 0.0;
+      else
+      {
+        m_terms[0].func->evaluate(x, f);
+        f *= m_terms[0].factor();
+      }
+
+      // identity and constants in one pass
+      double facid = identityFactor();
+      for (size_t k = 0; k < m_constants.size(); k++)
+        m_constfac[k] = m_constants[k].factor();
+      if (facid != 0.0 || !m_constants.empty())
+        for (size_t i = 0; i < m_dimf; i++)
+        {
+          double sum = f(i);
+          if (facid != 0.0) sum += facid * x(i);
+          for (size_t k = 0; k < m_constants.size(); k++)
+            sum += m_constfac[k] * static_cast<ConstantFunction&>(*m_constants[k].func).get()(i);
+          f(i) = sum;
+        }
+
+      for (size_t j = 1; j < m_terms.size(); j++)
+      {
+        m_terms[j].func->evaluate(x, m_tmpf);
+        f += m_terms[j].factor() * m_tmpf;
+      }
+    }
+
+    void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const override
+    {
+      if (m_terms.empty())
+        df = 0.0;
+      else
+      {
+        m_terms[0].func->evaluateDeriv(x, df);
+        df *= m_terms[0].factor();
+      }
+
+      double facid = identityFactor();
+      if (facid != 0.0)
+        for (size_t i = 0; i < std::min(m_dimf, m_dimx); i++)
+          df(i,i) += facid;
+
+      if (m_terms.size() > 1 && !m_tmpdf)
+        m_tmpdf = std::make_unique<Matrix<double>>(m_dimf, m_dimx);
+      for (size_t j = 1; j < m_terms.size(); j++)
+      {
+        m_terms[j].func->evaluateDeriv(x, *m_tmpdf);
+        *m_tmpdf *= m_terms[j].factor();
+        df += *m_tmpdf;
+      }
+    }
+
+    void evaluateWithDeriv (VectorView<double> x, VectorView<double> f,
+                            MatrixView<double> df) const override
+    {
+      if (m_terms.empty())
+      {
+        f = 0.0;
+        df = 0.0;
+      }
+      else
+      {
+        m_terms[0].func->evaluateWithDeriv(x, f, df);
+        f *= m_terms[0].factor();
+        df *= m_terms[0].factor();
+      }
+
+      double facid = identityFactor();
+      for (size_t k = 0; k < m_constants.size(); k++)
+        m_constfac[k] = m_constants[k].factor();
+      if (facid != 0.0 || !m_constants.empty())
+        for (size_t i = 0; i < m_dimf; i++)
+        {
+          double sum = f(i);
+          if (facid != 0.0) sum += facid * x(i);
+          for (size_t k = 0; k < m_constants.size(); k++)
+            sum += m_constfac[k] * static_cast<ConstantFunction&>(*m_constants[k].func).get()(i);
+          f(i) = sum;
+        }
+      if (facid != 0.0)
+        for (size_t i = 0; i < std::min(m_dimf, m_dimx); i++)
+          df(i,i) += facid;
+
+      if (m_terms.size() > 1 && !m_tmpdf)
+        m_tmpdf = std::make_unique<Matrix<double>>(m_dimf, m_dimx);
+      for (size_t j = 1; j < m_terms.size(); j++)
+      {
+        m_terms[j].func->evaluateWithDeriv(x, m_tmpf, *m_tmpdf);
+        f += m_terms[j].factor() * m_tmpf;
+        *m_tmpdf *= m_terms[j].factor();
+        df += *m_tmpdf;
+      }
+    }
+
+    void evaluateBatch (MatrixView<double> x, MatrixView<double> f) const override
+    {
+      size_t M = x.cols();
+      if (m_terms.empty())
+        f = 0.0;
+      else
+      {
+        m_terms[0].func->evaluateBatch(x, f);
+        f *= m_terms[0].factor();
+      }
+
+      double facid = identityFactor();
+      if (facid != 0.0)
+        for (size_t i = 0; i < m_dimf; i++)
+          for (size_t m = 0; m < M; m++)
+            f(i,m) += facid * x(i,m);
+      for (auto & t : m_constants)
+      {
+        double fac = t.factor();
+        auto val = static_cast<ConstantFunction&>(*t.func).get();
+        for (size_t i = 0; i < m_dimf; i++)
+          for (size_t m = 0; m < M; m++)
+            f(i,m) += fac * val(i);
+      }
+
+      if (m_terms.size() > 1)
+      {
+        auto tmp = BatchScratch(m_batchf, m_dimf, M);
+        for (size_t j = 1; j < m_terms.size(); j++)
+        {
+          m_terms[j].func->evaluateBatch(x, tmp);
+          f += m_terms[j].factor() * tmp;
+        }
+      }
+    }
+
+    void evaluateDerivBatch (MatrixView<double> x, MatrixView<double> df) const override
+    {
+      size_t M = x.cols();
+      if (m_terms.empty())
+        df = 0.0;
+      else
+      {
+        m_terms[0].func->evaluateDerivBatch(x, df);
+        df *= m_terms[0].factor();
+      }
+
+      double facid = identityFactor();
+      if (facid != 0.0)
+        for (size_t i = 0; i < std::min(m_dimf, m_dimx); i++)
+          for (size_t m = 0; m < M; m++)
+            df(i*m_dimx+i, m) += facid;
+
+      if (m_terms.size() > 1)
+      {
+        auto tmp = BatchScratch(m_batchdf, m_dimf*m_dimx, M);
+        for (size_t j = 1; j < m_terms.size(); j++)
+        {
+          m_terms[j].func->evaluateDerivBatch(x, tmp);
+          df += m_terms[j].factor() * tmp;
+        }
+      }
+    }
+
+    void evaluateDirectionalDeriv (VectorView<double> x, VectorView<double> v,
+                                   VectorView<double> dfv) const override
+    {
+      if (m_terms.empty())
+        dfv = 0.0;
+      else
+      {
+        m_terms[0].func->evaluateDirectionalDeriv(x, v, dfv);
+        dfv *= m_terms[0].factor();
+      }
+
+      double facid = identityFactor();
+      if (facid != 0.0)
+        for (size_t i = 0; i < m_dimf; i++)
+          dfv(i) += facid * v(i);
+
+      for (size_t j = 1; j < m_terms.size(); j++)
+      {
+        m_terms[j].func->evaluateDirectionalDeriv(x, v, m_tmpf);
+        dfv += m_terms[j].factor() * m_tmpf;
+      }
+    }
+
+    void addJacobianPattern (SparsityPattern & pattern, size_t firstf, size_t firstx) const override
+    {
+      if (!m_identity.empty())
+        pattern.addDiag(firstf, firstx, std::min(m_dimf, m_dimx));
+      for (auto & t : m_terms)
+        t.func->addJacobianPattern(pattern, firstf, firstx);
+    }
+    void addJacobian (VectorView<double> x, SparseMatrix<double> & df, double fac,
+                      size_t firstf, size_t firstx) const override
+    {
+      if (!m_identity.empty())
+      {
+        double facid = fac * identityFactor();
+        for (size_t i = 0; i < std::min(m_dimf, m_dimx); i++)
+          df.add(firstf+i, firstx+i, facid);
+      }
+      for (auto & t : m_terms)
+        t.func->addJacobian(x, df, fac*t.factor(), firstf, firstx);
+    }
+
+    JacobianTraits jacobianTraits () const override
+    {
+      JacobianTraits traits;
+      traits.constant = true;
+      traits.linear = m_constants.empty();
+      traits.diagonal = true;
+      traits.blocksize = m_dimx == m_dimf ? 1 : 0;
+      traits.symmetric = m_dimx == m_dimf;
+      for (auto & t : m_terms)
+        traits = CombineTraits(traits, t.func->jacobianTraits());
+      return traits;
+    }
+    // the factors of the constant terms do not enter the Jacobian
+    void addJacobianParameters (std::vector<std::shared_ptr<Parameter>> & params) const override
+    {
+      for (auto * terms : { &m_identity, &m_terms })
+        for (auto & t : *terms)
+          for (auto & p : t.params)
+            if (!p->isConstant())
+              params.push_back(p);
+      for (auto & t : m_terms)
+        t.func->addJacobianParameters(params);
+    }
+  };
+
+
+  std::shared_ptr<NonlinearFunction> Simplify (std::shared_ptr<NonlinearFunction> func);
+
+  // adds coef * params * func to lc, flattening sums and scalings
+  inline void CollectLinearTerms (std::shared_ptr<NonlinearFunction> func, double coef,
+                                  const std::vector<std::shared_ptr<Parameter>> & params,
+                                  LinearCombinationFunction & lc)
+  {
+    if (auto sum = std::dynamic_pointer_cast<SumFunction>(func))
+    {
+      CollectLinearTerms(sum->fa(), coef*sum->faca(), params, lc);
+      CollectLinearTerms(sum->fb(), coef*sum->facb(), params, lc);
+    }
+    else if (auto scale = std::dynamic_pointer_cast<ScaleFunction>(func))
+    {
+      auto par = scale->parameter();
+      if (par->isConstant())
+        CollectLinearTerms(scale->fa(), coef*par->get(), params, lc);
+      else
+      {
+        auto params2 = params;
+        params2.push_back(par);
+        CollectLinearTerms(scale->fa(), coef, params2, lc);
+      }
+    }
+    else if (auto comb = std::dynamic_pointer_cast<LinearCombinationFunction>(func))
+    {
+      auto merge = [&](const LinearCombinationFunction::Term & t)
+      {
+        auto params2 = params;
+        params2.insert(params2.end(), t.params.begin(), t.params.end());
+        return params2;
+      };
+      for (auto & t : comb->identityTerms())
+        lc.addIdentity(coef*t.coef, merge(t));
+      for (auto & t : comb->constantTerms())
+        lc.addConstant(coef*t.coef, merge(t), std::static_pointer_cast<ConstantFunction>(t.func));
+      for (auto & t : comb->terms())
+        lc.addTerm(coef*t.coef, merge(t), t.func);
+    }
+    else if (std::dynamic_pointer_cast<IdentityFunction>(func))
+      lc.addIdentity(coef, params);
+    else if (auto cf = std::dynamic_pointer_cast<ConstantFunction>(func))
+      lc.addConstant(coef, params, cf);
+    else
+      lc.addTerm(coef, params, Simplify(func));
+  }
+
+  // Optimisation pass over an expression tree: nested sums and scalings are
+  // flattened into one LinearCombinationFunction, constant factors are
+  // multiplied out, and the arguments of compositions are simplified.
+  // Parameters that are not constant stay live.
+  inline std::shared_ptr<NonlinearFunction> Simplify (std::shared_ptr<NonlinearFunction> func)
+  {
+    if (std::dynamic_pointer_cast<SumFunction>(func) ||
+        std::dynamic_pointer_cast<ScaleFunction>(func) ||
+        std::dynamic_pointer_cast<LinearCombinationFunction>(func))
+    {
+      auto lc = std::make_shared<LinearCombinationFunction>(func->dimX(), func->dimF());
+      CollectLinearTerms(func, 1.0, {}, *lc);
+      lc->removeZeroTerms();
+
+      // a single plain term needs no wrapper
+      if (lc->identityTerms().empty() && lc->constantTerms().empty() && lc->terms().size() == 1 &&
+          lc->terms()[0].coef == 1.0 && lc->terms()[0].params.empty())
+        return lc->terms()[0].func;
+      return lc;
+    }
+    if (auto comp = std::dynamic_pointer_cast<ComposeFunction>(func))
+      return Compose(Simplify(comp->fa()), Simplify(comp->fb()));
+    return func;
+  }
+
 }
 
 #endif
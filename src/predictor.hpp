@@ -0,0 +1,226 @@
+#ifndef PREDICTOR_HPP
+#define PREDICTOR_HPP
+
+#include <cstddef>
+#include <vector>
+#include <stdexcept>
+
+#include <vector.hpp>
+
+
+namespace ASC_ode
+{
+  using namespace nanoblas;
+
+
+  // Initial guess of the Newton iteration in an implicit time step
+  enum class Predictor
+  {
+    Constant,     // no prediction: y_n, stages k = 0, the last acceleration
+    Linear,       // linear extrapolation of the unknown from the last two steps
+    Quadratic,    // quadratic extrapolation from the last three steps
+    StageReuse,   // Runge-Kutta: the stages of the last step
+    DenseOutput   // Runge-Kutta: stages from the collocation polynomial of the last step,
+                  // CrankNicolson: the quadratic through y_n-1, y_n with slope f(y_n)
+  };
+
+  // The values of a vector at the last few times, for polynomial extrapolation.
+  // Storage is allocated by resize(), push() only copies. The predictors keep
+  // the times relative to the latest step (shift), so that the differences
+  // in extrapolate do not cancel on long runs.
+  class History
+  {
+    std::vector<Vector<double>> m_values;
+    std::vector<double> m_times;
+    size_t m_count = 0;   // valid entries
+    size_t m_first = 0;   // position of the latest one
+
+  public:
+    History (size_t dim = 0, size_t length = 0) { resize(dim, length); }
+
+    void resize (size_t dim, size_t length)
+    {
+      m_values.assign(length, Vector<double>(dim));
+      m_times.assign(length, 0.0);
+      m_count = m_first = 0;
+    }
+
+    size_t length() const { return m_values.size(); }
+    size_t size() const { return m_count; }
+    void clear() { m_count = 0; }
+
+    void push (double t, VectorView<double> v)
+    {
+      m_first = (m_first + length() - 1) % length();
+      m_values[m_first] = v;
+      m_times[m_first] = t;
+      if (m_count < length()) m_count++;
+    }
+
+    // moves the time origin: all times change by dt
+    void shift (double dt)
+    {
+      for (auto & t : m_times) t += dt;
+    }
+
+    // i = 0 is the latest value
+    const Vector<double> & value (size_t i) const { return m_values[(m_first + i) % length()]; }
+    double time (size_t i) const { return m_times[(m_first + i) % length()]; }
+
+    // the polynomial through all stored values, evaluated at t
+    void extrapolate (double t, VectorView<double> v) const
+    {
+      if (m_count == 0)
+        throw std::logic_error("History::extrapolate: no values");
+      v = 0.0;
+      for (size_t i = 0; i < m_count; i++)
+        {
+          double w = 1;
+          for (size_t j = 0; j < m_count; j++)
+            if (j != i)
+              w *= (t - time(j)) / (time(i) - time(j));
+          v += w * value(i);
+        }
+    }
+  };
+
+
+  // Stages k_j of the next Runge-Kutta step from u', the derivative of the
+  // collocation polynomial of the last step, which interpolates the old
+  // stages at the nodes c: k_j = u'(t_n + c_j tau) = sum_l L_l(1 + c_j tau/tauold) kold_l.
+  inline void CollocationPredictor (VectorView<double> c, VectorView<double> kold,
+                                    double ratio, size_t n, VectorView<double> k)
+  {
+    size_t s = c.size();
+    k = 0.0;
+    for (size_t j = 0; j < s; j++)
+      {
+        double theta = 1 + c(j) * ratio;
+        auto k_j = k.range(j*n, (j+1)*n);
+        for (size_t l = 0; l < s; l++)
+          {
+            double w = 1;
+            for (size_t m = 0; m < s; m++)
+              if (m != l)
+                w *= (theta - c(m)) / (c(l) - c(m));
+            k_j += w * kold.range(l*n, (l+1)*n);
+          }
+      }
+  }
+
+
+  // Prediction of the unknown of a one-step method from its own past values:
+  // Constant, Linear, Quadratic and, given the slope x'(t_n), DenseOutput.
+  class ValuePredictor
+  {
+    Predictor m_predictor = Predictor::Constant;
+    History m_history;   // times relative to the last step
+
+  public:
+    Predictor predictor() const { return m_predictor; }
+
+    void set (Predictor predictor, size_t dim)
+    {
+      if (predictor == Predictor::StageReuse)
+        throw std::invalid_argument("ValuePredictor: StageReuse needs Runge-Kutta stages");
+      m_predictor = predictor;
+      m_history.resize(dim, predictor == Predictor::Constant ? 0
+                       : predictor == Predictor::Quadratic ? 3 : 2);
+    }
+
+    // x holds the value at the last step and gets the prediction tau later
+    void predict (double tau, VectorView<double> x)
+    {
+      if (m_predictor == Predictor::DenseOutput)
+        throw std::logic_error("ValuePredictor: DenseOutput needs the slope");
+      if (m_predictor == Predictor::Constant) return;
+      if (m_history.size() == 0) m_history.push(0, x);
+      if (m_history.size() >= 2) m_history.extrapolate(tau, x);
+    }
+
+    // the same with the slope x'(t_n): DenseOutput extrapolates the quadratic
+    // with values x_n-1, x_n and slope x'(t_n), or the tangent in the first step
+    void predict (double tau, VectorView<double> x, VectorView<double> slope)
+    {
+      if (m_predictor != Predictor::DenseOutput)
+        {
+          predict(tau, x);
+          return;
+        }
+      if (m_history.size() == 0) m_history.push(0, x);
+      if (m_history.size() >= 2)
+        {
+          // x + tau slope + (tau/tauold)^2 (xold - x + tauold slope)
+          double tauold = m_history.time(0) - m_history.time(1);
+          double r2 = (tau/tauold) * (tau/tauold);
+          x *= 1 - r2;
+          x += r2 * m_history.value(1);
+          x += (tau + r2 * tauold) * slope;
+        }
+      else
+        x += tau * slope;
+    }
+
+    // after the step: x is the new value
+    void update (double tau, VectorView<double> x)
+    {
+      if (m_predictor == Predictor::Constant) return;
+      m_history.shift(-tau);
+      m_history.push(0, x);
+    }
+  };
+
+
+  // Prediction of the stages k = [k_0; ...; k_s-1] of an implicit Runge-Kutta
+  // step with nodes c. Constant starts from k = 0 (all stage values y_n),
+  // Linear and Quadratic extrapolate the stages of the last steps.
+  class StagePredictor
+  {
+    Predictor m_predictor = Predictor::Constant;
+    Vector<> m_c;
+    size_t m_n;
+    History m_history;   // times relative to the last step
+    double m_tauold = 0;
+
+  public:
+    StagePredictor (const Vector<> & c, size_t n) : m_c(c), m_n(n) { }
+
+    Predictor predictor() const { return m_predictor; }
+
+    void set (Predictor predictor)
+    {
+      m_predictor = predictor;
+      m_history.resize(m_c.size()*m_n, predictor == Predictor::Constant ? 0
+                       : predictor == Predictor::Linear ? 2
+                       : predictor == Predictor::Quadratic ? 3 : 1);
+    }
+
+    void predict (double tau, VectorView<double> k) const
+    {
+      if (m_history.size() == 0)
+        {
+          k = 0.0;
+          return;
+        }
+      switch (m_predictor)
+        {
+        case Predictor::StageReuse: k = m_history.value(0); break;
+        case Predictor::DenseOutput:
+          CollocationPredictor(m_c, m_history.value(0), tau/m_tauold, m_n, k); break;
+        default: m_history.extrapolate(tau, k);
+        }
+    }
+
+    // after the step: k are its stages
+    void update (double tau, VectorView<double> k)
+    {
+      m_tauold = tau;
+      if (m_predictor == Predictor::Constant) return;
+      m_history.shift(-tau);
+      m_history.push(0, k);
+    }
+  };
+
+}
+
+#endif
@@ -0,0 +1,301 @@
+#ifndef REVERSEAD_HPP
+#define REVERSEAD_HPP
+
+#include <cstddef>
+#include <ostream>
+#include <cmath>
+#include <vector>
+#include <stdexcept>
+#include <type_traits>
+
+#include <vector.hpp>
+
+
+namespace ASC_ode
+{
+  using namespace nanoblas;
+
+  // Reverse-mode (tape-based) automatic differentiation.
+  //
+  // Every operation on ReverseAD values appends one node to the active Tape,
+  // recording its (at most two) parents and the local partial derivatives.
+  // A single backward sweep over the tape then returns the gradient of one
+  // output with respect to all variables.
+
+
+  // one tape entry: parents and local partial derivatives d(node)/d(parent)
+  template <typename T = double>
+  struct TapeNode
+  {
+    size_t parent[2];
+    T partial[2];
+  };
+
+
+  template <typename T = double>
+  class Tape
+  {
+    // node and adjoint storage keep their capacity over clear(),
+    // so a tape reused between calls works as an arena
+    std::vector<TapeNode<T>> m_nodes;
+    std::vector<T> m_adjoints;
+  public:
+    static constexpr size_t none = size_t(-1);
+
+    // tape that ReverseAD operations currently record to
+    static Tape *& active()
+    {
+      thread_local Tape * tape = nullptr;
+      return tape;
+    }
+
+    // forget all nodes, O(1), memory is kept for the next recording
+    void clear() { m_nodes.clear(); }
+
+    size_t size() const { return m_nodes.size(); }
+    void reserve(size_t n) { m_nodes.reserve(n); }
+
+    size_t push (size_t p0, T d0, size_t p1 = none, T d1 = T(0))
+    {
+      m_nodes.push_back( { { p0, p1 }, { d0, d1 } } );
+      return m_nodes.size()-1;
+    }
+
+    // independent variable: node without parents
+    size_t newVariable () { return push(none, T(0)); }
+
+    // backward sweep: adjoints of all nodes w.r.t. node 'output'
+    const std::vector<T> & gradient (size_t output)
+    {
+      m_adjoints.assign(m_nodes.size(), T(0));
+      if (output == none) return m_adjoints;
+      m_adjoints[output] = T(1);
+      for (size_t i = output+1; i-- > 0; )
+      {
+        T adj = m_adjoints[i];
+        if constexpr (std::is_arithmetic_v<T>)
+          if (adj == T(0)) continue;
+        const TapeNode<T> & node = m_nodes[i];
+        for (int k = 0; k < 2; k++)
+          if (node.parent[k] != none)
+            m_adjoints[node.parent[k]] += node.partial[k] * adj;
+      }
+      return m_adjoints;
+    }
+  };
+
+
+  // makes 'tape' the active tape for the lifetime of the scope, and clears it
+  template <typename T = double>
+  class TapeScope
+  {
+    Tape<T> * m_prev;
+  public:
+    TapeScope (Tape<T> & tape) : m_prev(Tape<T>::active())
+    {
+      tape.clear();
+      Tape<T>::active() = &tape;
+    }
+    ~TapeScope() { Tape<T>::active() = m_prev; }
+    TapeScope (const TapeScope&) = delete;
+    TapeScope & operator= (const TapeScope&) = delete;
+  };
+
+
+  template <typename T = double>
+  class ReverseAD
+  {
+  private:
+    T m_val;
+    size_t m_index;   // node on the active tape, Tape<T>::none for constants
+  public:
+    // Default constructor: the constant 0
+    ReverseAD () : m_val(0), m_index(Tape<T>::none) {}
+
+    // Construct constant (not recorded on the tape)
+    ReverseAD (T v) : m_val(v), m_index(Tape<T>::none) {}
+
+    ReverseAD (T v, size_t index) : m_val(v), m_index(index) {}
+
+    // independent variable recorded on the active tape
+    static ReverseAD variable (T v)
+    {
+      Tape<T> * tape = Tape<T>::active();
+      if (!tape) throw std::logic_error("ReverseAD::variable: no active tape");
+      return ReverseAD(v, tape->newVariable());
+    }
+
+    T value() const { return m_val; }
+    size_t index() const { return m_index; }
+    bool isConstant() const { return m_index == Tape<T>::none; }
+  };
+
+
+  template <typename T>
+  std::ostream & operator<< (std::ostream& os, const ReverseAD<T>& ad)
+  {
+    os << "Value: " << ad.value() << ", Node: ";
+    if (ad.isConstant()) os << "const";
+    else os << ad.index();
+    return os;
+  }
+
+  // tape to record an operation on variables to
+  template <typename T>
+  Tape<T> & recordingTape ()
+  {
+    Tape<T> * tape = Tape<T>::active();
+    if (!tape) throw std::logic_error("ReverseAD: operation on a variable without an active tape");
+    return *tape;
+  }
+
+  // record unary/binary results; constants stay off the tape
+  template <typename T>
+  ReverseAD<T> recordUnary (T val, const ReverseAD<T>& a, T da)
+  {
+    if (a.isConstant()) return ReverseAD<T>(val);
+    return ReverseAD<T>(val, recordingTape<T>().push(a.index(), da));
+  }
+
+  template <typename T>
+  ReverseAD<T> recordBinary (T val, const ReverseAD<T>& a, T da, const ReverseAD<T>& b, T db)
+  {
+    if (a.isConstant()) return recordUnary(val, b, db);
+    if (b.isConstant()) return recordUnary(val, a, da);
+    return ReverseAD<T>(val, recordingTape<T>().push(a.index(), da, b.index(), db));
+  }
+
+
+  template <typename T>
+  ReverseAD<T> operator+ (const ReverseAD<T>& a, const ReverseAD<T>& b)
+  { return recordBinary(a.value()+b.value(), a, T(1), b, T(1)); }
+
+  template <typename T>
+  ReverseAD<T> operator+ (std::type_identity_t<T> a, const ReverseAD<T>& b)
+  { return recordUnary(a+b.value(), b, T(1)); }
+
+  template <typename T>
+  ReverseAD<T> operator+ (const ReverseAD<T>& a, std::type_identity_t<T> b)
+  { return recordUnary(a.value()+b, a, T(1)); }
+
+  template <typename T>
+  ReverseAD<T> operator- (const ReverseAD<T>& a)
+  { return recordUnary(-a.value(), a, T(-1)); }
+
+  template <typename T>
+  ReverseAD<T> operator- (const ReverseAD<T>& a, const ReverseAD<T>& b)
+  { return recordBinary(a.value()-b.value(), a, T(1), b, T(-1)); }
+
+  template <typename T>
+  ReverseAD<T> operator- (std::type_identity_t<T> a, const ReverseAD<T>& b)
+  { return recordUnary(a-b.value(), b, T(-1)); }
+
+  template <typename T>
+  ReverseAD<T> operator- (const ReverseAD<T>& a, std::type_identity_t<T> b)
+  { return recordUnary(a.value()-b, a, T(1)); }
+
+  template <typename T>
+  ReverseAD<T> operator* (const ReverseAD<T>& a, const ReverseAD<T>& b)
+  { return recordBinary(a.value()*b.value(), a, b.value(), b, a.value()); }
+
+  template <typename T>
+  ReverseAD<T> operator* (std::type_identity_t<T> s, const ReverseAD<T>& b)
+  { return recordUnary(s*b.value(), b, T(s)); }
+
+  template <typename T>
+  ReverseAD<T> operator* (const ReverseAD<T>& a, std::type_identity_t<T> s)
+  { return recordUnary(a.value()*s, a, T(s)); }
+
+  template <typename T>
+  ReverseAD<T> operator/ (const ReverseAD<T>& a, const ReverseAD<T>& b)
+  {
+    T inv = T(1) / b.value();
+    T val = a.value() * inv;
+    return recordBinary(val, a, inv, b, -val * inv);
+  }
+
+  template <typename T>
+  ReverseAD<T> operator/ (std::type_identity_t<T> a, const ReverseAD<T>& b)
+  {
+    T val = a / b.value();
+    return recordUnary(val, b, -val / b.value());
+  }
+
+  template <typename T>
+  ReverseAD<T> operator/ (const ReverseAD<T>& a, std::type_identity_t<T> b)
+  { return recordUnary(a.value()/b, a, T(1)/b); }
+
+  template <typename T>
+  auto operator+= (ReverseAD<T>& a, const ReverseAD<T>& b) { a = a + b; return a; }
+
+  template <typename T>
+  auto operator-= (ReverseAD<T>& a, const ReverseAD<T>& b) { a = a - b; return a; }
+
+  template <typename T>
+  auto operator*= (ReverseAD<T>& a, const ReverseAD<T>& b) { a = a * b; return a; }
+
+  template <typename T>
+  auto operator/= (ReverseAD<T>& a, const ReverseAD<T>& b) { a = a / b; return a; }
+
+  using std::sin;
+  using std::cos;
+  using std::exp;
+  using std::log;
+  using std::sqrt;
+
+  template <typename T>
+  ReverseAD<T> sin (const ReverseAD<T>& a)
+  { return recordUnary(sin(a.value()), a, cos(a.value())); }
+
+  template <typename T>
+  ReverseAD<T> cos (const ReverseAD<T>& a)
+  { return recordUnary(cos(a.value()), a, -sin(a.value())); }
+
+  template <typename T>
+  ReverseAD<T> exp (const ReverseAD<T>& a)
+  {
+    T v = exp(a.value());
+    return recordUnary(v, a, v);
+  }
+
+  template <typename T>
+  ReverseAD<T> log (const ReverseAD<T>& a)
+  { return recordUnary(log(a.value()), a, T(1)/a.value()); }
+
+  template <typename T>
+  ReverseAD<T> sqrt (const ReverseAD<T>& a)
+  {
+    T v = sqrt(a.value());
+    return recordUnary(v, a, T(1)/(T(2)*v));
+  }
+
+  template <typename T>
+  ReverseAD<T> norm2 (const ReverseAD<T>& a)
+  {
+    return a * a;
+  }
+
+
+  // Gradient of a scalar function in one backward sweep.
+  // 'func' gets x as VectorView<ReverseAD<>> and returns a ReverseAD<>,
+  // the value is returned, the gradient written to 'grad'.
+  template <typename FUNC>
+  double ReverseGradient (Tape<> & tape, FUNC && func,
+                          VectorView<double> x, VectorView<double> grad)
+  {
+    TapeScope<> scope(tape);
+    Vector<ReverseAD<>> xad(x.size());
+    for (size_t i = 0; i < x.size(); i++)
+      xad(i) = ReverseAD<>::variable(x(i));   // variables are the nodes 0..n-1
+
+    ReverseAD<> res = func(VectorView<ReverseAD<>>(x.size(), xad.data()));
+
+    auto & adj = tape.gradient(res.index());
+    for (size_t i = 0; i < x.size(); i++)
+      grad(i) = res.isConstant() ? 0.0 : adj[i];
+    return res.value();
+  }
+
+}
+
+#endif
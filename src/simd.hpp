@@ -0,0 +1,116 @@
+#ifndef SIMD_HPP
+#define SIMD_HPP
+
+#include <cstddef>
+#include <array>
+
+#if defined(__AVX__) || defined(__AVX512F__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+
+namespace ASC_ode
+{
+
+  // number of doubles in the widest vector register the build targets
+#if defined(__AVX512F__)
+  constexpr size_t SIMDWidth = 8;
+#elif defined(__AVX__)
+  constexpr size_t SIMDWidth = 4;
+#elif defined(__SSE2__)
+  constexpr size_t SIMDWidth = 2;
+#else
+  constexpr size_t SIMDWidth = 1;
+#endif
+
+  // alignment of SIMD data (bytes), enough for AVX-512
+  constexpr size_t SIMDAlignment = 64;
+
+
+  // Minimal SIMD pack: broadcast, aligned load/store, + - *.
+  // The generic version is the scalar fallback, specialisations use intrinsics.
+  template <typename T, size_t W>
+  class SIMD
+  {
+    std::array<T, W> m_val;
+  public:
+    SIMD () = default;
+    SIMD (T s) { m_val.fill(s); }
+    static SIMD load (const T * p)
+    {
+      SIMD r;
+      for (size_t i = 0; i < W; i++) r.m_val[i] = p[i];
+      return r;
+    }
+    void store (T * p) const
+    {
+      for (size_t i = 0; i < W; i++) p[i] = m_val[i];
+    }
+    T operator[] (size_t i) const { return m_val[i]; }
+
+    friend SIMD operator+ (SIMD a, SIMD b) { for (size_t i = 0; i < W; i++) a.m_val[i] += b.m_val[i]; return a; }
+    friend SIMD operator- (SIMD a, SIMD b) { for (size_t i = 0; i < W; i++) a.m_val[i] -= b.m_val[i]; return a; }
+    friend SIMD operator* (SIMD a, SIMD b) { for (size_t i = 0; i < W; i++) a.m_val[i] *= b.m_val[i]; return a; }
+  };
+
+
+#if defined(__SSE2__)
+  template <>
+  class SIMD<double, 2>
+  {
+    __m128d m_val;
+  public:
+    SIMD () = default;
+    SIMD (__m128d v) : m_val(v) { }
+    SIMD (double s) : m_val(_mm_set1_pd(s)) { }
+    static SIMD load (const double * p) { return _mm_load_pd(p); }
+    void store (double * p) const { _mm_store_pd(p, m_val); }
+    __m128d val() const { return m_val; }
+
+    friend SIMD operator+ (SIMD a, SIMD b) { return _mm_add_pd(a.m_val, b.m_val); }
+    friend SIMD operator- (SIMD a, SIMD b) { return _mm_sub_pd(a.m_val, b.m_val); }
+    friend SIMD operator* (SIMD a, SIMD b) { return _mm_mul_pd(a.m_val, b.m_val); }
+  };
+#endif
+
+#if defined(__AVX__)
+  template <>
+  class SIMD<double, 4>
+  {
+    __m256d m_val;
+  public:
+    SIMD () = default;
+    SIMD (__m256d v) : m_val(v) { }
+    SIMD (double s) : m_val(_mm256_set1_pd(s)) { }
+    static SIMD load (const double * p) { return _mm256_load_pd(p); }
+    void store (double * p) const { _mm256_store_pd(p, m_val); }
+    __m256d val() const { return m_val; }
+
+    friend SIMD operator+ (SIMD a, SIMD b) { return _mm256_add_pd(a.m_val, b.m_val); }
+    friend SIMD operator- (SIMD a, SIMD b) { return _mm256_sub_pd(a.m_val, b.m_val); }
+    friend SIMD operator* (SIMD a, SIMD b) { return _mm256_mul_pd(a.m_val, b.m_val); }
+  };
+#endif
+
+#if defined(__AVX512F__)
+  template <>
+  class SIMD<double, 8>
+  {
+    __m512d m_val;
+  public:
+    SIMD () = default;
+    SIMD (__m512d v) : m_val(v) { }
+    SIMD (double s) : m_val(_mm512_set1_pd(s)) { }
+    static SIMD load (const double * p) { return _mm512_load_pd(p); }
+    void store (double * p) const { _mm512_store_pd(p, m_val); }
+    __m512d val() const { return m_val; }
+
+    friend SIMD operator+ (SIMD a, SIMD b) { return _mm512_add_pd(a.m_val, b.m_val); }
+    friend SIMD operator- (SIMD a, SIMD b) { return _mm512_sub_pd(a.m_val, b.m_val); }
+    friend SIMD operator* (SIMD a, SIMD b) { return _mm512_mul_pd(a.m_val, b.m_val); }
+  };
+#endif
+
+}
+
+#endif
@@ -0,0 +1,699 @@
+#ifndef SPARSEMATRIX_HPP
+#define SPARSEMATRIX_HPP
+
+#include <cstddef>
+#include <cmath>
+#include <complex>
+#include <vector>
+#include <queue>
+#include <algorithm>
+#include <functional>
+#include <numeric>
+#include <stdexcept>
+#include <ostream>
+
+#include <vector.hpp>
+#include <matrix.hpp>
+
+
+namespace ASC_ode
+{
+  using namespace nanoblas;
+
+
+  // Nonzero pattern under construction: column indices per row,
+  // duplicates allowed until the pattern is compressed into a SparseMatrix.
+  class SparsityPattern
+  {
+    size_t m_rows, m_cols;
+    std::vector<std::vector<size_t>> m_rowcols;
+  public:
+    SparsityPattern (size_t rows, size_t cols)
+      : m_rows(rows), m_cols(cols), m_rowcols(rows) { }
+
+    size_t rows() const { return m_rows; }
+    size_t cols() const { return m_cols; }
+
+    void add (size_t i, size_t j) { m_rowcols[i].push_back(j); }
+
+    // entries (firstrow+k, firstcol+k), k < n
+    void addDiag (size_t firstrow, size_t firstcol, size_t n)
+    {
+      for (size_t k = 0; k < n; k++)
+        add(firstrow+k, firstcol+k);
+    }
+
+    // full block of size h x w
+    void addBlock (size_t firstrow, size_t firstcol, size_t h, size_t w)
+    {
+      for (size_t i = 0; i < h; i++)
+        for (size_t j = 0; j < w; j++)
+          add(firstrow+i, firstcol+j);
+    }
+
+    // sorted, unique column indices of every row
+    const std::vector<std::vector<size_t>> & compress ()
+    {
+      for (auto & cols : m_rowcols)
+      {
+        std::sort(cols.begin(), cols.end());
+        cols.erase(std::unique(cols.begin(), cols.end()), cols.end());
+      }
+      return m_rowcols;
+    }
+  };
+
+
+  // Compressed sparse row matrix with a fixed pattern.
+  // Values are assigned or accumulated only at pattern positions.
+  template <typename T = double>
+  class SparseMatrix
+  {
+    size_t m_rows = 0, m_cols = 0;
+    std::vector<size_t> m_rowptr;   // start of every row in m_colind / m_val, size rows+1
+    std::vector<size_t> m_colind;
+    std::vector<T> m_val;
+  public:
+    static constexpr size_t none = size_t(-1);
+
+    SparseMatrix () : m_rowptr(1, 0) { }
+
+    SparseMatrix (SparsityPattern pattern)
+      : m_rows(pattern.rows()), m_cols(pattern.cols())
+    {
+      auto & rowcols = pattern.compress();
+      m_rowptr.resize(m_rows+1);
+      m_rowptr[0] = 0;
+      for (size_t i = 0; i < m_rows; i++)
+        m_rowptr[i+1] = m_rowptr[i] + rowcols[i].size();
+      m_colind.reserve(m_rowptr[m_rows]);
+      for (auto & cols : rowcols)
+        m_colind.insert(m_colind.end(), cols.begin(), cols.end());
+      m_val.assign(m_colind.size(), T(0));
+    }
+
+    size_t rows() const { return m_rows; }
+    size_t cols() const { return m_cols; }
+    size_t nze() const { return m_val.size(); }
+
+    // two matrices have the same pattern if these agree
+    const std::vector<size_t> & rowPointers() const { return m_rowptr; }
+    const std::vector<size_t> & columnIndices() const { return m_colind; }
+
+    size_t rowBegin (size_t i) const { return m_rowptr[i]; }
+    size_t rowEnd (size_t i) const { return m_rowptr[i+1]; }
+    size_t colIndex (size_t k) const { return m_colind[k]; }
+    T & value (size_t k) { return m_val[k]; }
+    const T & value (size_t k) const { return m_val[k]; }
+
+    // index of entry (i,j) in the value array, 'none' if outside the pattern
+    size_t position (size_t i, size_t j) const
+    {
+      auto first = m_colind.begin() + m_rowptr[i];
+      auto last = m_colind.begin() + m_rowptr[i+1];
+      auto it = std::lower_bound(first, last, j);
+      if (it == last || *it != j) return none;
+      return it - m_colind.begin();
+    }
+
+    T operator() (size_t i, size_t j) const
+    {
+      size_t k = position(i, j);
+      return k == none ? T(0) : m_val[k];
+    }
+
+    void add (size_t i, size_t j, T val)
+    {
+      size_t k = position(i, j);
+      if (k == none)
+        throw std::out_of_range("SparseMatrix::add: entry not in sparsity pattern");
+      m_val[k] += val;
+    }
+
+    SparseMatrix & operator= (T scal)
+    {
+      std::fill(m_val.begin(), m_val.end(), scal);
+      return *this;
+    }
+
+    // y = A x
+    void mult (VectorView<T> x, VectorView<T> y) const
+    {
+      for (size_t i = 0; i < m_rows; i++)
+      {
+        T sum = T(0);
+        for (size_t k = m_rowptr[i]; k < m_rowptr[i+1]; k++)
+          sum += m_val[k] * x(m_colind[k]);
+        y(i) = sum;
+      }
+    }
+
+    Matrix<T> toDense () const
+    {
+      Matrix<T> dense(m_rows, m_cols);
+      dense = T(0);
+      for (size_t i = 0; i < m_rows; i++)
+        for (size_t k = m_rowptr[i]; k < m_rowptr[i+1]; k++)
+          dense(i, m_colind[k]) = m_val[k];
+      return dense;
+    }
+  };
+
+
+  template <typename T>
+  std::ostream & operator<< (std::ostream & ost, const SparseMatrix<T> & mat)
+  {
+    for (size_t i = 0; i < mat.rows(); i++)
+    {
+      ost << i << ":";
+      for (size_t k = mat.rowBegin(i); k < mat.rowEnd(i); k++)
+        ost << " " << mat.colIndex(k) << ": " << mat.value(k);
+      ost << "\n";
+    }
+    return ost;
+  }
+
+
+  // pattern of A*B, entries offset by (firstrow, firstcol)
+  template <typename T>
+  void addProductPattern (const SparseMatrix<T> & a, const SparseMatrix<T> & b,
+                          SparsityPattern & pattern, size_t firstrow = 0, size_t firstcol = 0)
+  {
+    for (size_t i = 0; i < a.rows(); i++)
+      for (size_t ka = a.rowBegin(i); ka < a.rowEnd(i); ka++)
+      {
+        size_t k = a.colIndex(ka);
+        for (size_t kb = b.rowBegin(k); kb < b.rowEnd(k); kb++)
+          pattern.add(firstrow+i, firstcol+b.colIndex(kb));
+      }
+  }
+
+  // c(firstrow+i, firstcol+j) += fac * (A*B)(i,j), c must contain the product pattern
+  template <typename T>
+  void addProduct (const SparseMatrix<T> & a, const SparseMatrix<T> & b, SparseMatrix<T> & c,
+                   T fac = T(1), size_t firstrow = 0, size_t firstcol = 0)
+  {
+    for (size_t i = 0; i < a.rows(); i++)
+      for (size_t ka = a.rowBegin(i); ka < a.rowEnd(i); ka++)
+      {
+        size_t k = a.colIndex(ka);
+        T aik = fac * a.value(ka);
+        if (aik == T(0)) continue;
+        for (size_t kb = b.rowBegin(k); kb < b.rowEnd(k); kb++)
+          c.add(firstrow+i, firstcol+b.colIndex(kb), aik * b.value(kb));
+      }
+  }
+
+
+  // pattern of a + a^T without the diagonal, neighbours of every index
+  template <typename T>
+  std::vector<std::vector<size_t>> SymmetricAdjacency (const SparseMatrix<T> & a)
+  {
+    std::vector<std::vector<size_t>> adj(a.rows());
+    for (size_t i = 0; i < a.rows(); i++)
+      for (size_t k = a.rowBegin(i); k < a.rowEnd(i); k++)
+        if (size_t j = a.colIndex(k); j != i)
+          {
+            adj[i].push_back(j);
+            adj[j].push_back(i);
+          }
+    for (auto & nb : adj)
+      {
+        std::sort(nb.begin(), nb.end());
+        nb.erase(std::unique(nb.begin(), nb.end()), nb.end());
+      }
+    return adj;
+  }
+
+
+  // Nested dissection ordering of the symmetric pattern of a + a^T:
+  // perm[k] is the original index placed at position k.
+  //
+  // A connected part is split by the middle breadth-first level from a
+  // pseudo-peripheral vertex. Both halves are numbered first, recursively,
+  // the separating level last, so eliminating one half never fills the
+  // other. Parts of at most 'leafsize' indices are numbered in breadth-first
+  // order. On grid-like patterns the fill of the factors grows like
+  // n log n instead of n^1.5 for banded orderings.
+  template <typename T>
+  std::vector<size_t> NestedDissection (const SparseMatrix<T> & a, size_t leafsize = 64)
+  {
+    static constexpr size_t none = size_t(-1);
+    size_t n = a.rows();
+    auto adj = SymmetricAdjacency(a);
+
+    std::vector<size_t> perm;
+    perm.reserve(n);
+    std::vector<size_t> part(n, 0), level(n, 0), stamp(n, none);
+    size_t nparts = 1, sweep = 0;
+
+    // breadth-first order of the component of 'start' within part p
+    auto bfs = [&] (size_t start, size_t p)
+    {
+      sweep++;
+      std::vector<size_t> queue(1, start);
+      stamp[start] = sweep;
+      level[start] = 0;
+      for (size_t q = 0; q < queue.size(); q++)
+        for (size_t v : adj[queue[q]])
+          if (stamp[v] != sweep && part[v] == p)
+            {
+              stamp[v] = sweep;
+              level[v] = level[queue[q]] + 1;
+              queue.push_back(v);
+            }
+      return queue;
+    };
+
+    std::function<void(const std::vector<size_t>&, size_t)> dissectComponents;
+
+    // 'verts' is connected and forms part p
+    auto dissect = [&] (const std::vector<size_t> & verts, size_t p)
+    {
+      // two sweeps move the start to a far end of the part (pseudo-peripheral vertex)
+      size_t start = bfs(verts[0], p).back();
+      start = bfs(start, p).back();
+      auto order = bfs(start, p);
+      size_t nlevels = level[order.back()] + 1;
+
+      if (verts.size() <= leafsize || nlevels < 3)
+        {
+          perm.insert(perm.end(), order.begin(), order.end());
+          return;
+        }
+
+      // the level holding the median vertex separates, it must not be the first or last one
+      size_t mid = std::clamp(level[order[order.size()/2]], size_t(1), nlevels-2);
+      std::vector<size_t> first, second, separator;
+      size_t pfirst = nparts++, psecond = nparts++;
+      for (size_t v : order)
+        {
+          if (level[v] < mid) { part[v] = pfirst; first.push_back(v); }
+          else if (level[v] > mid) { part[v] = psecond; second.push_back(v); }
+          else { part[v] = none; separator.push_back(v); }
+        }
+      dissectComponents(first, pfirst);
+      dissectComponents(second, psecond);
+      perm.insert(perm.end(), separator.begin(), separator.end());
+    };
+
+    // 'verts' form part p, possibly not connected
+    dissectComponents = [&] (const std::vector<size_t> & verts, size_t p)
+    {
+      for (size_t v : verts)
+        {
+          if (part[v] != p) continue;
+          auto comp = bfs(v, p);
+          size_t pcomp = nparts++;
+          for (size_t w : comp)
+            part[w] = pcomp;
+          dissect(comp, pcomp);
+        }
+    };
+
+    std::vector<size_t> all(n);
+    std::iota(all.begin(), all.end(), 0);
+    dissectComponents(all, 0);
+    return perm;
+  }
+
+
+  // Sparse LU factorization by rows, with column pivoting.
+  //
+  // Rows are taken in nested dissection order. Each one is eliminated with
+  // the previous pivot rows in pivot order (fill-in included), then the
+  // pivot is chosen among its remaining columns. The diagonal is kept
+  // whenever it is within 'threshold' of the largest entry, so matrices with
+  // a strong diagonal keep the symmetric, fill-reducing order.
+  //
+  // The factors keep every structural entry, also those that are numerically
+  // zero. refactor() therefore reuses pivot order and structure of the last
+  // factor() for a matrix with the same pattern and only recomputes values.
+  template <typename T = double>
+  class SparseLU
+  {
+    static constexpr size_t none = size_t(-1);
+
+    size_t m_n = 0;
+    double m_threshold;
+    // L: multipliers of row i w.r.t. pivot steps k < i
+    std::vector<size_t> m_lptr, m_lstep;
+    std::vector<T> m_lval;
+    // U: remaining entries of pivot row i, pivot excluded
+    std::vector<size_t> m_uptr, m_ucol;
+    std::vector<T> m_uval;
+    std::vector<size_t> m_rowperm;  // row eliminated in step i
+    std::vector<size_t> m_pivcol;   // column eliminated in step i
+    std::vector<T> m_pivval;
+    std::vector<size_t> m_arowptr, m_acolind;   // pattern of the factored matrix
+    size_t m_analyses = 0;
+
+    // work arrays
+    std::vector<T> m_work;
+    std::vector<size_t> m_colstep;
+    std::vector<char> m_used;
+    std::vector<size_t> m_nzcols;
+    mutable std::vector<T> m_y;
+
+  public:
+    SparseLU (double threshold = 0.1) : m_threshold(threshold) { }
+
+    SparseLU (const SparseMatrix<T> & a, double threshold = 0.1)
+      : m_threshold(threshold) { factor(a); }
+
+    size_t size() const { return m_n; }
+    size_t nzeL() const { return m_lval.size(); }
+    size_t nzeU() const { return m_uval.size() + m_n; }
+    // number of full factorizations, i.e. pivot searches and structure builds
+    size_t analyses() const { return m_analyses; }
+
+    void factor (const SparseMatrix<T> & a)
+    {
+      if (a.rows() != a.cols())
+        throw std::invalid_argument("SparseLU: matrix must be square");
+      size_t n = m_n = a.rows();
+      m_arowptr = a.rowPointers();
+      m_acolind = a.columnIndices();
+      m_analyses++;
+
+      m_rowperm = NestedDissection(a);
+      m_lptr.assign(1, 0); m_lstep.clear(); m_lval.clear();
+      m_uptr.assign(1, 0); m_ucol.clear(); m_uval.clear();
+      m_pivcol.assign(n, none);
+      m_pivval.assign(n, T(0));
+      m_work.assign(n, T(0));
+      m_colstep.assign(n, none);
+      m_used.assign(n, false);
+
+      std::priority_queue<size_t, std::vector<size_t>, std::greater<size_t>> steps;
+
+      for (size_t i = 0; i < n; i++)
+      {
+        // scatter the row of step i
+        size_t row = m_rowperm[i];
+        m_nzcols.clear();
+        auto touch = [&] (size_t c)
+        {
+          if (m_used[c]) return;
+          m_used[c] = true;
+          m_nzcols.push_back(c);
+          if (m_colstep[c] != none) steps.push(m_colstep[c]);
+        };
+        for (size_t k = a.rowBegin(row); k < a.rowEnd(row); k++)
+        {
+          touch(a.colIndex(k));
+          m_work[a.colIndex(k)] += a.value(k);
+        }
+
+        // eliminate with earlier pivot rows, in pivot order
+        while (!steps.empty())
+        {
+          size_t k = steps.top();
+          steps.pop();
+          while (!steps.empty() && steps.top() == k) steps.pop();
+
+          size_t pc = m_pivcol[k];
+          T l = m_work[pc] / m_pivval[k];
+          m_work[pc] = T(0);
+          m_lstep.push_back(k);
+          m_lval.push_back(l);
+          for (size_t ku = m_uptr[k]; ku < m_uptr[k+1]; ku++)
+          {
+            touch(m_ucol[ku]);
+            m_work[m_ucol[ku]] -= l * m_uval[ku];
+          }
+        }
+        m_lptr.push_back(m_lval.size());
+
+        // pivot among the columns not yet eliminated
+        size_t piv = none;
+        double maxval = 0;
+        for (size_t c : m_nzcols)
+          if (m_colstep[c] == none && std::abs(m_work[c]) > maxval)
+          {
+            maxval = std::abs(m_work[c]);
+            piv = c;
+          }
+        if (piv == none)
+          throw std::domain_error("SparseLU: matrix is singular");
+        if (m_colstep[row] == none && m_used[row] && std::abs(m_work[row]) >= m_threshold * maxval)
+          piv = row;
+
+        m_pivcol[i] = piv;
+        m_pivval[i] = m_work[piv];
+        m_colstep[piv] = i;
+        for (size_t c : m_nzcols)
+        {
+          if (c != piv && m_colstep[c] == none)
+          {
+            m_ucol.push_back(c);
+            m_uval.push_back(m_work[c]);
+          }
+          m_work[c] = T(0);
+          m_used[c] = false;
+        }
+        m_uptr.push_back(m_uval.size());
+      }
+    }
+
+    // numeric factorization with the pivot order and structure of the last
+    // factor(), which is repeated if the pattern differs or a pivot got too small
+    void refactor (const SparseMatrix<T> & a)
+    {
+      if (m_analyses == 0 || a.rowPointers() != m_arowptr || a.columnIndices() != m_acolind)
+        {
+          factor(a);
+          return;
+        }
+
+      for (size_t i = 0; i < m_n; i++)
+        {
+          size_t row = m_rowperm[i];
+          for (size_t k = a.rowBegin(row); k < a.rowEnd(row); k++)
+            m_work[a.colIndex(k)] += a.value(k);
+
+          for (size_t kl = m_lptr[i]; kl < m_lptr[i+1]; kl++)
+            {
+              size_t k = m_lstep[kl];
+              size_t pc = m_pivcol[k];
+              T l = m_work[pc] / m_pivval[k];
+              m_work[pc] = T(0);
+              m_lval[kl] = l;
+              for (size_t ku = m_uptr[k]; ku < m_uptr[k+1]; ku++)
+                m_work[m_ucol[ku]] -= l * m_uval[ku];
+            }
+
+          size_t piv = m_pivcol[i];
+          double maxval = std::abs(m_work[piv]);
+          for (size_t ku = m_uptr[i]; ku < m_uptr[i+1]; ku++)
+            {
+              m_uval[ku] = m_work[m_ucol[ku]];
+              maxval = std::max(maxval, double(std::abs(m_uval[ku])));
+              m_work[m_ucol[ku]] = T(0);
+            }
+          m_pivval[i] = m_work[piv];
+          m_work[piv] = T(0);
+
+          if (std::abs(m_pivval[i]) == 0 || std::abs(m_pivval[i]) < m_threshold * maxval)
+            {
+              std::fill(m_work.begin(), m_work.end(), T(0));
+              factor(a);
+              return;
+            }
+        }
+    }
+
+    // solve A x = b
+    void solve (VectorView<T> b, VectorView<T> x) const
+    {
+      m_y.resize(m_n);
+      for (size_t i = 0; i < m_n; i++)
+      {
+        T sum = b(m_rowperm[i]);
+        for (size_t k = m_lptr[i]; k < m_lptr[i+1]; k++)
+          sum -= m_lval[k] * m_y[m_lstep[k]];
+        m_y[i] = sum;
+      }
+      for (size_t i = m_n; i-- > 0; )
+      {
+        T sum = m_y[i];
+        for (size_t k = m_uptr[i]; k < m_uptr[i+1]; k++)
+          sum -= m_uval[k] * x(m_ucol[k]);
+        x(m_pivcol[i]) = sum / m_pivval[i];
+      }
+    }
+  };
+
+
+  // Sparse Cholesky factorization  P A P^T = L L^T  of a symmetric positive
+  // definite matrix (both triangles stored), up-looking by rows.
+  //
+  // analyze() computes the ordering (nested dissection), the elimination
+  // tree and the structure of L. It is done by factor() only when the pattern
+  // differs from the last one, so refactoring a Jacobian with fixed pattern
+  // costs the numeric part only.
+  template <typename T = double>
+  class SparseCholesky
+  {
+    static constexpr size_t none = size_t(-1);
+
+    size_t m_n = 0;
+    std::vector<size_t> m_perm, m_pinv;       // position k holds original index m_perm[k]
+    std::vector<size_t> m_parent;             // elimination tree
+    std::vector<size_t> m_lp, m_li;           // L by columns, diagonal first
+    std::vector<T> m_lx;
+    std::vector<size_t> m_arowptr, m_acolind; // analyzed pattern
+    size_t m_analyses = 0;
+
+    // work arrays
+    std::vector<size_t> m_stack, m_mark, m_next, m_fill;
+    std::vector<T> m_work;
+    mutable std::vector<T> m_y;
+
+    // pattern of row k of L (without the diagonal) in topological order,
+    // returned in m_stack[top..n)
+    size_t ereach (const SparseMatrix<T> & a, size_t k)
+    {
+      size_t top = m_n;
+      m_mark[k] = k;
+      size_t row = m_perm[k];
+      for (size_t p = a.rowBegin(row); p < a.rowEnd(row); p++)
+        {
+          size_t i = m_pinv[a.colIndex(p)];
+          if (i > k) continue;
+          size_t len = 0;
+          for ( ; m_mark[i] != k; i = m_parent[i])
+            {
+              m_next[len++] = i;
+              m_mark[i] = k;
+            }
+          while (len > 0)
+            m_stack[--top] = m_next[--len];
+        }
+      return top;
+    }
+
+  public:
+    SparseCholesky () = default;
+    SparseCholesky (const SparseMatrix<T> & a) { factor(a); }
+
+    size_t size() const { return m_n; }
+    size_t nzeL() const { return m_lx.size(); }
+    size_t analyses() const { return m_analyses; }
+
+    void analyze (const SparseMatrix<T> & a)
+    {
+      if (a.rows() != a.cols())
+        throw std::invalid_argument("SparseCholesky: matrix must be square");
+      size_t n = m_n = a.rows();
+      m_arowptr = a.rowPointers();
+      m_acolind = a.columnIndices();
+      m_analyses++;
+
+      m_perm = NestedDissection(a);
+      m_pinv.assign(n, 0);
+      for (size_t k = 0; k < n; k++)
+        m_pinv[m_perm[k]] = k;
+
+      // elimination tree, with path compression through 'ancestor'
+      m_parent.assign(n, none);
+      std::vector<size_t> ancestor(n, none);
+      for (size_t k = 0; k < n; k++)
+        {
+          size_t row = m_perm[k];
+          for (size_t p = a.rowBegin(row); p < a.rowEnd(row); p++)
+            for (size_t i = m_pinv[a.colIndex(p)]; i != none && i < k; )
+              {
+                size_t inext = ancestor[i];
+                ancestor[i] = k;
+                if (inext == none) m_parent[i] = k;
+                i = inext;
+              }
+        }
+
+      // column counts from the row patterns
+      m_stack.assign(n, 0);
+      m_mark.assign(n, none);
+      m_next.assign(n, 0);
+      m_fill.assign(n, 0);
+      std::vector<size_t> count(n, 1);
+      for (size_t k = 0; k < n; k++)
+        for (size_t top = ereach(a, k); top < n; top++)
+          count[m_stack[top]]++;
+
+      m_lp.assign(n+1, 0);
+      for (size_t k = 0; k < n; k++)
+        m_lp[k+1] = m_lp[k] + count[k];
+      m_li.assign(m_lp[n], 0);
+      m_lx.assign(m_lp[n], T(0));
+      m_work.assign(n, T(0));
+      m_y.assign(n, T(0));
+    }
+
+    void factor (const SparseMatrix<T> & a)
+    {
+      if (m_analyses == 0 || a.rowPointers() != m_arowptr || a.columnIndices() != m_acolind)
+        analyze(a);
+
+      size_t n = m_n;
+      std::fill(m_mark.begin(), m_mark.end(), none);
+      for (size_t j = 0; j < n; j++)
+        m_fill[j] = m_lp[j];      // next free position in column j
+
+      for (size_t k = 0; k < n; k++)
+        {
+          size_t top = ereach(a, k);
+          size_t row = m_perm[k];
+          for (size_t p = a.rowBegin(row); p < a.rowEnd(row); p++)
+            {
+              size_t j = m_pinv[a.colIndex(p)];
+              if (j <= k) m_work[j] += a.value(p);
+            }
+          T d = m_work[k];
+          m_work[k] = T(0);
+
+          for ( ; top < n; top++)
+            {
+              size_t i = m_stack[top];
+              T lki = m_work[i] / m_lx[m_lp[i]];
+              m_work[i] = T(0);
+              for (size_t p = m_lp[i]+1; p < m_fill[i]; p++)
+                m_work[m_li[p]] -= m_lx[p] * lki;
+              d -= lki * lki;
+              size_t p = m_fill[i]++;
+              m_li[p] = k;
+              m_lx[p] = lki;
+            }
+          if (!(d > T(0)))
+            throw std::domain_error("SparseCholesky: matrix is not positive definite");
+          size_t p = m_fill[k]++;
+          m_li[p] = k;
+          m_lx[p] = std::sqrt(d);
+        }
+    }
+
+    // solve A x = b
+    void solve (VectorView<T> b, VectorView<T> x) const
+    {
+      for (size_t k = 0; k < m_n; k++)
+        m_y[k] = b(m_perm[k]);
+      for (size_t j = 0; j < m_n; j++)
+        {
+          m_y[j] /= m_lx[m_lp[j]];
+          for (size_t p = m_lp[j]+1; p < m_lp[j+1]; p++)
+            m_y[m_li[p]] -= m_lx[p] * m_y[j];
+        }
+      for (size_t j = m_n; j-- > 0; )
+        {
+          for (size_t p = m_lp[j]+1; p < m_lp[j+1]; p++)
+            m_y[j] -= m_lx[p] * m_y[m_li[p]];
+          m_y[j] /= m_lx[m_lp[j]];
+        }
+      for (size_t k = 0; k < m_n; k++)
+        x(m_perm[k]) = m_y[k];
+    }
+  };
+
+}
+
+#endif
@@ -0,0 +1,349 @@
+#ifndef STATICFUNC_HPP
+#define STATICFUNC_HPP
+
+#include <cstddef>
+#include <cmath>
+#include <memory>
+#include <stdexcept>
+#include <numbers>
+
+#include <vector.hpp>
+#include <autodiff.hpp>
+#include "nonlinfunc.hpp"
+
+
+namespace ASC_ode
+{
+  using namespace nanoblas;
+
+  // Fixed-dimension counterparts of NonlinearFunction and the time steppers,
+  // for small systems integrated very often. Dimensions are template
+  // parameters, state lives in Vec<N> on the stack, and functions are called
+  // through their concrete type (CRTP), so every evaluation inlines: no
+  // virtual dispatch, no heap allocation.
+
+
+  // dense H x W matrix on the stack
+  template <size_t H, size_t W>
+  class StaticMatrix
+  {
+    double m_data[H*W];
+  public:
+    double & operator() (size_t i, size_t j) { return m_data[i*W+j]; }
+    double operator() (size_t i, size_t j) const { return m_data[i*W+j]; }
+  };
+
+
+  // solves a x = b by Gaussian elimination with partial pivoting,
+  // a is overwritten, b receives x
+  template <size_t N>
+  void StaticSolve (StaticMatrix<N,N> & a, Vec<N> & b)
+  {
+    for (size_t k = 0; k < N; k++)
+      {
+        size_t piv = k;
+        for (size_t i = k+1; i < N; i++)
+          if (std::abs(a(i,k)) > std::abs(a(piv,k)))
+            piv = i;
+        if (a(piv,k) == 0.0)
+          throw std::domain_error("StaticSolve: matrix is singular");
+        if (piv != k)
+          {
+            for (size_t j = k; j < N; j++)
+              std::swap(a(k,j), a(piv,j));
+            std::swap(b(k), b(piv));
+          }
+        for (size_t i = k+1; i < N; i++)
+          {
+            double l = a(i,k) / a(k,k);
+            for (size_t j = k+1; j < N; j++)
+              a(i,j) -= l * a(k,j);
+            b(i) -= l * b(k);
+          }
+      }
+    for (size_t i = N; i-- > 0; )
+      {
+        double sum = b(i);
+        for (size_t j = i+1; j < N; j++)
+          sum -= a(i,j) * b(j);
+        b(i) = sum / a(i,i);
+      }
+  }
+
+
+  // CRTP base: DERIVED provides
+  //   template <typename T> void evaluateT (const Vec<NX,T> & x, Vec<NF,T> & f) const
+  // and gets evaluate and a FixedAutoDiff Jacobian. A derived class with a
+  // hand-coded Jacobian shadows evaluateWithDeriv.
+  template <typename DERIVED, size_t NX, size_t NF = NX>
+  class StaticFunction
+  {
+  public:
+    static constexpr size_t DimX = NX;
+    static constexpr size_t DimF = NF;
+
+    const DERIVED & derived() const { return static_cast<const DERIVED&>(*this); }
+
+    void evaluate (const Vec<NX> & x, Vec<NF> & f) const
+    {
+      derived().template evaluateT<double>(x, f);
+    }
+
+    void evaluateWithDeriv (const Vec<NX> & x, Vec<NF> & f, StaticMatrix<NF,NX> & df) const
+    {
+      Vec<NX, FixedAutoDiff<NX>> xad;
+      Vec<NF, FixedAutoDiff<NX>> fad;
+      for (size_t i = 0; i < NX; i++)
+        xad(i) = FixedAutoDiff<NX>(x(i), i);
+      derived().template evaluateT<FixedAutoDiff<NX>>(xad, fad);
+      for (size_t i = 0; i < NF; i++)
+        {
+          f(i) = fad(i).value();
+          for (size_t j = 0; j < NX; j++)
+            df(i,j) = fad(i).deriv()[j];
+        }
+    }
+
+    void evaluateDeriv (const Vec<NX> & x, StaticMatrix<NF,NX> & df) const
+    {
+      Vec<NF> f;
+      derived().evaluateWithDeriv(x, f, df);
+    }
+  };
+
+
+  // Newton's method for N unknowns; residual(x, r, dr) sets r and its Jacobian dr
+  template <size_t N, typename RESIDUAL>
+  void StaticNewtonSolver (RESIDUAL && residual, Vec<N> & x,
+                           double tol = 1e-10, int maxsteps = 10)
+  {
+    Vec<N> res;
+    StaticMatrix<N,N> jac;
+    for (int i = 0; i < maxsteps; i++)
+      {
+        residual(x, res, jac);
+        double err = 0;
+        for (size_t j = 0; j < N; j++)
+          err += res(j)*res(j);
+        if (std::sqrt(err) < tol) return;
+
+        StaticSolve(jac, res);
+        for (size_t j = 0; j < N; j++)
+          x(j) -= res(j);
+      }
+    throw std::domain_error("Newton did not converge");
+  }
+
+
+  // Steppers hold the function by value, it is typically a few doubles.
+
+  template <typename FUNC>
+  class StaticExplicitEuler
+  {
+    static constexpr size_t N = FUNC::DimX;
+    FUNC m_rhs;
+  public:
+    StaticExplicitEuler (const FUNC & rhs) : m_rhs(rhs) { }
+    void DoStep (double tau, Vec<N> & y) const
+    {
+      Vec<N> f;
+      m_rhs.evaluate(y, f);
+      for (size_t i = 0; i < N; i++)
+        y(i) += tau * f(i);
+    }
+  };
+
+  template <typename FUNC>
+  class StaticImprovedEuler
+  {
+    static constexpr size_t N = FUNC::DimX;
+    FUNC m_rhs;
+  public:
+    StaticImprovedEuler (const FUNC & rhs) : m_rhs(rhs) { }
+    void DoStep (double tau, Vec<N> & y) const
+    {
+      Vec<N> f, yhat;
+      m_rhs.evaluate(y, f);
+      for (size_t i = 0; i < N; i++)
+        yhat(i) = y(i) + tau/2 * f(i);
+      m_rhs.evaluate(yhat, f);
+      for (size_t i = 0; i < N; i++)
+        y(i) += tau * f(i);
+    }
+  };
+
+  template <typename FUNC>
+  class StaticImplicitEuler
+  {
+    static constexpr size_t N = FUNC::DimX;
+    FUNC m_rhs;
+  public:
+    StaticImplicitEuler (const FUNC & rhs) : m_rhs(rhs) { }
+    void DoStep (double tau, Vec<N> & y) const
+    {
+      // R(ynew) = ynew - yold - tau f(ynew)
+      Vec<N> yold = y;
+      StaticNewtonSolver<N>([&](const Vec<N> & ynew, Vec<N> & res, StaticMatrix<N,N> & jac)
+        {
+          m_rhs.evaluateWithDeriv(ynew, res, jac);
+          for (size_t i = 0; i < N; i++)
+            {
+              res(i) = ynew(i) - yold(i) - tau * res(i);
+              for (size_t j = 0; j < N; j++)
+                jac(i,j) = (i == j ? 1.0 : 0.0) - tau * jac(i,j);
+            }
+        }, y);
+    }
+  };
+
+  template <typename FUNC>
+  class StaticCrankNicolson
+  {
+    static constexpr size_t N = FUNC::DimX;
+    FUNC m_rhs;
+  public:
+    StaticCrankNicolson (const FUNC & rhs) : m_rhs(rhs) { }
+    void DoStep (double tau, Vec<N> & y) const
+    {
+      // R(ynew) = ynew - yold - tau/2 (f(yold) + f(ynew))
+      Vec<N> yold = y, fold;
+      m_rhs.evaluate(yold, fold);
+      StaticNewtonSolver<N>([&](const Vec<N> & ynew, Vec<N> & res, StaticMatrix<N,N> & jac)
+        {
+          m_rhs.evaluateWithDeriv(ynew, res, jac);
+          for (size_t i = 0; i < N; i++)
+            {
+              res(i) = ynew(i) - yold(i) - tau/2 * (fold(i) + res(i));
+              for (size_t j = 0; j < N; j++)
+                jac(i,j) = (i == j ? 1.0 : 0.0) - tau/2 * jac(i,j);
+            }
+        }, y);
+    }
+  };
+
+
+  // Wraps a static function as NonlinearFunction, so it can be used in
+  // function graphs and with the dynamic steppers. JacobianTraits are taken
+  // from FUNC::jacobianTraits() if it exists.
+  template <typename FUNC>
+  class StaticFunctionAdapter : public NonlinearFunction
+  {
+    static constexpr size_t NX = FUNC::DimX;
+    static constexpr size_t NF = FUNC::DimF;
+    FUNC m_func;
+  public:
+    StaticFunctionAdapter (const FUNC & func) : m_func(func) { }
+
+    const FUNC & func() const { return m_func; }
+
+    size_t dimX() const override { return NX; }
+    size_t dimF() const override { return NF; }
+
+    void evaluate (VectorView<double> x, VectorView<double> f) const override
+    {
+      Vec<NX> xs;
+      Vec<NF> fs;
+      for (size_t i = 0; i < NX; i++) xs(i) = x(i);
+      m_func.evaluate(xs, fs);
+      for (size_t i = 0; i < NF; i++) f(i) = fs(i);
+    }
+
+    void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const override
+    {
+      Vec<NX> xs;
+      StaticMatrix<NF,NX> dfs;
+      for (size_t i = 0; i < NX; i++) xs(i) = x(i);
+      m_func.evaluateDeriv(xs, dfs);
+      for (size_t i = 0; i < NF; i++)
+        for (size_t j = 0; j < NX; j++)
+          df(i,j) = dfs(i,j);
+    }
+
+    void evaluateWithDeriv (VectorView<double> x, VectorView<double> f,
+                            MatrixView<double> df) const override
+    {
+      Vec<NX> xs;
+      Vec<NF> fs;
+      StaticMatrix<NF,NX> dfs;
+      for (size_t i = 0; i < NX; i++) xs(i) = x(i);
+      m_func.evaluateWithDeriv(xs, fs, dfs);
+      for (size_t i = 0; i < NF; i++)
+        {
+          f(i) = fs(i);
+          for (size_t j = 0; j < NX; j++)
+            df(i,j) = dfs(i,j);
+        }
+    }
+
+    JacobianTraits jacobianTraits () const override
+    {
+      if constexpr (requires (const FUNC & func) { func.jacobianTraits(); })
+        return m_func.jacobianTraits();
+      else
+        return { };
+    }
+  };
+
+  template <typename FUNC>
+  auto MakeDynamic (const FUNC & func)
+  {
+    return std::make_shared<StaticFunctionAdapter<FUNC>>(func);
+  }
+
+
+  // PendulumAD with static dimensions
+  class StaticPendulum : public StaticFunction<StaticPendulum, 2>
+  {
+    double m_length;
+    double m_gravity;
+  public:
+    StaticPendulum (double length, double gravity=9.81) : m_length(length), m_gravity(gravity) {}
+
+    template <typename T>
+    void evaluateT (const Vec<2,T> & x, Vec<2,T> & f) const
+    {
+      f(0) = x(1);
+      f(1) = -m_gravity/m_length*sin(x(0));
+    }
+  };
+
+  // MassSpring of test_ode with static dimensions: x'' = -k/m x
+  class StaticMassSpring : public StaticFunction<StaticMassSpring, 2>
+  {
+    double m_mass;
+    double m_stiffness;
+  public:
+    StaticMassSpring (double mass, double stiffness) : m_mass(mass), m_stiffness(stiffness) {}
+
+    template <typename T>
+    void evaluateT (const Vec<2,T> & x, Vec<2,T> & f) const
+    {
+      f(0) = x(1);
+      f(1) = -m_stiffness/m_mass*x(0);
+    }
+
+    // linear: implicit steppers factor the Jacobian once per time step size
+    JacobianTraits jacobianTraits () const { return { true, true, false, 0 }; }
+  };
+
+  // ElectricNetwork of test_ode with static dimensions: RC circuit driven by
+  // cos(100 pi t), the time is the second unknown
+  class StaticElectricNetwork : public StaticFunction<StaticElectricNetwork, 2>
+  {
+    double m_resistivity;
+    double m_capacity;
+  public:
+    StaticElectricNetwork (double resistivity, double capacity)
+      : m_resistivity(resistivity), m_capacity(capacity) {}
+
+    template <typename T>
+    void evaluateT (const Vec<2,T> & x, Vec<2,T> & f) const
+    {
+      f(0) = (cos(100*std::numbers::pi*x(1)) - x(0)) / (m_resistivity*m_capacity);
+      f(1) = T(1.0);
+    }
+  };
+
+}
+
+#endif
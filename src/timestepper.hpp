@@ -5,6 +5,7 @@
 #include <exception>
 
 #include "Newton.hpp"
+#include "predictor.hpp"
 
 
 namespace ASC_ode
@@ -18,6 +19,8 @@ namespace ASC_ode
     TimeStepper(std::shared_ptr<NonlinearFunction> rhs) : m_rhs(rhs) {}
     virtual ~TimeStepper() = default;
     virtual void DoStep(double tau, VectorView<double> y) = 0;
+    // Newton counters and timers of all steps so far, empty for explicit methods
+    virtual NewtonStatistics statistics() const { return NewtonStatistics(); }
   };
 
   class ImprovedEuler : public TimeStepper
@@ -62,20 +65,38 @@ namespace ASC_ode
     std::shared_ptr<NonlinearFunction> m_equ;
     std::shared_ptr<Parameter> m_tau;
     std::shared_ptr<ConstantFunction> m_yold;
+    std::shared_ptr<NewtonWorkspace> m_newton;
+    ValuePredictor m_predictor;
   public:
     ImplicitEuler(std::shared_ptr<NonlinearFunction> rhs) 
     : TimeStepper(rhs), m_tau(std::make_shared<Parameter>(0.0)) 
     {
       m_yold = std::make_shared<ConstantFunction>(rhs->dimX());
       auto ynew = std::make_shared<IdentityFunction>(rhs->dimX());
-      m_equ = ynew - m_yold - m_tau * m_rhs;
+      m_equ = Simplify(ynew - m_yold - m_tau * m_rhs);
+      m_newton = std::make_shared<NewtonWorkspace>(m_equ);
+      m_newton->watch(m_tau);
+    }
+
+    // e.g. newton().setMode(NewtonMode::Simplified)
+    NewtonWorkspace & newton() { return *m_newton; }
+    NewtonStatistics statistics() const override { return m_newton->statistics(); }
+
+    // initial guess of Newton: Constant (y_n), Linear or Quadratic
+    void setPredictor (Predictor predictor)
+    {
+      if (predictor == Predictor::DenseOutput)
+        throw std::invalid_argument("ImplicitEuler: DenseOutput is the same as Linear");
+      m_predictor.set(predictor, m_rhs->dimX());
     }
 
     void DoStep(double tau, VectorView<double> y) override
     {
       m_yold->set(y);
       m_tau->set(tau);
-      NewtonSolver(m_equ, y);
+      m_predictor.predict(tau, y);
+      NewtonSolver(*m_newton, y);
+      m_predictor.update(tau, y);
     }
   };
 
@@ -83,9 +104,11 @@ namespace ASC_ode
 class CrankNicolson : public TimeStepper
 {
   std::shared_ptr<NonlinearFunction> m_equ;
-  std::shared_ptr<Parameter> m_tau;
+  std::shared_ptr<Parameter> m_tau;   // tau/2
   std::shared_ptr<ConstantFunction> m_yold;
   std::shared_ptr<ConstantFunction> m_fold;
+  std::shared_ptr<NewtonWorkspace> m_newton;
+  ValuePredictor m_predictor;
   Vector<> m_vecf_old;
 public:
   CrankNicolson(std::shared_ptr<NonlinearFunction> rhs)
@@ -95,9 +118,21 @@ public:
     m_fold(std::make_shared<ConstantFunction>(rhs->dimF())),
     m_vecf_old(rhs->dimF())
   {
-    // m_equ will be constructed in DoStep,  cause tau and f_old are first known there
+    //  R(y_new) = y_new - y_old - (tau/2)*(f_old + f(y_new)),
+    //  y_old, f_old and tau are updated in every step
+    auto ynew = std::make_shared<IdentityFunction>(rhs->dimX());
+    m_equ = Simplify(ynew - m_yold - m_tau * (m_fold + m_rhs));
+    m_newton = std::make_shared<NewtonWorkspace>(m_equ);
+    m_newton->watch(m_tau);
   }
 
+  NewtonWorkspace & newton() { return *m_newton; }
+  NewtonStatistics statistics() const override { return m_newton->statistics(); }
+
+  // initial guess of Newton: Constant (y_n), Linear, Quadratic or DenseOutput,
+  // which uses f(y_n) of the step and costs no evaluation
+  void setPredictor (Predictor predictor) { m_predictor.set(predictor, m_rhs->dimX()); }
+
   void DoStep(double tau, VectorView<double> y) override
   {
     // save old value y_old = y
@@ -106,14 +141,12 @@ public:
     // f_old = f(y_old)
     this->m_rhs->evaluate(y, m_vecf_old);
     m_fold->set(m_vecf_old);
+    m_tau->set(0.5 * tau);
 
-    //  R(y_new) = y_new - y_old - (tau/2)*(f_old + f(y_new))
-    auto ynew = std::make_shared<IdentityFunction>(this->m_rhs->dimX());
-    auto tau_param = std::make_shared<Parameter>(0.5 * tau);
-    m_equ = ynew - m_yold - tau_param * (m_fold + this->m_rhs);
-
-    // Newton solves R(y_new)=0, start value is current y
-    NewtonSolver(m_equ, y);
+    // Newton solves R(y_new)=0, start value is the prediction from y
+    m_predictor.predict(tau, y, m_vecf_old);
+    NewtonSolver(*m_newton, y);
+    m_predictor.update(tau, y);
   }
 };
 